@@ -0,0 +1,120 @@
+//*****************************************************************************
+//
+//  Helpers of the host benchmarks.
+//  File:     bench.h
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  Each benchmark reports the virtual time of the emulator per call, that is
+//  the time the board would wait for the SIM868, the AT commands sent per
+//  call and the host time per call, that is the CPU time of the library.
+//  It is included before sim868.c for the clock of POSIX.
+//
+//  Options:
+//  -n <calls>    Number of calls measured.
+//  -l <ms>       Extra latency of every reply of the emulator.
+//
+//*****************************************************************************
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#define _POSIX_C_SOURCE                             199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "sim868_emulator.h"
+
+//
+//  Bench.
+//  Calls: Number of calls measured.
+//  Latency: Extra latency of the replies in ms.
+//  Virtual/Commands: Virtual ms and commands at the start of the call.
+//  Host: Host ns at the start of the measure.
+//
+struct Bench
+{
+  uint32_t calls, latency;
+  uint32_t virtual_ms, commands;
+  uint64_t host_ns;
+  uint64_t total_virtual, total_commands;
+};
+static struct Bench gs_bench = { .calls = 100 };
+
+static inline uint64_t
+bench_host_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+static inline void
+bench_options(int argc, char **argv, uint32_t calls)
+{
+  int i;
+
+  gs_bench.calls = calls;
+  for (i = 1; i + 1 < argc; i += 2)
+  {
+    if (!strcmp(argv[i], "-n"))
+    {
+      gs_bench.calls = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (!strcmp(argv[i], "-l"))
+    {
+      gs_bench.latency = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+    }
+  }
+  if (gs_bench.calls == 0)
+  {
+    gs_bench.calls = 1;
+  }
+}
+
+//
+//  Starts a measure of a number of calls.
+//
+static inline void
+bench_start(void)
+{
+  gs_bench.total_virtual = 0;
+  gs_bench.total_commands = 0;
+  gs_bench.host_ns = bench_host_ns();
+}
+
+//
+//  Brackets each call, the set up between the calls is not counted in the
+//  virtual time.
+//
+static inline void
+bench_call_begin(void)
+{
+  gs_bench.virtual_ms = emu_now();
+  gs_bench.commands = emu_commands();
+}
+
+static inline void
+bench_call_end(void)
+{
+  gs_bench.total_virtual += emu_now() - gs_bench.virtual_ms;
+  gs_bench.total_commands += emu_commands() - gs_bench.commands;
+}
+
+static inline void
+bench_report(const char *name, uint32_t errors)
+{
+  double host_us = (double)(bench_host_ns() - gs_bench.host_ns) / 1000.0;
+
+  printf("%-38s %6lu calls %10.1f virtual ms/call %6.1f commands/call %10.2f host us/call %4lu errors\n",
+         name, (unsigned long)gs_bench.calls,
+         (double)gs_bench.total_virtual / gs_bench.calls,
+         (double)gs_bench.total_commands / gs_bench.calls,
+         host_us / gs_bench.calls, (unsigned long)errors);
+}
+
+#endif
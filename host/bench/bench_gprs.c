@@ -0,0 +1,70 @@
+//*****************************************************************************
+//
+//  Benchmark of SIM868_gprs_gsm_init().
+//  File:     bench_gprs.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The SIM868 is searching the network when the registration is queried,
+//  it registers 1.2 s later with a +CREG code, then the GPRS service
+//  is attached and the bearer is opened. A second call only checks the
+//  registration, the state of the GPRS service is cached.
+//
+//*****************************************************************************
+
+#include "bench.h"
+#include "sim868.c"
+
+static const struct Emu_Rule g_script[] =
+{
+  { "AT+COPS?", "\r\n+COPS: 0,0,\"TELCEL\"\r\n\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  { "AT+CSQ", "\r\n+CSQ: 18,0\r\n\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  { "AT+CREG=2", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+CREG?", "\r\n+CREG: 2,2\r\n\r\nOK\r\n", 20, "\r\n+CREG: 1,\"1A2B\",\"00C3D4E5\"\r\n", 1200, 0, 0, 1 },
+  { "AT+CREG?", "\r\n+CREG: 2,1,\"1A2B\",\"00C3D4E5\"\r\n\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  { "AT+CGREG=1", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+CGATT?", "\r\n+CGATT: 1\r\n\r\nOK\r\n", 40, 0, 0, 0, 0, 0 },
+  { "AT+SAPBR=2,1", "\r\n+SAPBR: 1,3,\"0.0.0.0\"\r\n\r\nOK\r\n", 30, 0, 0, 0, 0, 1 },
+  { "AT+SAPBR=2,1", "\r\n+SAPBR: 1,1,\"10.120.3.254\"\r\n\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+  { "AT+SAPBR=3,1", "\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+  { "AT+SAPBR=1,1", "\r\nOK\r\n", 1800, 0, 0, 0, 0, 0 },
+};
+
+int
+main(int argc, char **argv)
+{
+  uint32_t errors = 0;
+  uint32_t i;
+
+  bench_options(argc, argv, 200);
+
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    emu_reset();
+    emu_set_latency(gs_bench.latency);
+    emu_set_script(g_script, sizeof(g_script) / sizeof(g_script[0]));
+    memset(&gs_gprs_connection, 0, sizeof(gs_gprs_connection));
+    gs_gsm_registration.status = 0;
+    SIM868_gprs_set_apn(TELCEL);
+
+    bench_call_begin();
+    errors += (SIM868_gprs_gsm_init() != NO_ERROR);
+    bench_call_end();
+  }
+  bench_report("SIM868_gprs_gsm_init() cold", errors);
+
+  //
+  //  Registered, attached and connected.
+  //
+  errors = 0;
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    bench_call_begin();
+    errors += (SIM868_gprs_gsm_init() != NO_ERROR);
+    bench_call_end();
+  }
+  bench_report("SIM868_gprs_gsm_init() warm", errors);
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+//*****************************************************************************
+//
+//  Benchmark of SIM868_http_send_request().
+//  File:     bench_http.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  A POST of a JSON structure to a server that replies in 1.5 s, with a new
+//  Http session per request and with the session kept alive.
+//
+//*****************************************************************************
+
+#include "bench.h"
+#include "sim868.c"
+
+static const struct Emu_Rule g_script[] =
+{
+  { "AT+HTTPTERM", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+HTTPINIT", "\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  { "AT+HTTPPARA", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+HTTPDATA=", "\r\nDOWNLOAD\r\n", 10, 0, 0, "\r\nOK\r\n", 10, 0 },
+  { "AT+HTTPACTION=1", "\r\nOK\r\n", 10, "\r\n+HTTPACTION: 1,200,27\r\n", 1500, 0, 0, 0 },
+  { "AT+HTTPREAD", "\r\n+HTTPREAD: 27\r\n{\"status\":\"ok\",\"id\":86812}\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+};
+
+static char g_json[] = "{\"lat\":19.432608,\"lon\":-99.133209,\"speed\":42,\"id\":\"SIM868\"}";
+
+static void
+bench_requests(const char *name)
+{
+  uint32_t errors = 0;
+  uint32_t i;
+
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    bench_call_begin();
+    errors += (SIM868_http_send_request(POST, 1) != NO_ERROR);
+    bench_call_end();
+
+    if (SIM868_http_get_status_code() != 200)
+    {
+      errors++;
+    }
+  }
+  bench_report(name, errors);
+}
+
+int
+main(int argc, char **argv)
+{
+  bench_options(argc, argv, 200);
+
+  emu_reset();
+  emu_set_latency(gs_bench.latency);
+  emu_set_script(g_script, sizeof(g_script) / sizeof(g_script[0]));
+  SIM868_http_set_root("http://api.example.com");
+  SIM868_http_set_web_serivce("/v1/report");
+  SIM868_http_set_content_type("application/json");
+  SIM868_http_set_json_structure(g_json);
+
+  SIM868_http_set_keep_alive(false);
+  bench_requests("SIM868_http_send_request()");
+
+  SIM868_http_set_keep_alive(true);
+  bench_requests("SIM868_http_send_request() kept alive");
+
+  return 0;
+}
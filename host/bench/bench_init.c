@@ -0,0 +1,53 @@
+//*****************************************************************************
+//
+//  Benchmark of SIM868_init().
+//  File:     bench_init.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  A cold start auto bauds and saves the profile of the SIM868, a warm start
+//  after a reset of the MCU only probes it.
+//
+//*****************************************************************************
+
+#include "bench.h"
+#include "sim868.c"
+
+int
+main(int argc, char **argv)
+{
+  uint32_t errors = 0;
+  uint32_t i;
+
+  bench_options(argc, argv, 1000);
+
+  //
+  //  Cold start, the SIM868 was just powered with the echo on.
+  //
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    emu_reset();
+    emu_set_latency(gs_bench.latency);
+    gs_warm_start.key = 0;
+
+    bench_call_begin();
+    errors += (SIM868_init() != NO_ERROR);
+    bench_call_end();
+  }
+  bench_report("SIM868_init() cold", errors);
+
+  //
+  //  Warm start.
+  //
+  errors = 0;
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    bench_call_begin();
+    errors += (SIM868_init() != NO_ERROR);
+    bench_call_end();
+  }
+  bench_report("SIM868_init() warm", errors);
+
+  return 0;
+}
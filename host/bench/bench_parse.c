@@ -0,0 +1,166 @@
+//*****************************************************************************
+//
+//  Benchmark of the parsers of the replies and of the GNSS output.
+//  File:     bench_parse.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  parse_reply() reads the fields of a reply held in the sim ring, the NMEA
+//  parser is run over the replay log of a drive, first straight from memory
+//  and then as the GNSS port delivers it to SIM868_gnss_poll(), read from
+//  the UART driver or through the ring filled by SIM868_gnss_rx_block().
+//
+//*****************************************************************************
+
+#include "bench.h"
+#include "sim868.c"
+
+#define BENCH_LOG                                   "logs/drive.nmea"
+
+static const struct Emu_Rule g_script[] =
+{
+  { "AT+SAPBR=2,1", "\r\n+SAPBR: 1,1,\"10.120.3.254\"\r\n\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+};
+
+//
+//  Reads the sentences of the log, the comments are skipped.
+//
+static char *
+read_log(const char *path, uint32_t *length)
+{
+  FILE *file = fopen(path, "r");
+  char line[256];
+  char *text;
+  size_t n;
+
+  if (!file)
+  {
+    return NULL;
+  }
+
+  text = malloc(1024 * 1024);
+  *length = 0;
+  while (fgets(line, sizeof(line), file))
+  {
+    n = strcspn(line, "\r\n");
+    if (line[0] == '$' && *length + n + 2 < 1024 * 1024)
+    {
+      memcpy(&text[*length], line, n);
+      *length += n;
+      text[(*length)++] = '\r';
+      text[(*length)++] = '\n';
+    }
+  }
+  fclose(file);
+
+  return text;
+}
+
+static void
+bench_parse_reply(void)
+{
+  uint32_t errors = 0;
+  uint16_t value;
+  uint32_t i;
+
+  emu_reset();
+  emu_set_script(g_script, sizeof(g_script) / sizeof(g_script[0]));
+  get_reply("AT+SAPBR=2,1", DEFAULT_TIMEOUT);
+
+  bench_start();
+  for (i = 0; i < gs_bench.calls; i++)
+  {
+    errors += (parse_reply("+SAPBR: ", &value, ',', 1) || value != 1);
+  }
+  bench_report("parse_reply()", errors);
+}
+
+static void
+bench_nmea(const char *path)
+{
+  uint32_t length;
+  uint32_t calls = gs_bench.calls / 1000 + 1;
+  uint64_t start;
+  double ns;
+  char *text = read_log(path, &length);
+  uint32_t i;
+  uint32_t j;
+
+  if (!text)
+  {
+    printf("%s: not found\n", path);
+    return;
+  }
+
+  start = bench_host_ns();
+  for (i = 0; i < calls; i++)
+  {
+    memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+    for (j = 0; j < length; j++)
+    {
+      nmea_process_char(text[j]);
+    }
+  }
+  ns = (double)(bench_host_ns() - start) / ((double)calls * length);
+
+  printf("%-38s %6lu chars %10.2f host ns/char %10.1f MB/s %s\n", "nmea_process_char()",
+         (unsigned long)length, ns, 1000.0 / ns, gs_gnss_fix.valid ? "fixed" : "no fix");
+  free(text);
+}
+
+static void
+bench_replay(const char *path, uint8_t ring)
+{
+  struct SIM868_Stats stats;
+  char block[SIM868_GNSS_RX_LENGTH];
+  uint16_t length;
+  int epochs;
+  uint32_t fixes = 0;
+  uint64_t start;
+  int i;
+
+  emu_reset();
+  SIM868_clear_stats();
+  memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+  epochs = emu_gnss_load(path, 1000);
+  if (epochs <= 0)
+  {
+    printf("%s: not found\n", path);
+    return;
+  }
+
+  //
+  //  The GNSS is polled every 100 ms, as a main loop would, the ring gets
+  //  what a DMA transfer would have received in between.
+  //
+  start = bench_host_ns();
+  for (i = 0; i < epochs * 10; i++)
+  {
+    emu_advance(100);
+    for (length = 0; ring && length < sizeof(block) && emu_gnss_available(); length++)
+    {
+      block[length] = emu_gnss_read();
+    }
+    SIM868_gnss_rx_block(block, length);
+    SIM868_gnss_poll();
+    fixes += ((i % 10) == 9 && gs_gnss_fix.valid);
+  }
+
+  SIM868_get_stats(&stats);
+  printf("%-38s %6d epochs %10.2f host us/epoch %6lu fixes %6lu overruns\n",
+         ring ? "SIM868_gnss_rx_block() replay" : "SIM868_gnss_poll() replay",
+         epochs, (double)(bench_host_ns() - start) / 1000.0 / epochs, (unsigned long)fixes,
+         (unsigned long)stats.gnss_overruns);
+}
+
+int
+main(int argc, char **argv)
+{
+  bench_options(argc, argv, 1000000);
+
+  bench_parse_reply();
+  bench_nmea(BENCH_LOG);
+  bench_replay(BENCH_LOG, 0);
+  bench_replay(BENCH_LOG, 1);
+
+  return 0;
+}
@@ -0,0 +1,696 @@
+//*****************************************************************************
+//
+//  Scripted emulator of the SIM868 for the host build.
+//  File:     sim868_emulator.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The clock is virtual, it moves when the library waits (_debug_delay() and
+//  _sim_idle()), and one ms each time it only reads the tick for a while, so
+//  every run takes the same virtual time. The characters of both serial
+//  ports arrive at their baud rate after the latency of the reply.
+//
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sim868_emulator.h"
+
+//*****************************************************************************
+//
+//  The following are defines for the emulator.
+//
+//*****************************************************************************
+
+#define EMU_STREAM_LENGTH                           65536
+#define EMU_COMMAND_LENGTH                          1024
+#define EMU_LOG_LENGTH                              65536
+#define EMU_TICK_SPIN                               10000
+#define EMU_RULE_LENGTH                             64
+#define EMU_POWER_PULSE                             1000
+#define EMU_FLASH_ADDRESS                           0x00038000UL
+#define EMU_FLASH_LENGTH                            (64 * 1024)
+#define EMU_DEFAULT_LATENCY                         5
+#define EMU_SIM_BAUD                                115200
+#define EMU_GNSS_BAUD                               115200
+
+//*****************************************************************************
+//
+//  Structs for the emulator.
+//
+//*****************************************************************************
+
+//
+//  Stream.
+//  Characters sent to the library by one serial port, each with the time it
+//  arrives in us. Last is the time of the last character queued.
+//
+struct Emu_Stream
+{
+  char data[EMU_STREAM_LENGTH];
+  uint64_t at[EMU_STREAM_LENGTH];
+  uint32_t head, tail;
+  uint64_t last;
+  uint32_t byte_us;
+};
+
+//
+//  NMEA Replay.
+//  Text: Sentences of the log, the first type of sentence starts an epoch.
+//  Epoch: Offsets of the epochs in the text, one is sent each period.
+//
+struct Emu_Replay
+{
+  char *text;
+  uint32_t *epoch;
+  uint32_t epochs, next, period;
+  uint64_t next_at;
+  uint8_t enabled;
+};
+
+//
+//  Emulator.
+//
+struct Emu
+{
+  uint64_t now_us;
+  uint32_t spin;
+  struct Emu_Stream sim, gnss;
+  const struct Emu_Rule *rules;
+  uint16_t rule_count;
+  uint16_t used[EMU_RULE_LENGTH];
+  uint32_t extra_latency;
+  char command[EMU_COMMAND_LENGTH];
+  uint16_t command_length;
+  const struct Emu_Rule *data_rule;
+  uint8_t echo, power_state, power_level, gnss_enabled;
+  uint64_t power_since;
+  char log[EMU_LOG_LENGTH];
+  uint32_t log_length, commands;
+  uint32_t rtc;
+  uint8_t flash[EMU_FLASH_LENGTH];
+  struct Emu_Replay replay;
+};
+static struct Emu gs_emu;
+
+//*****************************************************************************
+//
+//  Private functions.
+//
+//*****************************************************************************
+
+static void
+stream_reset(struct Emu_Stream *stream, uint32_t baud)
+{
+  stream->head = 0;
+  stream->tail = 0;
+  stream->last = 0;
+  stream->byte_us = 10000000UL / baud;
+}
+
+static void
+stream_push(struct Emu_Stream *stream, const char *text, uint32_t length, uint64_t at)
+{
+  uint32_t i;
+
+  if (stream->last > at)
+  {
+    at = stream->last;
+  }
+
+  for (i = 0; i < length; i++)
+  {
+    if (((stream->head + 1) % EMU_STREAM_LENGTH) == stream->tail)
+    {
+      fprintf(stderr, "emulator: stream overflow\n");
+      exit(2);
+    }
+
+    at += stream->byte_us;
+    stream->data[stream->head] = text[i];
+    stream->at[stream->head] = at;
+    stream->head = (stream->head + 1) % EMU_STREAM_LENGTH;
+  }
+
+  stream->last = at;
+}
+
+static int
+stream_available(struct Emu_Stream *stream)
+{
+  return (stream->tail != stream->head && stream->at[stream->tail] <= gs_emu.now_us);
+}
+
+static char
+stream_read(struct Emu_Stream *stream)
+{
+  char c = stream->data[stream->tail];
+
+  stream->tail = (stream->tail + 1) % EMU_STREAM_LENGTH;
+
+  return c;
+}
+
+//
+//  Sends the epochs of the NMEA log that are due.
+//
+static void
+replay_pump(void)
+{
+  struct Emu_Replay *replay = &gs_emu.replay;
+  uint32_t start;
+  uint32_t end;
+
+  while (replay->enabled && gs_emu.gnss_enabled && replay->next_at <= gs_emu.now_us)
+  {
+    start = replay->epoch[replay->next % replay->epochs];
+    end = ((replay->next % replay->epochs) + 1 < replay->epochs) ?
+          replay->epoch[(replay->next % replay->epochs) + 1] : (uint32_t)strlen(replay->text);
+
+    stream_push(&gs_emu.gnss, &replay->text[start], end - start, replay->next_at);
+    replay->next++;
+    replay->next_at += (uint64_t)replay->period * 1000;
+  }
+}
+
+static void
+clock_advance_us(uint64_t us)
+{
+  gs_emu.now_us += us;
+  gs_emu.spin = 0;
+  replay_pump();
+}
+
+static void
+log_command(const char *command)
+{
+  size_t length = strlen(command);
+
+  gs_emu.commands++;
+  if (gs_emu.log_length + length + 2 < EMU_LOG_LENGTH)
+  {
+    memcpy(&gs_emu.log[gs_emu.log_length], command, length);
+    gs_emu.log_length += length;
+    gs_emu.log[gs_emu.log_length++] = '|';
+    gs_emu.log[gs_emu.log_length] = 0;
+  }
+}
+
+static void
+reply(const char *text, uint32_t latency)
+{
+  if (text)
+  {
+    stream_push(&gs_emu.sim, text, strlen(text),
+                gs_emu.now_us + ((uint64_t)(latency + gs_emu.extra_latency) * 1000));
+  }
+}
+
+//
+//  Replies to a command line, the script first and then the built-in
+//  commands.
+//
+static void
+command_done(const char *command)
+{
+  const struct Emu_Rule *rule;
+  uint16_t i;
+
+  log_command(command);
+
+  if (gs_emu.echo)
+  {
+    reply(command, 0);
+    reply("\r", 0);
+  }
+
+  for (i = 0; i < gs_emu.rule_count; i++)
+  {
+    rule = &gs_emu.rules[i];
+    if (strncmp(command, rule->prefix, strlen(rule->prefix)) == 0 &&
+        (rule->count == 0 || gs_emu.used[i] < rule->count))
+    {
+      gs_emu.used[i]++;
+      reply(rule->reply, rule->latency);
+      if (rule->urc)
+      {
+        reply(rule->urc, rule->urc_latency);
+      }
+
+      //
+      //  The raw data follows a DOWNLOAD or '>' prompt.
+      //
+      if (rule->data_reply || (rule->reply && (strstr(rule->reply, "DOWNLOAD") || strchr(rule->reply, '>'))))
+      {
+        gs_emu.data_rule = rule;
+      }
+      return;
+    }
+  }
+
+  if (!strcmp(command, "ATE0") || !strcmp(command, "ATE1"))
+  {
+    gs_emu.echo = (command[3] == '1');
+    reply("\r\nOK\r\n", EMU_DEFAULT_LATENCY);
+  }
+  else if (!strcmp(command, "AT") || !strncmp(command, "AT+IPR=", 7) || !strcmp(command, "AT&W"))
+  {
+    reply("\r\nOK\r\n", EMU_DEFAULT_LATENCY);
+  }
+  else
+  {
+    reply("\r\nERROR\r\n", EMU_DEFAULT_LATENCY);
+  }
+}
+
+//
+//  Replies to the raw data that follows a prompt, it is not echoed.
+//
+static void
+data_done(const char *data)
+{
+  const struct Emu_Rule *rule = gs_emu.data_rule;
+
+  log_command(data);
+
+  gs_emu.data_rule = NULL;
+  reply(rule->data_reply ? rule->data_reply : "\r\nOK\r\n", rule->data_latency);
+}
+
+//*****************************************************************************
+//
+//  Set up.
+//
+//*****************************************************************************
+
+void
+emu_reset(void)
+{
+  free(gs_emu.replay.text);
+  free(gs_emu.replay.epoch);
+  memset(&gs_emu, 0, sizeof(gs_emu));
+
+  stream_reset(&gs_emu.sim, EMU_SIM_BAUD);
+  stream_reset(&gs_emu.gnss, EMU_GNSS_BAUD);
+  memset(gs_emu.flash, 0xFF, sizeof(gs_emu.flash));
+  gs_emu.echo = 1;
+  gs_emu.power_state = 1;
+  gs_emu.gnss_enabled = 1;
+}
+
+void
+emu_set_script(const struct Emu_Rule *rules, uint16_t count)
+{
+  gs_emu.rules = rules;
+  gs_emu.rule_count = (count < EMU_RULE_LENGTH) ? count : EMU_RULE_LENGTH;
+  memset(gs_emu.used, 0, sizeof(gs_emu.used));
+}
+
+void
+emu_set_latency(uint32_t extra)
+{
+  gs_emu.extra_latency = extra;
+}
+
+void
+emu_set_baud(uint32_t sim_baud, uint32_t gnss_baud)
+{
+  gs_emu.sim.byte_us = 10000000UL / sim_baud;
+  gs_emu.gnss.byte_us = 10000000UL / gnss_baud;
+}
+
+void
+emu_set_power(uint8_t state)
+{
+  gs_emu.power_state = state;
+}
+
+//*****************************************************************************
+//
+//  Virtual clock.
+//
+//*****************************************************************************
+
+uint32_t
+emu_now(void)
+{
+  //
+  //  A loop that only reads the tick still moves the clock.
+  //
+  if (++gs_emu.spin > EMU_TICK_SPIN)
+  {
+    clock_advance_us(1000);
+  }
+
+  return (uint32_t)(gs_emu.now_us / 1000);
+}
+
+void
+emu_advance(uint32_t ms)
+{
+  clock_advance_us((uint64_t)ms * 1000);
+}
+
+//*****************************************************************************
+//
+//  Unsolicited result codes and NMEA replay.
+//
+//*****************************************************************************
+
+void
+emu_inject(const char *text, uint32_t delay)
+{
+  stream_push(&gs_emu.sim, text, strlen(text), gs_emu.now_us + ((uint64_t)delay * 1000));
+}
+
+void
+emu_gnss_feed(const char *text, uint32_t delay)
+{
+  stream_push(&gs_emu.gnss, text, strlen(text), gs_emu.now_us + ((uint64_t)delay * 1000));
+}
+
+//
+//  Loads a log of the GNSS output, the lines that do not start with '$' are
+//  skipped. Each epoch starts with the type of the first sentence and one is
+//  sent every period ms, from the start again at the end of the log.
+//
+int
+emu_gnss_load(const char *path, uint32_t period)
+{
+  struct Emu_Replay *replay = &gs_emu.replay;
+  FILE *file = fopen(path, "r");
+  char line[256];
+  char first[8] = { 0 };
+  size_t length = 0;
+  size_t size = 4096;
+  uint32_t epoch_size = 64;
+
+  if (!file)
+  {
+    return -1;
+  }
+
+  free(replay->text);
+  free(replay->epoch);
+  replay->text = malloc(size);
+  replay->epoch = malloc(epoch_size * sizeof(uint32_t));
+  replay->epochs = 0;
+  replay->text[0] = 0;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    size_t n = strcspn(line, "\r\n");
+
+    if (line[0] != '$' || n < 7)
+    {
+      continue;
+    }
+    line[n] = 0;
+
+    if (!first[0])
+    {
+      memcpy(first, &line[3], 3);
+    }
+    if (!strncmp(&line[3], first, 3))
+    {
+      if (replay->epochs == epoch_size)
+      {
+        epoch_size *= 2;
+        replay->epoch = realloc(replay->epoch, epoch_size * sizeof(uint32_t));
+      }
+      replay->epoch[replay->epochs++] = (uint32_t)length;
+    }
+
+    while (length + n + 3 > size)
+    {
+      size *= 2;
+      replay->text = realloc(replay->text, size);
+    }
+    memcpy(&replay->text[length], line, n);
+    length += n;
+    replay->text[length++] = '\r';
+    replay->text[length++] = '\n';
+    replay->text[length] = 0;
+  }
+  fclose(file);
+
+  if (replay->epochs == 0)
+  {
+    return -1;
+  }
+
+  replay->period = period;
+  replay->next = 0;
+  replay->next_at = gs_emu.now_us;
+  replay->enabled = 1;
+  replay_pump();
+
+  return (int)replay->epochs;
+}
+
+uint32_t
+emu_gnss_epochs(void)
+{
+  return gs_emu.replay.next;
+}
+
+//*****************************************************************************
+//
+//  Log of the commands.
+//
+//*****************************************************************************
+
+const char *
+emu_log(void)
+{
+  return gs_emu.log;
+}
+
+uint32_t
+emu_commands(void)
+{
+  return gs_emu.commands;
+}
+
+uint32_t
+emu_rtc(void)
+{
+  return gs_emu.rtc;
+}
+
+//*****************************************************************************
+//
+//  Hardware API of sim868.h.
+//
+//*****************************************************************************
+
+int
+emu_sim_available(void)
+{
+  return stream_available(&gs_emu.sim);
+}
+
+char
+emu_sim_read(void)
+{
+  return stream_read(&gs_emu.sim);
+}
+
+void
+emu_sim_clear(void)
+{
+  while (stream_available(&gs_emu.sim))
+  {
+    stream_read(&gs_emu.sim);
+  }
+}
+
+void
+emu_sim_write(const char *text)
+{
+  for (; *text; text++)
+  {
+    if (*text == '\r')
+    {
+      gs_emu.command[gs_emu.command_length] = 0;
+      if (gs_emu.data_rule)
+      {
+        data_done(gs_emu.command);
+      }
+      else
+      {
+        command_done(gs_emu.command);
+      }
+      gs_emu.command_length = 0;
+    }
+    else if (*text != '\n' && gs_emu.command_length < EMU_COMMAND_LENGTH - 1)
+    {
+      gs_emu.command[gs_emu.command_length++] = *text;
+    }
+  }
+}
+
+void
+emu_sim_write_array(const uint8_t *data, uint16_t length)
+{
+  char text[EMU_COMMAND_LENGTH];
+  uint16_t n = (length < EMU_COMMAND_LENGTH - 1) ? length : EMU_COMMAND_LENGTH - 1;
+
+  memcpy(text, data, n);
+  text[n] = 0;
+
+  if (gs_emu.data_rule)
+  {
+    data_done(text);
+  }
+  else
+  {
+    log_command(text);
+    reply("\r\nERROR\r\n", EMU_DEFAULT_LATENCY);
+  }
+}
+
+uint8_t
+emu_sim_state(void)
+{
+  return gs_emu.power_state;
+}
+
+//
+//  The power key toggles the state when it is held for a second.
+//
+void
+emu_sim_power(uint8_t level)
+{
+  if (gs_emu.power_level && !level &&
+      gs_emu.now_us - gs_emu.power_since >= (uint64_t)EMU_POWER_PULSE * 1000)
+  {
+    gs_emu.power_state = !gs_emu.power_state;
+    gs_emu.echo = 1;
+  }
+
+  if (level && !gs_emu.power_level)
+  {
+    gs_emu.power_since = gs_emu.now_us;
+  }
+  gs_emu.power_level = level;
+}
+
+void
+emu_sim_dtr(uint8_t level)
+{
+  (void)level;
+}
+
+int
+emu_gnss_available(void)
+{
+  return stream_available(&gs_emu.gnss);
+}
+
+char
+emu_gnss_read(void)
+{
+  return stream_read(&gs_emu.gnss);
+}
+
+void
+emu_gnss_clear(void)
+{
+  while (stream_available(&gs_emu.gnss))
+  {
+    stream_read(&gs_emu.gnss);
+  }
+}
+
+void
+emu_gnss_enable(uint8_t state)
+{
+  gs_emu.gnss_enabled = state;
+}
+
+void
+emu_debug(const char *text)
+{
+  if (getenv("SIM868_EMU_DEBUG"))
+  {
+    fputs(text, stderr);
+  }
+}
+
+void
+emu_delay(uint32_t ms)
+{
+  clock_advance_us((uint64_t)ms * 1000);
+}
+
+//
+//  The blocking functions wait here, one ms at a time so the time outs are
+//  checked as on the board.
+//
+void
+emu_idle(void)
+{
+  if (!stream_available(&gs_emu.sim))
+  {
+    clock_advance_us(1000);
+  }
+}
+
+void
+emu_rtc_set(uint32_t seconds)
+{
+  gs_emu.rtc = seconds;
+}
+
+uint8_t
+emu_flash_read(uint32_t address, void *buffer, uint16_t length)
+{
+  if (address < EMU_FLASH_ADDRESS || address - EMU_FLASH_ADDRESS + length > EMU_FLASH_LENGTH)
+  {
+    return 1;
+  }
+
+  memcpy(buffer, &gs_emu.flash[address - EMU_FLASH_ADDRESS], length);
+
+  return 0;
+}
+
+//
+//  Programming only clears bits, as the flash memory does.
+//
+uint8_t
+emu_flash_write(uint32_t address, const void *buffer, uint16_t length)
+{
+  const uint8_t *data = buffer;
+  uint16_t i;
+
+  if (address < EMU_FLASH_ADDRESS || address - EMU_FLASH_ADDRESS + length > EMU_FLASH_LENGTH)
+  {
+    return 1;
+  }
+
+  for (i = 0; i < length; i++)
+  {
+    gs_emu.flash[address - EMU_FLASH_ADDRESS + i] &= data[i];
+  }
+
+  return 0;
+}
+
+uint8_t
+emu_flash_erase(uint32_t address)
+{
+  if (address < EMU_FLASH_ADDRESS || address - EMU_FLASH_ADDRESS >= EMU_FLASH_LENGTH)
+  {
+    return 1;
+  }
+
+  //
+  //  The sector size of sim868.h.
+  //
+  memset(&gs_emu.flash[(address - EMU_FLASH_ADDRESS) & ~1023UL], 0xFF, 1024);
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+//*****************************************************************************
+//
+//  Prototypes for the SIM868 emulator.
+//  File:     sim868_emulator.h
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  Scripted emulator of the SIM868 for the host build. It stands behind the
+//  hardware API of sim868.h (see sim868_port_host.h), with a virtual clock,
+//  the serial ports paced at their baud rate, replies matched by the prefix
+//  of the commands, injected unsolicited result codes and NMEA logs replayed
+//  on the GNSS port.
+//
+//*****************************************************************************
+
+#ifndef __SIM868_EMULATOR_H__
+#define __SIM868_EMULATOR_H__
+
+#include <stdint.h>
+
+//*****************************************************************************
+//
+//  The following is a rule of the script of the emulator.
+//  Prefix: Commands it replies to, the first rule that matches is used.
+//  Reply/Latency: Text sent back and time to the first character in ms.
+//  Urc/Urc latency: Unsolicited result code sent after the reply, it can be
+//  null, e.g. the +HTTPACTION result.
+//  Data reply/Data latency: Text sent back to the raw data that follows a
+//  DOWNLOAD or '>' prompt, e.g. the OK of AT+HTTPDATA.
+//  Count: Number of times the rule is used, zero for always, so a later rule
+//  of the same prefix replies once it is used up, e.g. a bearer that opens.
+//
+//*****************************************************************************
+
+struct Emu_Rule
+{
+  const char *prefix;
+  const char *reply;
+  uint32_t latency;
+  const char *urc;
+  uint32_t urc_latency;
+  const char *data_reply;
+  uint32_t data_latency;
+  uint16_t count;
+};
+
+//*****************************************************************************
+//
+//  Prototypes for the emulator.
+//
+//*****************************************************************************
+
+//
+//  Set up.
+//
+extern void emu_reset(void);
+extern void emu_set_script(const struct Emu_Rule *rules, uint16_t count);
+extern void emu_set_latency(uint32_t extra);
+extern void emu_set_baud(uint32_t sim_baud, uint32_t gnss_baud);
+extern void emu_set_power(uint8_t state);
+
+//
+//  Virtual clock.
+//
+extern uint32_t emu_now(void);
+extern void emu_advance(uint32_t ms);
+
+//
+//  Unsolicited result codes and NMEA replay.
+//
+extern void emu_inject(const char *text, uint32_t delay);
+extern void emu_gnss_feed(const char *text, uint32_t delay);
+extern int emu_gnss_load(const char *path, uint32_t period);
+extern uint32_t emu_gnss_epochs(void);
+
+//
+//  Log of the commands received, separated by '|'.
+//
+extern const char *emu_log(void);
+extern uint32_t emu_commands(void);
+extern uint32_t emu_rtc(void);
+
+//
+//  Hardware API of sim868.h.
+//
+extern int emu_sim_available(void);
+extern char emu_sim_read(void);
+extern void emu_sim_clear(void);
+extern void emu_sim_write(const char *text);
+extern void emu_sim_write_array(const uint8_t *data, uint16_t length);
+extern uint8_t emu_sim_state(void);
+extern void emu_sim_power(uint8_t level);
+extern void emu_sim_dtr(uint8_t level);
+extern int emu_gnss_available(void);
+extern char emu_gnss_read(void);
+extern void emu_gnss_clear(void);
+extern void emu_gnss_enable(uint8_t state);
+extern void emu_debug(const char *text);
+extern void emu_delay(uint32_t ms);
+extern void emu_idle(void);
+extern void emu_rtc_set(uint32_t seconds);
+extern uint8_t emu_flash_read(uint32_t address, void *buffer, uint16_t length);
+extern uint8_t emu_flash_write(uint32_t address, const void *buffer, uint16_t length);
+extern uint8_t emu_flash_erase(uint32_t address);
+
+#endif
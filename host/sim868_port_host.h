@@ -0,0 +1,64 @@
+//*****************************************************************************
+//
+//  Port header of the host build.
+//  File:     sim868_port_host.h
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  Hardware API of sim868.h for a PC, every macro is served by the SIM868
+//  emulator (sim868_emulator.c). It is included by sim868.h when the library
+//  is built with -DSIM868_PORT_HEADER='"sim868_port_host.h"'.
+//
+//*****************************************************************************
+
+#ifndef __SIM868_PORT_HOST_H__
+#define __SIM868_PORT_HOST_H__
+
+#include "sim868_emulator.h"
+
+//
+//  SIM868 UART Interface
+//
+#define _sim_data_available()                       emu_sim_available()
+#define _sim_read_buffer()                          emu_sim_read()
+#define _sim_clear_buffer()                         emu_sim_clear()
+#define _sim_send_data(...)                         emu_sim_write(__VA_ARGS__)
+#define _sim_send_array(...)                        emu_sim_write_array(__VA_ARGS__)
+
+//
+//  SIM868 Power Control GPIO
+//
+#define _sim_state()                                emu_sim_state()
+#define _sim_pwm(...)                               emu_sim_power(__VA_ARGS__)
+#define _sim_dtr(...)                               emu_sim_dtr(__VA_ARGS__)
+
+//
+//  GNSS UART Interface
+//
+#define _gnss_data_available()                      emu_gnss_available()
+#define _gnss_read_buffer()                         emu_gnss_read()
+#define _gnss_clear_buffer()                        emu_gnss_clear()
+
+//
+//  GNSS Power Control GPIO
+//
+#define _gnss_enable(...)                           emu_gnss_enable(__VA_ARGS__)
+
+//
+//  Debugging output, delays and the virtual clock of the emulator. The
+//  blocking functions run the emulator while they wait.
+//
+#define _debug_put_string(...)                      emu_debug(__VA_ARGS__)
+#define _debug_delay(...)                           emu_delay(__VA_ARGS__)
+#define _sys_tick_ms()                              emu_now()
+#define _sim_idle()                                 emu_idle()
+#define _rtc_set(seconds)                           emu_rtc_set(seconds)
+
+//
+//  Flash memory and retention RAM.
+//
+#define _flash_read(...)                            emu_flash_read(__VA_ARGS__)
+#define _flash_write(...)                           emu_flash_write(__VA_ARGS__)
+#define _flash_erase(...)                           emu_flash_erase(__VA_ARGS__)
+#define SIM868_RETAINED
+
+#endif
@@ -0,0 +1,26 @@
+//*****************************************************************************
+//
+//  Checks of the host tests.
+//  File:     check.h
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  Each test includes sim868.c, so the private functions are reached, and
+//  reports the failed checks. The exit status is the number of failures.
+//
+//*****************************************************************************
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stdio.h>
+
+static int g_check_failures;
+
+#define CHECK(condition)                            do { if (!(condition)) { \
+                                                      printf("%s:%d: FAIL %s\n", __FILE__, __LINE__, #condition); \
+                                                      g_check_failures++; } } while (0)
+
+#define CHECK_DONE(name)                            (printf("%s: %s\n", (name), g_check_failures ? "FAIL" : "OK"), \
+                                                     g_check_failures)
+
+#endif
@@ -0,0 +1,299 @@
+//*****************************************************************************
+//
+//  Tests of the AT command engine against the SIM868 emulator.
+//  File:     test_at.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The blocking functions run the engine until the reply, so the virtual
+//  clock of the emulator measures the time each one waited.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+//
+//  Result of the asynchronous commands.
+//
+static struct
+{
+  uint8_t calls, error_status;
+} gs_done;
+
+//
+//  Unsolicited result codes passed to the application.
+//
+static struct
+{
+  uint8_t calls;
+  char last[32];
+} gs_urc;
+
+static void
+on_done(uint8_t error_status, void *context)
+{
+  (void)context;
+
+  gs_done.calls++;
+  gs_done.error_status = error_status;
+}
+
+static void
+on_urc(char *urc, void *context)
+{
+  (void)context;
+
+  gs_urc.calls++;
+  snprintf(gs_urc.last, sizeof(gs_urc.last), "%s", urc);
+}
+
+static uint16_t
+count(const char *command)
+{
+  const char *log = emu_log();
+  uint16_t n = 0;
+
+  while ((log = strstr(log, command)))
+  {
+    n++;
+    log++;
+  }
+
+  return n;
+}
+
+static void
+test_init(void)
+{
+  uint32_t commands;
+
+  //
+  //  Cold start: the echo is on until ATE0, then the profile is saved.
+  //
+  emu_reset();
+  CHECK(SIM868_init() == NO_ERROR);
+  CHECK(strcmp(emu_log(), "AT|ATE0|ATE0|AT+IPR=115200|AT&W|") == 0);
+  CHECK(gs_warm_start.key == WARM_START_KEY);
+
+  //
+  //  Warm start: a single probe.
+  //
+  commands = emu_commands();
+  CHECK(SIM868_init() == NO_ERROR);
+  CHECK(emu_commands() == commands + 1);
+
+  //
+  //  The profile is set again after a power cycle.
+  //
+  CHECK(SIM868_set_power_level(RESET) == NO_ERROR);
+  CHECK(gs_warm_start.key == 0);
+  commands = emu_commands();
+  CHECK(SIM868_init() == NO_ERROR);
+  CHECK(emu_commands() > commands + 1 && count("AT&W|") == 2);
+}
+
+static void
+test_replies(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CSQ", "\r\n+CSQ: 17,0\r\n\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+    { "AT+CPIN?", "\r\n+CME ERROR: 10\r\n", 20, 0, 0, 0, 0, 0 },
+    { "AT+SLOW", "\r\nOK\r\n", 800, 0, 0, 0, 0, 0 },
+    { "AT+NONE", 0, 0, 0, 0, 0, 0, 0 },
+  };
+  uint16_t value;
+  uint32_t start;
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  SIM868_at_set_adaptive_timeout(false);
+
+  start = emu_now();
+  get_reply("AT+CSQ", DEFAULT_TIMEOUT);
+  CHECK(!parse_reply("+CSQ: ", &value, ',', 0) && value == 17);
+  CHECK(!parse_reply("+CSQ: ", &value, ',', 1) && value == 0);
+  CHECK(emu_now() - start < 100);
+
+  CHECK(send_check_reply("AT+CPIN?", "OK", DEFAULT_TIMEOUT));
+  CHECK(send_check_reply("AT+UNKNOWN", "OK", DEFAULT_TIMEOUT));
+
+  //
+  //  The asynchronous commands complete in SIM868_poll().
+  //
+  memset(&gs_done, 0, sizeof(gs_done));
+  CHECK(SIM868_at_send_async("AT+CPIN?", DEFAULT_TIMEOUT, on_done, NULL) == NO_ERROR);
+  CHECK(gs_done.calls == 0);
+  at_wait_idle();
+  CHECK(gs_done.calls == 1 && gs_done.error_status == ERROR_REPLY);
+
+  //
+  //  A reply later than the time out, and no reply at all.
+  //
+  start = emu_now();
+  SIM868_at_send_async("AT+SLOW", DEFAULT_TIMEOUT, on_done, NULL);
+  at_wait_idle();
+  CHECK(gs_done.calls == 2 && gs_done.error_status == ERROR_TIMEOUT);
+  CHECK(emu_now() - start >= DEFAULT_TIMEOUT && emu_now() - start < DEFAULT_TIMEOUT + 50);
+
+  emu_advance(1000);
+  SIM868_at_send_async("AT+NONE", DEFAULT_TIMEOUT, on_done, NULL);
+  at_wait_idle();
+  CHECK(gs_done.calls == 3 && gs_done.error_status == ERROR_TIMEOUT);
+
+  SIM868_at_set_adaptive_timeout(true);
+}
+
+static void
+test_urcs(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n", 50, 0, 0, 0, 0, 0 },
+  };
+  uint16_t value;
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  SIM868_at_set_urc_callback(on_urc, NULL);
+  memset(&gs_urc, 0, sizeof(gs_urc));
+
+  //
+  //  Between the commands.
+  //
+  emu_inject("\r\nRING\r\n", 0);
+  emu_advance(10);
+  SIM868_poll();
+  CHECK(gs_urc.calls == 1 && !strcmp(gs_urc.last, "RING"));
+
+  //
+  //  In the middle of a reply, it is taken out before the reply is matched.
+  //
+  emu_inject("\r\n+CREG: 1,\"1A2B\",\"00C3D4E5\"\r\n", 20);
+  get_reply("AT+CSQ", DEFAULT_TIMEOUT);
+  CHECK(!parse_reply("+CSQ: ", &value, ',', 0) && value == 20);
+  CHECK(gs_urc.calls == 2 && !strncmp(gs_urc.last, "+CREG: 1", 8));
+  CHECK(SIM868_gsm_get_registration_status() == 1);
+  CHECK(SIM868_gsm_get_lac() == 0x1A2B && SIM868_gsm_get_cell_id() == 0xC3D4E5);
+
+  SIM868_at_set_urc_callback(NULL, NULL);
+}
+
+static uint8_t
+step_none(uint8_t depth)
+{
+  TASK_BEGIN(depth);
+  TASK_END(depth);
+}
+
+//
+//  Receives a code as the interrupt would, just before the next command is
+//  sent.
+//
+static void
+on_step_done(uint8_t error_status, void *context)
+{
+  const char *urcs = "\r\nRING\r\n\r\n+CREG: 5";
+
+  (void)error_status;
+  (void)context;
+
+  SIM868_rx_block(urcs, strlen(urcs));
+  SIM868_at_send_async("AT+CSQ", DEFAULT_TIMEOUT, on_done, NULL);
+}
+
+static void
+test_urc_dispatch(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n", 50, 0, 0, 0, 0, 0 },
+  };
+  const char *rest = ",\"1A2B\",\"00C3D4E5\"\r\n";
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  SIM868_at_set_urc_callback(on_urc, NULL);
+  memset(&gs_urc, 0, sizeof(gs_urc));
+  memset(&gs_done, 0, sizeof(gs_done));
+
+  //
+  //  The code received is dispatched, and the one still being received is
+  //  kept whole until its line is complete.
+  //
+  CHECK(!task_start(step_none, on_step_done, NULL));
+  SIM868_poll();
+  CHECK(gs_urc.calls == 1 && !strcmp(gs_urc.last, "RING"));
+
+  SIM868_rx_block(rest, strlen(rest));
+  at_wait_idle();
+  CHECK(gs_urc.calls == 2 && !strncmp(gs_urc.last, "+CREG: 5", 8));
+  CHECK(gs_done.calls == 1 && gs_done.error_status == NO_ERROR);
+  CHECK(reply_find("+CSQ: ") && !reply_find("+CREG"));
+
+  SIM868_at_set_urc_callback(NULL, NULL);
+}
+
+static void
+test_adaptive_timeout(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n", 100, 0, 0, 0, 0, 0 },
+  };
+  struct AT_Rto *rto;
+  uint8_t i;
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  memset(&gs_at_timeouts.rto, 0, sizeof(gs_at_timeouts.rto));
+  gs_at_timeouts.rssi = 20;
+
+  //
+  //  The requested time out is used until the round trip time is learned.
+  //
+  CHECK(at_timeout("AT+CSQ", 5000) == 5000);
+  for (i = 0; i < AT_RTO_SAMPLES; i++)
+  {
+    CHECK(!send_check_reply("AT+CSQ", "OK", 5000));
+  }
+
+  rto = &gs_at_timeouts.rto[gs_at_engine.rto];
+  CHECK(rto->samples == AT_RTO_SAMPLES);
+  CHECK(rto->srtt >= 100 && rto->srtt < 150);
+  CHECK(at_timeout("AT+CSQ", 5000) == AT_RTO_MIN);
+  CHECK(at_timeout("AT+CSQ", 200) == 200);
+  CHECK(at_timeout("AT+UNKNOWN", 5000) == 5000);
+
+  //
+  //  Each time out doubles the learned one, a reply resets it.
+  //
+  rto->srtt = 1000;
+  rto->rttvar = 0;
+  at_timeout("AT+CSQ", 60000);
+  at_rto_update(ERROR_TIMEOUT, 0);
+  CHECK(at_timeout("AT+CSQ", 60000) == 2000);
+  at_rto_update(ERROR_TIMEOUT, 0);
+  CHECK(at_timeout("AT+CSQ", 60000) == 4000);
+  at_rto_update(NO_ERROR, 1000);
+  CHECK(at_timeout("AT+CSQ", 60000) == 1000);
+
+  //
+  //  A low signal strength widens the radio commands.
+  //
+  gs_at_timeouts.rssi = RSSI_UNKNOWN;
+  CHECK(at_timeout("AT+CSQ", 60000) == 1000);
+  CHECK(at_timeout("AT+HTTPACTION=0", 60000) == 60000);
+}
+
+int
+main(void)
+{
+  test_init();
+  test_replies();
+  test_urcs();
+  test_urc_dispatch();
+  test_adaptive_timeout();
+
+  return CHECK_DONE("test_at");
+}
@@ -0,0 +1,233 @@
+//*****************************************************************************
+//
+//  Tests of the binary encoding of the report batch.
+//  File:     test_encode.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The record of SIM868_batch_encode() is decoded here and compared with the
+//  fixes added, the time of each fix is taken from the time service. The
+//  JSON array of SIM868_batch_send() is posted to the emulator.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+static uint32_t
+decode_varint(const uint8_t *buffer, uint16_t *i)
+{
+  uint32_t value = 0;
+  uint8_t shift = 0;
+
+  do
+  {
+    value |= (uint32_t)(buffer[*i] & 0x7F) << shift;
+    shift += 7;
+  } while (buffer[(*i)++] & 0x80);
+
+  return value;
+}
+
+static int32_t
+decode_zigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static void
+test_varint(void)
+{
+  uint8_t buffer[8];
+  uint16_t i;
+
+  CHECK(encode_varint(buffer, 0) == 1 && buffer[0] == 0);
+  CHECK(encode_varint(buffer, 127) == 1 && buffer[0] == 127);
+  CHECK(encode_varint(buffer, 128) == 2 && buffer[0] == 0x80 && buffer[1] == 0x01);
+  CHECK(encode_varint(buffer, 300) == 2 && buffer[0] == 0xAC && buffer[1] == 0x02);
+  CHECK(encode_varint(buffer, 0xFFFFFFFFUL) == 5 && buffer[4] == 0x0F);
+
+  i = 0;
+  encode_varint(buffer, 0x12345678UL);
+  CHECK(decode_varint(buffer, &i) == 0x12345678UL && i == 5);
+
+  CHECK(encode_zigzag(0) == 0);
+  CHECK(encode_zigzag(-1) == 1);
+  CHECK(encode_zigzag(1) == 2);
+  CHECK(encode_zigzag(-2) == 3);
+  CHECK(encode_zigzag(INT32_MAX) == 0xFFFFFFFEUL);
+  CHECK(encode_zigzag(INT32_MIN) == 0xFFFFFFFFUL);
+  CHECK(decode_zigzag(encode_zigzag(-180000000)) == -180000000);
+}
+
+static void
+test_batch(void)
+{
+  const int32_t lat[] = { 19432608, 19432650, 19432590, -33852050 };
+  const int32_t lon[] = { -99133209, -99133300, -99133100, 151208333 };
+  uint8_t buffer[2 + (BATCH_LENGTH * BATCH_ENCODED_FIX_LENGTH)];
+  int32_t last_lat = 0;
+  int32_t last_lon = 0;
+  uint32_t last_seconds = 0;
+  uint32_t seconds;
+  uint16_t length;
+  uint16_t i = 0;
+  uint8_t j;
+
+  //
+  //  The time service is synced at 2024-02-29 23:59:59.750.
+  //
+  gs_time_sync.valid = true;
+  gs_time_sync.seconds = 762566399UL;
+  gs_time_sync.ms = 750;
+  gs_time_sync.synced_at = emu_now();
+  gs_report_batch.count = 0;
+
+  for (j = 0; j < 4; j++)
+  {
+    SIM868_batch_add_position(lat[j], lon[j], 10 * j);
+    emu_advance(1100);
+  }
+
+  CHECK(SIM868_batch_encode(buffer, 2 + (3 * BATCH_ENCODED_FIX_LENGTH)) == 0);
+
+  length = SIM868_batch_encode(buffer, sizeof(buffer));
+  CHECK(length > 2 && length <= 2 + (4 * BATCH_ENCODED_FIX_LENGTH));
+  CHECK(buffer[i++] == BATCH_ENCODING_VERSION);
+  CHECK(buffer[i++] == 4);
+
+  for (j = 0; j < 4; j++)
+  {
+    last_lat += decode_zigzag(decode_varint(buffer, &i));
+    last_lon += decode_zigzag(decode_varint(buffer, &i));
+    last_seconds += decode_zigzag(decode_varint(buffer, &i));
+    CHECK(last_lat == lat[j] && last_lon == lon[j]);
+
+    //
+    //  1100 ms apart from 23:59:59.750.
+    //
+    seconds = 762566399UL + ((750 + (1100UL * j)) / 1000);
+    CHECK(last_seconds == seconds);
+    CHECK(decode_varint(buffer, &i) == (750 + (1100UL * j)) % 1000);
+    CHECK(buffer[i++] == 10 * j);
+  }
+  CHECK(i == length);
+}
+
+static void
+test_batch_full(void)
+{
+  uint8_t buffer[2 + (BATCH_LENGTH * BATCH_ENCODED_FIX_LENGTH)];
+  uint16_t i = 2;
+  uint8_t j;
+
+  //
+  //  Without the time service the time of the fix is used, the oldest fixes
+  //  are dropped once the batch is full. The fix has no date yet.
+  //
+  memset(&gs_time_sync, 0, sizeof(gs_time_sync));
+  memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+  gs_report_batch.count = 0;
+  gs_report_batch.head = 0;
+
+  for (j = 0; j < BATCH_LENGTH + 3; j++)
+  {
+    SIM868_batch_add_position(j, 0, 0);
+  }
+  CHECK(SIM868_batch_get_count() == BATCH_LENGTH);
+
+  SIM868_batch_encode(buffer, sizeof(buffer));
+  CHECK(buffer[1] == BATCH_LENGTH);
+  CHECK(decode_zigzag(decode_varint(buffer, &i)) == 3);
+  decode_varint(buffer, &i);
+  CHECK(decode_varint(buffer, &i) == 0);
+  CHECK(decode_varint(buffer, &i) == BATCH_UNDATED_MS);
+
+  batch_serialize(gs_report_batch.record, gs_report_batch.head, 1);
+  CHECK(!strcmp(g_batch_json, "[{\"lat\":0.000003,\"lon\":0.000000,\"speed\":0,\"time\":null}]"));
+}
+
+static void
+test_batch_undated(void)
+{
+  uint8_t buffer[2 + (BATCH_LENGTH * BATCH_ENCODED_FIX_LENGTH)];
+  uint16_t i = 2;
+  uint8_t j;
+
+  //
+  //  A fix without a date between two dated ones, the time of the last one
+  //  is the difference with the first one.
+  //
+  memset(&gs_time_sync, 0, sizeof(gs_time_sync));
+  memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+  gs_report_batch.count = 0;
+  gs_report_batch.head = 0;
+
+  gs_gnss_fix.time.year = 24;
+  gs_gnss_fix.time.month = 3;
+  gs_gnss_fix.time.day = 1;
+  SIM868_batch_add_position(1, 0, 0);
+  memset(&gs_gnss_fix.time, 0, sizeof(gs_gnss_fix.time));
+  SIM868_batch_add_position(2, 0, 0);
+  gs_gnss_fix.time.year = 24;
+  gs_gnss_fix.time.month = 3;
+  gs_gnss_fix.time.day = 1;
+  gs_gnss_fix.time.seconds = 5;
+  SIM868_batch_add_position(3, 0, 0);
+
+  SIM868_batch_encode(buffer, sizeof(buffer));
+  for (j = 0; j < 3; j++)
+  {
+    CHECK(decode_zigzag(decode_varint(buffer, &i)) == 1);
+    CHECK(decode_zigzag(decode_varint(buffer, &i)) == 0);
+    CHECK(decode_zigzag(decode_varint(buffer, &i)) == ((j == 0) ? 762566400L : (j == 1) ? 0 : 5));
+    CHECK(decode_varint(buffer, &i) == ((j == 1) ? BATCH_UNDATED_MS : 0));
+    i++;
+  }
+}
+
+static void
+test_batch_send(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+HTTPTERM", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+    { "AT+HTTPINIT", "\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+    { "AT+HTTPPARA", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+    { "AT+HTTPDATA=", "\r\nDOWNLOAD\r\n", 10, 0, 0, "\r\nOK\r\n", 10, 0 },
+    { "AT+HTTPACTION=1", "\r\nOK\r\n", 10, "\r\n+HTTPACTION: 1,200,2\r\n", 500, 0, 0, 0 },
+    { "AT+HTTPREAD", "\r\n+HTTPREAD: 2\r\n{}\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+  };
+  char json[] = "{\"id\":\"SIM868\"}";
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  SIM868_http_set_root("http://api.example.com");
+  SIM868_http_set_web_serivce("/v1/report");
+  SIM868_http_set_json_structure(json);
+  gs_report_batch.count = 0;
+  gs_report_batch.head = 0;
+
+  //
+  //  The batch is posted in place of the json structure of the host, which
+  //  is kept for its own requests.
+  //
+  SIM868_batch_add_position(19432608, -99133209, 42);
+  CHECK(SIM868_batch_send(1) == NO_ERROR);
+  CHECK(SIM868_batch_get_count() == 0);
+  CHECK(strstr(emu_log(), "AT+HTTPDATA=") != NULL);
+  CHECK(gs_http_header.json_structure == json);
+}
+
+int
+main(void)
+{
+  emu_reset();
+
+  test_varint();
+  test_batch();
+  test_batch_full();
+  test_batch_undated();
+  test_batch_send();
+
+  return CHECK_DONE("test_encode");
+}
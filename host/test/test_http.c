@@ -0,0 +1,161 @@
+//*****************************************************************************
+//
+//  Tests of the asynchronous Http requests against the SIM868 emulator.
+//  File:     test_http.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The requests are started and SIM868_poll() is run until the server
+//  replied, the response is read afterwards with SIM868_http_read_stream().
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+static const struct Emu_Rule g_script[] =
+{
+  { "AT+HTTPTERM", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+HTTPINIT", "\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  { "AT+HTTPPARA", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+  { "AT+HTTPACTION=0", "\r\nOK\r\n", 10, "\r\n+HTTPACTION: 0,200,2\r\n", 500, 0, 0, 0 },
+  { "AT+HTTPREAD", "\r\n+HTTPREAD: 2\r\n{}\r\nOK\r\n", 30, 0, 0, 0, 0, 0 },
+};
+
+static uint16_t gs_read;
+
+//
+//  Result of the asynchronous request.
+//
+static struct
+{
+  uint8_t calls, error_status;
+  uint16_t status_code;
+  uint32_t length;
+} gs_done;
+
+static void
+on_request(uint8_t error_status, uint16_t status_code, uint32_t length, void *context)
+{
+  (void)context;
+
+  gs_done.calls++;
+  gs_done.error_status = error_status;
+  gs_done.status_code = status_code;
+  gs_done.length = length;
+}
+
+//
+//  Runs the engine until the request is completed, as a main loop would.
+//
+static void
+run_request(void)
+{
+  uint16_t i;
+
+  for (i = 0; i < 1000 && SIM868_http_is_pending(); i++)
+  {
+    emu_advance(10);
+    SIM868_poll();
+  }
+}
+
+static void
+on_data(char *data, uint16_t length, void *context)
+{
+  (void)data;
+  (void)context;
+
+  gs_read += length;
+}
+
+static void
+test_read_busy(void)
+{
+  uint32_t commands;
+
+  emu_reset();
+  emu_set_script(g_script, sizeof(g_script) / sizeof(g_script[0]));
+  SIM868_http_set_root("http://api.example.com");
+  SIM868_http_set_web_serivce("/v1/config");
+
+  //
+  //  Nothing is read while the task of the request is running.
+  //
+  gs_http_request.data_left = true;
+  CHECK(SIM868_http_send_request_async(GET, 1, NULL, NULL) == NO_ERROR);
+  CHECK(SIM868_http_read_stream(on_data, 0, NULL) == ERROR_HTTP_BUSY);
+  CHECK(gs_read == 0);
+  task_wait();
+
+  //
+  //  Nor while an asynchronous request waits for the server.
+  //
+  commands = emu_commands();
+  gs_http_request.data_left = true;
+  gs_http_request.pending = true;
+  CHECK(SIM868_http_read_stream(on_data, 0, NULL) == ERROR_HTTP_BUSY);
+  CHECK(gs_read == 0 && emu_commands() == commands);
+  gs_http_request.pending = false;
+}
+
+static void
+test_request_async(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+HTTPTERM", "\r\nOK\r\n", 10, 0, 0, 0, 0, 0 },
+    { "AT+HTTPINIT", "\r\nOK\r\n", 20, 0, 0, 0, 0, 0 },
+  };
+
+  emu_reset();
+  emu_set_script(g_script, sizeof(g_script) / sizeof(g_script[0]));
+  memset(&gs_done, 0, sizeof(gs_done));
+  gs_read = 0;
+
+  //
+  //  The request returns before any command is sent.
+  //
+  CHECK(SIM868_http_request_async(GET, on_request, NULL) == NO_ERROR);
+  CHECK(SIM868_http_is_pending() && emu_commands() == 0);
+  CHECK(SIM868_http_request_async(GET, on_request, NULL) == ERROR_HTTP_BUSY);
+
+  run_request();
+  CHECK(gs_done.calls == 1 && gs_done.error_status == NO_ERROR);
+  CHECK(gs_done.status_code == 200 && gs_done.length == 2);
+  CHECK(strstr(emu_log(), "AT+HTTPACTION=0|") != NULL);
+
+  CHECK(SIM868_http_read_stream(on_data, 0, NULL) == NO_ERROR);
+  CHECK(gs_read == 2);
+
+  //
+  //  Another task is running.
+  //
+  CHECK(!task_start(task_http_init, NULL, NULL));
+  CHECK(SIM868_http_request_async(GET, on_request, NULL) == ERROR_TASK_BUSY);
+  CHECK(!SIM868_http_is_pending());
+  task_wait();
+
+  //
+  //  The error of the step that failed is passed to the callback, the Http
+  //  parameters are refused.
+  //
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  SIM868_http_set_web_serivce("/v1/status");
+  memset(&gs_done, 0, sizeof(gs_done));
+
+  CHECK(SIM868_http_request_async(GET, on_request, NULL) == NO_ERROR);
+  run_request();
+  CHECK(gs_done.calls == 1 && gs_done.error_status == ERROR_REPLY);
+  CHECK(SIM868_http_get_error_status() == ERROR_REPLY);
+  CHECK(strstr(emu_log(), "AT+HTTPACTION") == NULL);
+}
+
+int
+main(void)
+{
+  test_read_busy();
+  test_request_async();
+
+  return CHECK_DONE("test_http");
+}
@@ -0,0 +1,181 @@
+//*****************************************************************************
+//
+//  Tests of the MQTT packets received.
+//  File:     test_mqtt.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The PUBLISH packets are passed to mqtt_handle() as the receive loop does,
+//  the ones that do not fit their own length are dropped without reading
+//  past them.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+//
+//  Last message passed to the callback.
+//
+static struct
+{
+  uint16_t calls;
+  char topic[64];
+  uint16_t topic_length;
+  uint8_t payload[64];
+  uint16_t length;
+} gs_message;
+
+static void
+on_message(char *topic, uint16_t topic_length, uint8_t *payload, uint16_t length, void *context)
+{
+  (void)context;
+
+  gs_message.calls++;
+  gs_message.topic_length = topic_length;
+  gs_message.length = length;
+  memcpy(gs_message.topic, topic, topic_length < sizeof(gs_message.topic) ? topic_length : sizeof(gs_message.topic));
+  memcpy(gs_message.payload, payload, length < sizeof(gs_message.payload) ? length : sizeof(gs_message.payload));
+}
+
+//
+//  Handles a packet copied to the heap, so the sanitizer catches any read
+//  past its length.
+//
+static void
+handle(const uint8_t *packet, uint16_t length, uint16_t header)
+{
+  uint8_t *copy = malloc(length);
+
+  memcpy(copy, packet, length);
+  mqtt_handle(copy, length, header);
+  free(copy);
+}
+
+static void
+test_publish(void)
+{
+  const uint8_t qos0[] = { 0x30, 7, 0x00, 0x03, 'a', '/', 'b', 'h', 'i' };
+  const uint8_t empty[] = { 0x30, 5, 0x00, 0x03, 'a', '/', 'b' };
+
+  memset(&gs_message, 0, sizeof(gs_message));
+  handle(qos0, sizeof(qos0), 2);
+  CHECK(gs_message.calls == 1);
+  CHECK(gs_message.topic_length == 3 && !memcmp(gs_message.topic, "a/b", 3));
+  CHECK(gs_message.length == 2 && !memcmp(gs_message.payload, "hi", 2));
+
+  handle(empty, sizeof(empty), 2);
+  CHECK(gs_message.calls == 2 && gs_message.length == 0);
+}
+
+static void
+test_truncated(void)
+{
+  const uint8_t no_topic[] = { 0x30, 1, 0x00 };
+  const uint8_t short_topic[] = { 0x30, 4, 0x00, 0x05, 'a', '/' };
+  const uint8_t no_id[] = { 0x32, 6, 0x00, 0x03, 'a', '/', 'b', 0x00 };
+
+  memset(&gs_message, 0, sizeof(gs_message));
+
+  handle(no_topic, 2, 2);
+  handle(no_topic, sizeof(no_topic), 2);
+  handle(short_topic, sizeof(short_topic), 2);
+  handle(no_id, sizeof(no_id), 2);
+  CHECK(gs_message.calls == 0);
+}
+
+static void
+test_oversized(void)
+{
+  //
+  //  The topic length wraps around a 16 bit index back into the packet.
+  //
+  const uint8_t wrap[] = { 0x30, 8, 0xFF, 0xFE, 'a', '/', 'b', 'h', 'i', '!' };
+  const uint8_t wrap_qos[] = { 0x32, 8, 0xFF, 0xFC, 'a', '/', 'b', 'h', 'i', '!' };
+  const uint8_t full[] = { 0x30, 8, 0xFF, 0xFF, 'a', '/', 'b', 'h', 'i', '!' };
+
+  memset(&gs_message, 0, sizeof(gs_message));
+
+  handle(wrap, sizeof(wrap), 2);
+  handle(wrap_qos, sizeof(wrap_qos), 2);
+  handle(full, sizeof(full), 2);
+  CHECK(gs_message.calls == 0);
+}
+
+static void
+test_qos(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CIPSEND=", "\r\n> ", 5, 0, 0, "\r\nSEND OK\r\n", 20, 0 },
+  };
+  const uint8_t qos1[] = { 0x32, 9, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'h', 'i' };
+  const uint8_t qos2[] = { 0x34, 9, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'h', 'i' };
+  const uint8_t qos3[] = { 0x36, 9, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'h', 'i' };
+
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  gs_socket.connected = true;
+  memset(&gs_message, 0, sizeof(gs_message));
+
+  //
+  //  QoS 1 is acknowledged with the packet identifier.
+  //
+  handle(qos1, sizeof(qos1), 2);
+  CHECK(gs_message.calls == 1 && gs_message.length == 2 && !memcmp(gs_message.payload, "hi", 2));
+  CHECK(strstr(emu_log(), "AT+CIPSEND=4|") != NULL);
+  CHECK(emu_commands() == 2);
+
+  //
+  //  QoS 2 is not supported, it is not answered with a PUBACK.
+  //
+  handle(qos2, sizeof(qos2), 2);
+  CHECK(gs_message.calls == 1);
+  CHECK(emu_commands() == 2);
+
+  //
+  //  QoS 3 is reserved.
+  //
+  handle(qos3, sizeof(qos3), 2);
+  CHECK(gs_message.calls == 1);
+  CHECK(emu_commands() == 2);
+}
+
+static void
+test_remaining_length(void)
+{
+  const struct Emu_Rule script[] =
+  {
+    { "AT+CIPRXGET=2,", "\r\n+CIPRXGET: 2,6,0\r\n\x30\xFF\xFF\xFF\xFF\x01\r\nOK\r\n", 5, 0, 0, 0, 0, 0 },
+    { "AT+CIPCLOSE=1", "\r\nCLOSE OK\r\n", 5, 0, 0, 0, 0, 0 },
+  };
+
+  emu_reset();
+  emu_set_script(script, sizeof(script) / sizeof(script[0]));
+  gs_socket.connected = true;
+  gs_socket.available = true;
+  gs_mqtt_client.connected = true;
+  memset(&gs_message, 0, sizeof(gs_message));
+
+  //
+  //  A fifth byte of remaining length is a protocol error, the connection is
+  //  closed instead of waiting for the packet forever.
+  //
+  mqtt_receive();
+  CHECK(gs_message.calls == 0);
+  CHECK(!gs_mqtt_client.connected && gs_mqtt_client.rx_length == 0);
+  CHECK(strstr(emu_log(), "AT+CIPCLOSE=1|") != NULL);
+}
+
+int
+main(void)
+{
+  emu_reset();
+  SIM868_mqtt_set_callback(on_message, NULL);
+
+  test_publish();
+  test_truncated();
+  test_oversized();
+  test_qos();
+  test_remaining_length();
+
+  return CHECK_DONE("test_mqtt");
+}
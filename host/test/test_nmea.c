@@ -0,0 +1,250 @@
+//*****************************************************************************
+//
+//  Tests of the NMEA parser.
+//  File:     test_nmea.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The sentences are fed one character at a time, as the GNSS port does, and
+//  their checksum is computed here so each one can be altered.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+//
+//  Feeds the characters as they are.
+//
+static void
+feed_raw(const char *text)
+{
+  for (; *text; text++)
+  {
+    nmea_process_char(*text);
+  }
+}
+
+//
+//  Feeds a sentence from '$' to '*' followed by its checksum, or by another
+//  one when bad is set.
+//
+static void
+feed(const char *sentence, uint8_t bad)
+{
+  char trailer[6];
+  uint8_t checksum = 0;
+  const char *c;
+
+  for (c = sentence + 1; *c && *c != '*'; c++)
+  {
+    checksum ^= (uint8_t)*c;
+  }
+  sprintf(trailer, "%02X\r\n", (unsigned)(checksum ^ (bad ? 0x01 : 0x00)));
+
+  feed_raw(sentence);
+  feed_raw(trailer);
+}
+
+static void
+reset(void)
+{
+  memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+  memset(&gs_nmea_parser, 0, sizeof(gs_nmea_parser));
+  memset(&gs_time_sync, 0, sizeof(gs_time_sync));
+}
+
+static void
+test_rmc(void)
+{
+  reset();
+  feed("$GPRMC,123519.250,A,4807.038,N,01131.000,E,022.4,084.4,230324,003.1,W*", 0);
+
+  CHECK(gs_gnss_fix.valid);
+  CHECK(gs_gnss_fix.lat == 48117300);
+  CHECK(gs_gnss_fix.lon == 11516667);
+  CHECK(gs_gnss_fix.speed_cms == 1152);
+  CHECK(gs_gnss_fix.course == 8440);
+  CHECK(gs_gnss_fix.time.hour == 12 && gs_gnss_fix.time.minutes == 35 && gs_gnss_fix.time.seconds == 19);
+  CHECK(gs_gnss_fix.time_ms == 250);
+  CHECK(gs_gnss_fix.time.day == 23 && gs_gnss_fix.time.month == 3 && gs_gnss_fix.time.year == 24);
+  CHECK(gs_time_sync.valid);
+
+  //
+  //  South and west are negative, a void fix is not valid.
+  //
+  feed("$GNRMC,000001.000,V,3351.123,S,15112.500,W,0.0,0.0,010124,,,N*", 0);
+  CHECK(!gs_gnss_fix.valid);
+  CHECK(gs_gnss_fix.lat == -33852050);
+  CHECK(gs_gnss_fix.lon == -151208333);
+}
+
+static void
+test_gga(void)
+{
+  reset();
+  feed("$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*", 0);
+
+  CHECK(gs_gnss_fix.quality == 1);
+  CHECK(gs_gnss_fix.satellites == 8);
+  CHECK(gs_gnss_fix.hdop == 90);
+  CHECK(gs_gnss_fix.altitude == 54540);
+  CHECK(gs_gnss_fix.lat == 48117300);
+
+  //
+  //  Empty fields keep the last value.
+  //
+  feed("$GPGGA,123520,,,,,1,09,,,M,,M,,*", 0);
+  CHECK(gs_gnss_fix.satellites == 9);
+  CHECK(gs_gnss_fix.altitude == 54540 && gs_gnss_fix.lat == 48117300);
+
+  //
+  //  The extra decimals are truncated.
+  //
+  feed("$GPGGA,123521,4807.0381234,N,01131.000,E,1,09,1.25,-12.345,M,,M,,*", 0);
+  CHECK(gs_gnss_fix.lat == 48117302);
+  CHECK(gs_gnss_fix.hdop == 125);
+  CHECK(gs_gnss_fix.altitude == -1234);
+}
+
+static void
+test_checksum(void)
+{
+  reset();
+
+  //
+  //  A bad checksum, a missing checksum or an unknown sentence leave the
+  //  fix as it was.
+  //
+  feed("$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*", 1);
+  CHECK(gs_gnss_fix.satellites == 0 && gs_gnss_fix.lat == 0);
+
+  feed_raw("$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,\r\n");
+  CHECK(gs_gnss_fix.satellites == 0);
+
+  feed("$GPXXX,1,2,3*", 0);
+  CHECK(gs_gnss_fix.satellites == 0);
+
+  //
+  //  A '$' restarts the sentence, the part received before is dropped.
+  //
+  feed_raw("$GPGGA,123519,4807.0");
+  feed("$GPGGA,123519,0100.000,N,00200.000,E,1,05,0.9,1.0,M,,M,,*", 0);
+  CHECK(gs_gnss_fix.satellites == 5 && gs_gnss_fix.lat == 1000000 && gs_gnss_fix.lon == 2000000);
+
+  //
+  //  The hex digits of the checksum are upper case.
+  //
+  feed("$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*", 0);
+  CHECK(gs_gnss_fix.mode == 3 && gs_gnss_fix.hdop == 130);
+}
+
+static void
+test_zda(void)
+{
+  reset();
+
+  //
+  //  The date of ZDA syncs the time service, the RMC without a date does not.
+  //
+  feed("$GPRMC,235959.500,A,0100.000,N,00200.000,E,0.0,0.0,,,,A*", 0);
+  CHECK(!gs_time_sync.valid);
+
+  feed("$GPZDA,235959.500,29,02,2024,00,00*", 0);
+  CHECK(gs_gnss_fix.time.day == 29 && gs_gnss_fix.time.month == 2 && gs_gnss_fix.time.year == 24);
+  CHECK(gs_time_sync.valid && gs_time_sync.ms == 500);
+  CHECK(gs_time_sync.seconds == time_seconds(&gs_gnss_fix.time));
+}
+
+static void
+test_replay(void)
+{
+  uint32_t seconds;
+  uint16_t ms;
+  int epochs;
+  int i;
+
+  //
+  //  The static log crosses 2024-03-01 00:00:00 UTC, it starts 30 s before.
+  //
+  reset();
+  emu_reset();
+  epochs = emu_gnss_load("logs/static.nmea", 1000);
+  CHECK(epochs == 61);
+
+  //
+  //  An epoch takes 50 ms at 115200 bps.
+  //
+  emu_advance(100);
+  SIM868_gnss_poll();
+  CHECK(gs_gnss_fix.valid && gs_gnss_fix.satellites == 9 && gs_gnss_fix.satellites_in_view == 15);
+  CHECK(gs_gnss_fix.lat > 20659000 && gs_gnss_fix.lat < 20660500);
+  CHECK(gs_gnss_fix.lon < -103349000 && gs_gnss_fix.lon > -103350500);
+
+  for (i = 0; i < 40; i++)
+  {
+    emu_advance(1000);
+    SIM868_gnss_poll();
+  }
+  CHECK(emu_gnss_epochs() == 41);
+  CHECK(gs_gnss_fix.time.day == 1 && gs_gnss_fix.time.month == 3 && gs_gnss_fix.time.hour == 0);
+  CHECK(gs_gnss_fix.time.seconds == 10);
+
+  CHECK(SIM868_time_get_utc(&seconds, &ms));
+  CHECK(seconds == 762566400UL + 10);
+
+  //
+  //  The RTC of the host is only set by the first sync, the tick kept the
+  //  time.
+  //
+  CHECK(emu_rtc() == 762566400UL - 30);
+}
+
+//
+//  Replays the drive log through the ring of the GNSS port, as the receive
+//  interrupt or a DMA transfer fills it, with the GNSS polled every 100 ms.
+//
+static void
+test_replay_ring(void)
+{
+  struct SIM868_Stats stats;
+  char block[SIM868_GNSS_RX_LENGTH];
+  uint16_t length;
+  uint32_t fixes = 0;
+  int epochs;
+  int i;
+
+  reset();
+  emu_reset();
+  SIM868_clear_stats();
+  epochs = emu_gnss_load("logs/drive.nmea", 1000);
+  CHECK(epochs == 240);
+
+  for (i = 0; i < epochs * 10; i++)
+  {
+    emu_advance(100);
+    for (length = 0; length < sizeof(block) && emu_gnss_available(); length++)
+    {
+      block[length] = emu_gnss_read();
+    }
+    SIM868_gnss_rx_block(block, length);
+    SIM868_gnss_poll();
+    fixes += ((i % 10) == 9 && gs_gnss_fix.valid);
+  }
+
+  SIM868_get_stats(&stats);
+  CHECK(stats.gnss_overruns == 0);
+  CHECK(fixes > 200);
+}
+
+int
+main(void)
+{
+  test_rmc();
+  test_gga();
+  test_checksum();
+  test_zda();
+  test_replay();
+  test_replay_ring();
+
+  return CHECK_DONE("test_nmea");
+}
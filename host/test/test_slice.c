@@ -0,0 +1,119 @@
+//*****************************************************************************
+//
+//  Tests of the tokenizer of the replies.
+//  File:     test_slice.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The replies are slices of the sim ring, so each one is written at a given
+//  position of the ring, across its end for the ones that wrap around.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+//
+//  Writes a text in the sim ring and returns its slice.
+//
+static struct Slice
+ring_text(uint16_t offset, const char *text)
+{
+  struct Slice s = { offset, (uint16_t)strlen(text) };
+  uint16_t i;
+
+  for (i = 0; i < s.length; i++)
+  {
+    gs_sim_ring.data[(offset + i) % gs_sim_ring.size] = text[i];
+  }
+
+  return s;
+}
+
+static void
+test_numbers(void)
+{
+  struct Reply_Field field[4];
+  uint8_t count;
+
+  count = slice_tokenize(ring_text(0, "1,0,42"), ',', field, 4);
+  CHECK(count == 3);
+  CHECK(field[0].type == FIELD_NUMBER && field[0].value == 1);
+  CHECK(field[1].type == FIELD_NUMBER && field[1].value == 0);
+  CHECK(field[2].type == FIELD_NUMBER && field[2].value == 42);
+
+  //
+  //  Spaces are skipped, empty fields are kept, text is not a number.
+  //
+  count = slice_tokenize(ring_text(10, " 2,,AB1,7 "), ',', field, 4);
+  CHECK(count == 4);
+  CHECK(field[0].type == FIELD_NUMBER && field[0].value == 2);
+  CHECK(field[1].type == FIELD_EMPTY && field[1].text.length == 0);
+  CHECK(field[2].type == FIELD_TEXT && slice_equals(field[2].text, "AB1"));
+  CHECK(field[3].type == FIELD_NUMBER && field[3].value == 7);
+
+  //
+  //  The fields beyond the maximum are not returned.
+  //
+  count = slice_tokenize(ring_text(30, "1,2,3,4,5"), ',', field, 2);
+  CHECK(count == 2 && field[1].value == 2);
+
+  count = slice_tokenize(ring_text(40, ""), ',', field, 4);
+  CHECK(count == 1 && field[0].type == FIELD_EMPTY);
+}
+
+static void
+test_strings(void)
+{
+  struct Reply_Field field[4];
+  uint8_t count;
+
+  count = slice_tokenize(ring_text(0, "1,1,\"10.120.3.254\""), ',', field, 4);
+  CHECK(count == 3);
+  CHECK(field[2].type == FIELD_IP && field[2].value == 0x0A7803FEUL);
+  CHECK(slice_equals(field[2].text, "10.120.3.254"));
+
+  //
+  //  A quoted comma is part of the string, the octets are at most 255.
+  //
+  count = slice_tokenize(ring_text(50, "\"a,b\",\"1.2.3.256\",\"1.2.3\""), ',', field, 4);
+  CHECK(count == 3);
+  CHECK(field[0].type == FIELD_STRING && slice_equals(field[0].text, "a,b"));
+  CHECK(field[1].type == FIELD_STRING && field[1].value == 0);
+  CHECK(field[2].type == FIELD_STRING);
+
+  //
+  //  Unterminated string.
+  //
+  count = slice_tokenize(ring_text(80, "\"abc"), ',', field, 4);
+  CHECK(count == 1 && field[0].type == FIELD_STRING && slice_equals(field[0].text, "abc"));
+}
+
+static void
+test_wrap(void)
+{
+  struct Reply_Field field[5];
+  uint16_t offset;
+  uint8_t count;
+
+  //
+  //  Every split of the line across the end of the ring.
+  //
+  for (offset = SIM_RX_LENGTH - 24; offset < SIM_RX_LENGTH; offset++)
+  {
+    count = slice_tokenize(ring_text(offset, "2,1,\"1A2B\",\"00C3D4E5\",7"), ',', field, 5);
+    CHECK(count == 5);
+    CHECK(field[0].value == 2 && field[1].value == 1 && field[4].value == 7);
+    CHECK(field[2].type == FIELD_STRING && slice_to_hex(field[2].text) == 0x1A2B);
+    CHECK(field[3].type == FIELD_STRING && slice_to_hex(field[3].text) == 0xC3D4E5);
+  }
+}
+
+int
+main(void)
+{
+  test_numbers();
+  test_strings();
+  test_wrap();
+
+  return CHECK_DONE("test_slice");
+}
@@ -0,0 +1,158 @@
+//*****************************************************************************
+//
+//  Tests of the time service.
+//  File:     test_time.c
+//  ---------------------------------------------------------------------------
+//  Specifications:
+//  The seconds are counted from 2000-01-01 00:00:00, every fourth year is a
+//  leap year up to 2099, and the local time is clamped at the epoch.
+//
+//*****************************************************************************
+
+#include "sim868.c"
+#include "check.h"
+
+static uint32_t
+seconds_of(uint8_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minutes, uint8_t seconds)
+{
+  struct GNSS_Data_Time time = { seconds, minutes, hour, day, month, year };
+
+  return time_seconds(&time);
+}
+
+static uint8_t
+date_is(struct GNSS_Data_Time *time, uint8_t year, uint8_t month, uint8_t day)
+{
+  return (time->year == year && time->month == month && time->day == day);
+}
+
+static void
+test_leap_days(void)
+{
+  struct GNSS_Data_Time time;
+
+  CHECK(seconds_of(0, 1, 1, 0, 0, 0) == 0);
+  CHECK(seconds_of(0, 2, 29, 0, 0, 0) == 59UL * 86400);
+  CHECK(seconds_of(0, 3, 1, 0, 0, 0) == 60UL * 86400);
+  CHECK(seconds_of(1, 1, 1, 0, 0, 0) == 366UL * 86400);
+  CHECK(seconds_of(1, 3, 1, 0, 0, 0) == (366UL + 59) * 86400);
+
+  //
+  //  2024-02-29 12:00:00 (unix time 1709208000).
+  //
+  CHECK(seconds_of(24, 2, 29, 12, 0, 0) == 1709208000UL - 946684800UL);
+
+  time_date(&time, seconds_of(24, 2, 28, 23, 59, 59) + 1);
+  CHECK(date_is(&time, 24, 2, 29) && time.hour == 0 && time.minutes == 0 && time.seconds == 0);
+
+  time_date(&time, seconds_of(24, 2, 29, 23, 59, 59) + 1);
+  CHECK(date_is(&time, 24, 3, 1));
+
+  time_date(&time, seconds_of(23, 2, 28, 23, 59, 59) + 1);
+  CHECK(date_is(&time, 23, 3, 1));
+
+  time_date(&time, seconds_of(24, 12, 31, 23, 59, 59));
+  CHECK(date_is(&time, 24, 12, 31) && time.hour == 23 && time.seconds == 59);
+  CHECK(seconds_of(24, 12, 31, 23, 59, 59) + 1 == seconds_of(25, 1, 1, 0, 0, 0));
+
+  time_date(&time, seconds_of(99, 12, 31, 23, 59, 59));
+  CHECK(date_is(&time, 99, 12, 31));
+}
+
+static void
+test_round_trip(void)
+{
+  struct GNSS_Data_Time time;
+  uint32_t day;
+  uint32_t seconds;
+  uint32_t failures = 0;
+
+  //
+  //  Every day from 2000 to 2099, at a different time of the day.
+  //
+  for (day = 0; day < 36525; day++)
+  {
+    seconds = (day * 86400UL) + ((day * 7919UL) % 86400);
+    time_date(&time, seconds);
+    if (time_seconds(&time) != seconds || !time_has_date(&time))
+    {
+      failures++;
+    }
+  }
+  CHECK(failures == 0);
+}
+
+static void
+test_zone(void)
+{
+  struct GNSS_Data_Time time;
+  uint32_t seconds;
+  uint32_t utc;
+  uint16_t ms;
+  int32_t lat;
+  int32_t lon;
+  uint16_t speed;
+
+  //
+  //  Local time before the epoch is clamped, not wrapped around.
+  //
+  SIM868_time_set_zone(-360);
+  CHECK(time_local(0) == 0);
+  CHECK(time_local(6UL * 3600 - 1) == 0);
+  CHECK(time_local(6UL * 3600) == 0);
+  CHECK(time_local(6UL * 3600 + 1) == 1);
+
+  //
+  //  The zone moves the date back over a leap day and a new year.
+  //
+  time_date(&time, time_local(seconds_of(24, 3, 1, 2, 30, 0)));
+  CHECK(date_is(&time, 24, 2, 29) && time.hour == 20 && time.minutes == 30);
+
+  time_date(&time, time_local(seconds_of(25, 1, 1, 5, 0, 0)));
+  CHECK(date_is(&time, 24, 12, 31) && time.hour == 23);
+
+  SIM868_time_set_zone(330);
+  time_date(&time, time_local(seconds_of(24, 12, 31, 20, 0, 0)));
+  CHECK(date_is(&time, 25, 1, 1) && time.hour == 1 && time.minutes == 30);
+
+  //
+  //  A fix without a date keeps the last date and time, then its first date
+  //  is converted.
+  //
+  SIM868_time_set_zone(-360);
+  memset(&gs_gnss_data_time, 0, sizeof(gs_gnss_data_time));
+  memset(&gs_gnss_fix, 0, sizeof(gs_gnss_fix));
+  gs_gnss_fix.valid = true;
+  gs_gnss_fix.time.hour = 3;
+  CHECK(SIM868_gnss_get_position(&lat, &lon, &speed));
+  CHECK(gs_gnss_data_time.day == 0 && gs_gnss_data_time.hour == 0);
+
+  gs_gnss_fix.time.day = 1;
+  gs_gnss_fix.time.month = 1;
+  CHECK(SIM868_gnss_get_position(&lat, &lon, &speed));
+  CHECK(date_is(&gs_gnss_data_time, 0, 1, 1) && gs_gnss_data_time.hour == 0);
+
+  //
+  //  The clock of the host, synced from the fix.
+  //
+  seconds = seconds_of(24, 2, 29, 23, 59, 59);
+  gs_time_sync.valid = true;
+  gs_time_sync.seconds = seconds;
+  gs_time_sync.ms = 750;
+  gs_time_sync.synced_at = emu_now();
+  emu_advance(300);
+  CHECK(SIM868_time_get_utc(&utc, &ms) && utc == seconds + 1 && ms == 50);
+  CHECK(SIM868_time_get_local(&utc, &ms) && utc == seconds + 1 - 6UL * 3600);
+}
+
+int
+main(void)
+{
+  emu_reset();
+
+  test_leap_days();
+  test_round_trip();
+  test_zone();
+
+  return CHECK_DONE("test_time");
+}
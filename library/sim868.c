@@ -43,6 +43,15 @@
 #define ERROR_JSON_STRUCTURE                        12
 #define ERROR_GNSS_FIX                              13
 #define ERROR_POWER_STATE                           14
+#define ERROR_TIMEOUT                               15
+#define ERROR_QUEUE_FULL                            16
+#define ERROR_HTTP_BUSY                             17
+#define ERROR_STORE                                 18
+#define ERROR_SOCKET                                19
+#define ERROR_MQTT                                  20
+#define ERROR_CONFIG                                21
+#define ERROR_TASK_BUSY                             22
+#define ERROR_RTOS                                  23
 
 //*****************************************************************************
 //
@@ -64,6 +73,31 @@
 #define DEBUG_SHORT_DELAY                           1000
 #define DEBUG_MEDIUM_DELAY                          2000
 #define DEBUG_LONG_DELAY                            3000
+#define HTTP_DATA_MIN_TIME                          1000
+#define HTTP_DATA_MAX_TIME                          60000
+#define GSM_REGISTRATION_TIMEOUT                    120000
+#define SLEEP_WAKE_DELAY                            100
+#define SOCKET_SHUT_TIMEOUT                         65000
+#define SOCKET_CONTEXT_TIMEOUT                      65000
+#define SOCKET_CONNECT_TIMEOUT                      65000
+#define SOCKET_SEND_TIMEOUT                         20000
+#define MQTT_ACK_TIMEOUT                            10000
+
+//*****************************************************************************
+//
+//  The following are defines for the adaptive time outs of the AT commands,
+//  values are given in ms. The time out is learned once AT_RTO_SAMPLES
+//  replies were received, and it is never below AT_RTO_MIN.
+//
+//*****************************************************************************
+
+#define AT_RTO_MIN                                  1000
+#define AT_RTO_SAMPLES                              3
+#define AT_RTO_MAX_BACKOFF                          4
+#define AT_RTO_NONE                                 0xFF
+#define RSSI_UNKNOWN                                99
+#define RSSI_MEDIUM                                 15
+#define RSSI_LOW                                    10
 
 //*****************************************************************************
 //
@@ -71,21 +105,195 @@
 //
 //*****************************************************************************
 
-#define REPLY_BUFFER_LENGTH                         255
-#define APN_BUFFER_LENGTH                           50
-#define URL_BUFFER_LENGTH                           55
-#define UA_BUFFER_LENGTH                            30
-#define CONTENT_BUFFER_LENGTH                       42
-#define UD_BUFFER_LENGTH                            52
+#define PROFILE_BUFFER_LENGTH                       224
+#define CSTT_BUFFER_LENGTH                          128
+#define URL_BUFFER_LENGTH                           128
+#define UA_BUFFER_LENGTH                            64
+#define CONTENT_BUFFER_LENGTH                       64
+#define UD_BUFFER_LENGTH                            128
+#define ROOT_BUFFER_LENGTH                          96
+#define WS_BUFFER_LENGTH                            96
+#define AT_LINE_LENGTH                              556
+#define SIM_RX_LENGTH                               512
+#define GNSS_RX_LENGTH                              SIM868_GNSS_RX_LENGTH
+#define RX_POOL_LENGTH                              (SIM_RX_LENGTH + GNSS_RX_LENGTH)
+#define DEBUG_LINE_LENGTH                           64
+#define HTTP_CHUNK_LENGTH                           (SIM_RX_LENGTH / 2)
+#define HTTP_DATA_MAX_LENGTH                        319488
+#define BATCH_LENGTH                                10
+#define BATCH_RECORD_LENGTH                         80
+#define BATCH_JSON_LENGTH                           ((BATCH_LENGTH * BATCH_RECORD_LENGTH) + 3)
+#define BATCH_ENCODED_FIX_LENGTH                    18
+#define BATCH_UNDATED_MS                            1000
+#define AT_QUEUE_LENGTH                             4
+#define AT_TIMEOUT_COMMANDS                         14
+#define SOCKET_START_LENGTH                         96
+#define SOCKET_SEND_LENGTH                          1460
+#define SOCKET_CHUNK_LENGTH                         (SIM_RX_LENGTH / 2)
+#define MQTT_BUFFER_LENGTH                          512
+
+//*****************************************************************************
+//
+//  The following are defines for the Http parameters not sent to the session.
+//
+//*****************************************************************************
+
+#define HTTP_PARA_UA                                0x01
+#define HTTP_PARA_CONTENT                           0x02
+#define HTTP_PARA_USERDATA                          0x04
+#define HTTP_PARA_URL                               0x08
+#define HTTP_PARA_ALL                               0x0F
+
+//*****************************************************************************
+//
+//  The following is the command line of the bearer profile, the commands
+//  after the first one are joined without their AT prefix.
+//
+//*****************************************************************************
+
+#define AT_CHAIN_SEPARATOR                          ';'
+#define BEARER_PROFILE                              "AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\";" \
+                                                    "+SAPBR=3,1,\"APN\",\"%s\";" \
+                                                    "+SAPBR=3,1,\"USER\",\"%s\";" \
+                                                    "+SAPBR=3,1,\"PWD\",\"%s\""
+
+//*****************************************************************************
+//
+//  The following are defines for the reply of the AT commands.
+//
+//*****************************************************************************
+
+#define AT_REPLY_LINES                              8
+#define AT_NO_RESULT                                0xFF
+#define AT_RAW_DATA                                 "DATA"
+#define REPLY_MAX_FIELDS                            8
+
+#define FIELD_EMPTY                                 0
+#define FIELD_NUMBER                                1
+#define FIELD_STRING                                2
+#define FIELD_IP                                    3
+#define FIELD_TEXT                                  4
+
+//*****************************************************************************
+//
+//  The following are defines for the tasks, sequences of AT commands that are
+//  resumed from the line where they yielded, like protothreads. A task that
+//  waits returns TASK_RUNNING, the locals are not kept between the calls.
+//
+//*****************************************************************************
+
+#define TASK_RUNNING                                0
+#define TASK_DONE                                   1
+#define TASK_DEPTH                                  3
+#define TASK_AT_LENGTH                              40
+
+#define TASK_AT_NONE                                0
+#define TASK_AT_SENT                                1
+#define TASK_AT_DONE                                2
+
+#define TASK_BEGIN(depth)                           switch (gs_sim_task.line[depth]) { case 0:
+
+#define TASK_END(depth)                             } gs_sim_task.line[depth] = 0; \
+                                                    gs_sim_task.error_status = NO_ERROR; \
+                                                    return TASK_DONE
+
+#define TASK_EXIT(depth, error)                     do { gs_sim_task.error_status = (error); \
+                                                    gs_sim_task.line[depth] = 0; \
+                                                    return TASK_DONE; } while (0)
+
+#define TASK_YIELD(depth)                           gs_sim_task.line[depth] = __LINE__; \
+                                                    return TASK_RUNNING; case __LINE__:
+
+#define TASK_WAIT_UNTIL(depth, condition)           gs_sim_task.line[depth] = __LINE__; case __LINE__: \
+                                                    if (!(condition)) return TASK_RUNNING
+
+#define TASK_SEND(depth, at, time_out)              gs_sim_task.at_state = TASK_AT_NONE; \
+                                                    TASK_WAIT_UNTIL(depth, !task_send((at), (time_out)))
+
+#define TASK_SPAWN(depth, step)                     gs_sim_task.line[(depth) + 1] = 0; \
+                                                    TASK_WAIT_UNTIL(depth, step((depth) + 1) == TASK_DONE)
+
+//*****************************************************************************
+//
+//  The following is the version of the binary encoding of the report batch.
+//
+//*****************************************************************************
+
+#define BATCH_ENCODING_VERSION                      3
+
+//*****************************************************************************
+//
+//  The following are defines for the control packets of MQTT 3.1.1.
+//
+//*****************************************************************************
+
+#define MQTT_CONNECT                                0x10
+#define MQTT_CONNACK                                0x20
+#define MQTT_PUBLISH                                0x30
+#define MQTT_PUBACK                                 0x40
+#define MQTT_SUBSCRIBE                              0x82
+#define MQTT_SUBACK                                 0x90
+#define MQTT_PINGREQ                                0xC0
+#define MQTT_PINGRESP                               0xD0
+#define MQTT_DISCONNECT                             0xE0
+
+//*****************************************************************************
+//
+//  The following are the keys of the retention RAM, they mark the SIM868 as
+//  already set up, and the trace buffer as holding valid entries.
+//
+//*****************************************************************************
+
+#define WARM_START_KEY                              0x5348384BUL
+#define TRACE_KEY                                   0x54524345UL
+
+//*****************************************************************************
+//
+//  The following are defines for the store of the reports in the flash
+//  memory of the host MCU.
+//
+//*****************************************************************************
+
+#define STORE_KEY                                   0x53464C32UL
+#define STORE_ERASED                                0xFFFFFFFFUL
+#define STORE_FIX                                   1
+#define STORE_SENT                                  2
+#define STORE_ENTRIES                               ((SIM868_STORE_SECTOR_SIZE - sizeof(struct Store_Sector)) / sizeof(struct Store_Entry))
+
+//*****************************************************************************
+//
+//  The following are defines for the sleep state of the SIM868.
+//
+//*****************************************************************************
+
+#define SLEEP_AWAKE                                 0
+#define SLEEP_ASLEEP                                1
+#define SLEEP_WAKING                                2
 
 //*****************************************************************************
 //
-//  The following are defines for the number of lines to be read on the UART.
+//  The following are defines for the NMEA sentences parsed from the GNSS
+//  output, and for the states of the parser.
 //
 //*****************************************************************************
 
-#define MULTILINE                                   1
-#define SINGLE_LINE                                 0
+#define NMEA_UNKNOWN                                0
+#define NMEA_RMC                                    1
+#define NMEA_GGA                                    2
+#define NMEA_GSA                                    3
+#define NMEA_GSV                                    4
+#define NMEA_VTG                                    5
+#define NMEA_ZDA                                    6
+
+#define NMEA_IDLE                                   0
+#define NMEA_FIELDS                                 1
+#define NMEA_CHECKSUM                               2
+
+#define NMEA_ADDRESS_LENGTH                         5
+#define NMEA_MAX_FIELDS                             24
+#define NMEA_MAX_DECIMALS                           5
+#define NMEA_COORDINATE_DECIMALS                    5
+#define NMEA_SPEED_DECIMALS                         3
 
 //*****************************************************************************
 //
@@ -140,31 +348,193 @@
 
 //
 //  Bearer Serivce.
-//  APN: Acces Point Name.
-//  User: Name of the service provider.
-//  Password: Password of the user.
+//  Profile: AT+SAPBR commands of the connection type, the Acces Point Name,
+//  the name of the service provider and the password of the user, joined in
+//  one command line when the service is set.
+//  CSTT: AT+CSTT command of the TCP/IP stack, built with the same parameters.
+//  Dirty: The profile was not sent to the SIM868 yet.
 //
 struct Bearer_Service
 {
-  char *apn, *user, pwd;
+  char profile[PROFILE_BUFFER_LENGTH];
+  char cstt[CSTT_BUFFER_LENGTH];
+  uint8_t dirty;
 };
-struct Bearer_Service gs_bearer_config;
+static struct Bearer_Service gs_bearer_config;
 
 //
 //  Http Header Parameters.
-//  User agent: Identifier for the mobile.
-//  User data: Authorization keys.
-//  Content type: Media type of the resource.
-//  Root: Server application.
-//  Web service: Interface to a database server.
-//  Json structure: Data packet in json format.
+//  User agent, content type, user data, URL: AT+HTTPPARA commands of the
+//  identifier for the mobile, the media type of the resource, the
+//  authorization keys and the address, built when they are set.
+//  Root: Server application, kept to build the URL again.
+//  Web service: Interface to a database server, kept to build the URL again.
+//  Json structure: Data packet in json format, it is not copied.
+//  Dirty: HTTP_PARA_* flags of the commands not sent to the session yet.
 //
 struct Http_Header
 {
-  char *user_agent, *user_data, *content_type;
-  char *root, *web_service, *json_structure;
+  char user_agent[UA_BUFFER_LENGTH], content_type[CONTENT_BUFFER_LENGTH];
+  char user_data[UD_BUFFER_LENGTH], url[URL_BUFFER_LENGTH];
+  char root[ROOT_BUFFER_LENGTH], web_service[WS_BUFFER_LENGTH];
+  char *json_structure;
+  uint8_t dirty;
+};
+static struct Http_Header gs_http_header;
+
+//
+//  Http Session.
+//  Keep alive: The session is kept initialized between requests.
+//  Active: The session was initialized and it was not terminated, only the
+//  parameters that changed are sent again while it is kept alive.
+//
+struct Http_Session
+{
+  uint8_t keep_alive, active;
+};
+static struct Http_Session gs_http_session;
+
+//
+//  Http Request.
+//  Pending: An asynchronous request is running or waiting for the server.
+//  Data left: The response data was left in the SIM868, to be read with
+//  SIM868_http_read_stream().
+//  Error status: Result of the last asynchronous request.
+//  Action: AT+HTTPACTION command of the asynchronous request.
+//  Callback/Context: Function called when the request is completed, and its
+//  user pointer.
+//
+struct Http_Request
+{
+  uint8_t pending, data_left, error_status;
+  char action[18];
+  SIM868_http_callback_t callback;
+  void *context;
+};
+static struct Http_Request gs_http_request;
+
+//
+//  GPRS Connection.
+//  Known: The state below was queried and it is kept up to date by
+//  unsolicited result codes, otherwise it has to be queried again.
+//  Attached: The SIM868 is attached to the GPRS service.
+//  Bearer: Connection state of the bearer (CONNECTING, CONNECTED...).
+//
+struct Gprs_Connection
+{
+  uint8_t known, attached, bearer;
+};
+static struct Gprs_Connection gs_gprs_connection;
+
+//
+//  Socket.
+//  Context: The GPRS context of the TCP/IP stack is active, it is separate
+//  from the bearer of the Http service.
+//  Connected: The connection was opened and it was not closed.
+//  Available: The SIM868 holds data received, it is read with AT+CIPRXGET.
+//  Start: Command that opened the connection, an open request with the same
+//  parameters keeps it.
+//
+struct Socket
+{
+  uint8_t context, connected, available;
+  char start[SOCKET_START_LENGTH];
+};
+static struct Socket gs_socket;
+
+//
+//  MQTT Client.
+//  Connected: The broker accepted the connection and it was not lost.
+//  Acked: The acknowledgement waited for was received.
+//  Ack type/id: Packet type and packet identifier waited for.
+//  Packet id: Identifier of the last packet sent, it is never zero.
+//  Keep alive: Maximum time in seconds between two packets sent.
+//  Sent at/Ping at: Tick when the last packet was sent, and when the pending
+//  PINGREQ was sent, zero for none.
+//  Buffer/Length: Storage of the packets, the first half holds the packet
+//  being sent and the second half the packet being received.
+//  Rx length: Bytes of the packet being received.
+//  Rx skip: Bytes left of a packet dropped because it did not fit.
+//  Callback/Context: Function called with each message published by the
+//  broker, and its user pointer.
+//
+struct Mqtt_Client
+{
+  uint8_t connected, acked, ack_type;
+  uint16_t ack_id, packet_id, keep_alive;
+  uint32_t sent_at, ping_at;
+  uint8_t *buffer;
+  uint16_t length, rx_length;
+  uint32_t rx_skip;
+  SIM868_mqtt_callback_t callback;
+  void *context;
+};
+static uint8_t g_mqtt_buffer[MQTT_BUFFER_LENGTH];
+static struct Mqtt_Client gs_mqtt_client = { .buffer = g_mqtt_buffer, .length = MQTT_BUFFER_LENGTH };
+
+//
+//  GSM Registration.
+//  Status: Last registration status reported by +CREG.
+//  LAC/Cell ID: Location area code and cell of the serving cell.
+//  Time out: Time to wait for the registration in ms.
+//
+struct Gsm_Registration
+{
+  uint8_t status;
+  uint16_t lac;
+  uint32_t cell_id;
+  uint32_t time_out;
+};
+static struct Gsm_Registration gs_gsm_registration = { .time_out = GSM_REGISTRATION_TIMEOUT };
+
+//
+//  Sleep Mode.
+//  Enabled: The slow clock (AT+CSCLK=1) is enabled, the SIM868 sleeps while
+//  the DTR line is high.
+//  State: SLEEP_AWAKE, SLEEP_ASLEEP or SLEEP_WAKING.
+//  Idle time: Time in ms without commands before sleeping, zero to only
+//  sleep on request.
+//  Idle since: Tick when the last command was completed.
+//  Woken at: Tick when the DTR line was pulled low.
+//
+struct Sleep_Mode
+{
+  uint8_t enabled, state;
+  uint16_t idle_time;
+  uint32_t idle_since, woken_at;
+};
+static struct Sleep_Mode gs_sleep_mode;
+
+//
+//  Warm Start.
+//  Key: WARM_START_KEY once the SIM868 was set up, its baud rate fixed and
+//  its profile saved.
+//  Sim card ready: The SIM Card was initialized.
+//  It is kept in the retention RAM, so it survives a reset of the MCU.
+//
+struct Warm_Start
+{
+  uint32_t key;
+  uint8_t sim_card_ready;
+};
+SIM868_RETAINED static struct Warm_Start gs_warm_start;
+
+//
+//  Trace Buffer.
+//  Key: TRACE_KEY once the buffer was cleared, it is kept in the retention
+//  RAM so the last events before a reset of the MCU can be read.
+//  Entry: Events recorded, the oldest one is overwritten when it is full.
+//  Head/Count: Position of the oldest entry and number of entries.
+//
+#if SIM868_TRACE_LENGTH > 0
+struct Trace_Buffer
+{
+  uint32_t key;
+  struct SIM868_Trace_Entry entry[SIM868_TRACE_LENGTH];
+  uint8_t head, count;
 };
-struct Http_Header gs_http_header;
+SIM868_RETAINED static struct Trace_Buffer gs_trace_buffer;
+#endif
 
 //
 //  GNSS Date-Time.
@@ -176,6 +546,383 @@ struct GNSS_Data_Time
 };
 struct GNSS_Data_Time gs_gnss_data_time;
 
+//
+//  GNSS Fix.
+//  The fields are fixed-point integers, so the parser needs no floating point.
+//  Valid: The position is valid (fixed), from RMC.
+//  Latitude/Longitude: Position in microdegrees.
+//  Speed: Speed over ground in cm/s.
+//  Course: Course over ground in hundredths of degree.
+//  Altitude: Altitude above mean sea level in cm.
+//  HDOP: Horizontal dilution of precision in hundredths.
+//  Quality: Fix quality from GGA (0 invalid, 1 GPS, 2 DGPS).
+//  Mode: Fix mode from GSA (1 no fix, 2 2D, 3 3D).
+//  Satellites: Satellites used in the fix and satellites in view.
+//  Time: UTC date and time of the fix, and its milliseconds.
+//
+struct GNSS_Fix
+{
+  uint8_t valid;
+  int32_t lat, lon, altitude;
+  uint16_t speed_cms, course, hdop;
+  uint8_t quality, mode, satellites, satellites_in_view;
+  struct GNSS_Data_Time time;
+  uint16_t time_ms;
+};
+static struct GNSS_Fix gs_gnss_fix;
+
+//
+//  Time Sync.
+//  Software RTC disciplined by the RMC and ZDA sentences, the tick keeps the
+//  time between them.
+//  Valid: The RTC was synced at least once.
+//  Seconds/ms: UTC time of the last sync, seconds since 2000-01-01.
+//  Synced at: Tick of the last sync.
+//  PPS/PPS at: The PPS line is used, and the tick of its last pulse.
+//  Zone: Offset of the local time from UTC in minutes.
+//
+struct Time_Sync
+{
+  uint8_t valid;
+  uint32_t seconds;
+  uint16_t ms;
+  uint32_t synced_at;
+  volatile uint8_t pps;
+  volatile uint32_t pps_at;
+  int16_t zone;
+};
+static struct Time_Sync gs_time_sync = { .zone = SIM868_TIME_ZONE };
+
+//
+//  NMEA Parser.
+//  State: Part of the sentence being received.
+//  Sentence: Type of the sentence, NMEA_UNKNOWN for the ones skipped.
+//  Talker: Index of the constellation of the sentence (0 GPS, 1 GLONASS).
+//  Field: Index of the field being received, the address is the field 0.
+//  Checksum: XOR of the characters between '$' and '*'.
+//  Received/Received digits: Checksum sent after '*' and its hex digits.
+//  Address: Talker and sentence identifiers.
+//  Value/Decimals/Digits: Number of the field as an integer, number of
+//  decimals and number of digits received.
+//  Point/Negative: The number has a decimal point, or a minus sign.
+//  Letter: First character of the field that is not part of a number.
+//  In view: Satellites in view reported by each constellation.
+//  Fix: Copy of the last fix updated with the fields of the sentence, it is
+//  committed only when the checksum is valid.
+//
+struct NMEA_Parser
+{
+  uint8_t state, sentence, talker, field;
+  uint8_t checksum, received, received_digits;
+  char address[NMEA_ADDRESS_LENGTH];
+  uint32_t value;
+  uint8_t decimals, digits, point, negative;
+  char letter;
+  uint8_t in_view[2];
+  struct GNSS_Fix fix;
+};
+static struct NMEA_Parser gs_nmea_parser;
+
+//
+//  GNSS Fix Record.
+//  Latitude/Longitude: Position in microdegrees.
+//  Speed: Speed in kph.
+//  Seconds/ms: UTC time of the fix, seconds since 2000-01-01, taken from
+//  the time service when it is synced. Zero seconds when the fix has no date.
+//
+struct GNSS_Fix_Record
+{
+  int32_t lat, lon;
+  uint8_t speed_kph;
+  uint16_t ms;
+  uint32_t seconds;
+};
+
+//
+//  Report Batch.
+//  Record: Fixes waiting to be uploaded, the first one is the oldest.
+//  Head/Count: Position of the oldest fix and number of fixes.
+//  Max count: Number of fixes that makes the batch due.
+//  Max age: Age in seconds of the oldest fix that makes the batch due.
+//  First at: Tick when the oldest fix was added.
+//
+struct Report_Batch
+{
+  struct GNSS_Fix_Record record[BATCH_LENGTH];
+  uint8_t head, count, max_count;
+  uint16_t max_age;
+  uint32_t first_at;
+};
+static struct Report_Batch gs_report_batch = { .max_count = BATCH_LENGTH };
+static char g_batch_json[BATCH_JSON_LENGTH];
+static char g_at_chain[AT_LINE_LENGTH];
+
+//
+//  Store Sector.
+//  The store is an append-only log in the flash memory, the sectors are used
+//  in turn so they wear evenly, and the oldest one is erased when the log is
+//  full.
+//  Key: STORE_KEY once the sector is in use.
+//  Sequence: Order of the sector in the log.
+//
+struct Store_Sector
+{
+  uint32_t key, sequence;
+};
+
+//
+//  Store Entry.
+//  Sequence: Order of the entry in the log from one, STORE_ERASED for a free
+//  entry.
+//  Sent: Sequence of the last fix forwarded when the entry was written, zero
+//  for none.
+//  Fix: Report of a STORE_FIX entry, unused for STORE_SENT.
+//  Type: STORE_FIX for a fix, STORE_SENT to only record the sent sequence.
+//  Check: Sum of the other bytes, it discards an entry half programmed.
+//
+struct Store_Entry
+{
+  uint32_t sequence, sent;
+  struct GNSS_Fix_Record fix;
+  uint8_t type, check;
+};
+
+//
+//  Report Store.
+//  Mounted: The log was scanned.
+//  Sector/Entry: Sector in use and its next free entry.
+//  Sector sequence/Sequence: Order of the sector in use and of the next
+//  entry.
+//  Sent: Sequence of the last fix forwarded.
+//  Count/Dropped: Fixes waiting to be forwarded, and fixes erased before they
+//  were forwarded.
+//
+struct Report_Store
+{
+  uint8_t mounted, sector;
+  uint16_t entry;
+  uint32_t sector_sequence, sequence, sent;
+  uint16_t count, dropped;
+};
+#if SIM868_STORE_SECTORS > 0
+static struct Report_Store gs_report_store;
+#endif
+
+//
+//  Ring Buffer.
+//  Data: Storage taken from the receive pool.
+//  Size: Number of characters of the storage.
+//  Head: Position where the next character received is written.
+//  Scan: Position of the next character to be processed.
+//  Tail: Oldest character still in use, the storage is released up to here.
+//
+struct Ring
+{
+  char *data;
+  uint16_t size;
+  volatile uint16_t head;
+  uint16_t scan, tail;
+};
+
+//
+//  Slice.
+//  Offset: Position of the first character within the sim ring.
+//  Length: Number of characters, the slice is not closed with a null
+//  character and it may wrap around the end of the ring.
+//
+struct Slice
+{
+  uint16_t offset, length;
+};
+
+//
+//  Reply Field.
+//  Type: FIELD_EMPTY, FIELD_NUMBER, FIELD_STRING (quoted), FIELD_IP (quoted
+//  dotted address) or FIELD_TEXT (anything else).
+//  Value: Value of a number, or the address of an IP packed as 0xAABBCCDD.
+//  Text: Slice of the field, without the quotes of a string.
+//
+struct Reply_Field
+{
+  uint8_t type;
+  uint32_t value;
+  struct Slice text;
+};
+
+//
+//  AT Result Code.
+//  Code: Final result code sent by the SIM868, a code ending with ':' is
+//  matched as a prefix.
+//  Error status: Result of the command when the code is received.
+//
+struct AT_Result
+{
+  char *code;
+  uint8_t error_status;
+};
+
+//
+//  AT Response.
+//  At: Prefix of the AT command.
+//  Urc: Line that follows the final result code, the command is completed
+//  only after it is received.
+//  Data: Line that announces the length of raw data following it, the raw
+//  data is kept as a single line.
+//
+struct AT_Response
+{
+  char *at, *urc, *data;
+};
+
+//
+//  AT Unsolicited Result Code.
+//  Prefix: Beginning of the line of the code.
+//  At: Prefix of the command whose reply starts the same way, while it is
+//  the active command the line is also kept as part of its reply. Null when
+//  the code is never part of a reply.
+//  Handler: Function called with the line, null to only drop it.
+//
+struct AT_Urc
+{
+  char *prefix, *at;
+  void (*handler)(struct Slice line);
+};
+
+//
+//  AT Time Out.
+//  At: Prefix of the commands sharing the estimator.
+//  Radio: The reply depends on the mobile network, the time out is scaled by
+//  the signal strength.
+//
+struct AT_Timeout
+{
+  char *at;
+  uint8_t radio;
+};
+
+//
+//  AT Round Trip Estimator.
+//  Srtt/Rttvar: Smoothed round trip time and its mean deviation in ms, as the
+//  retransmission timer of TCP (RFC 6298).
+//  Samples: Replies received, up to AT_RTO_SAMPLES.
+//  Backoff: Times the time out is doubled, set by the commands that timed
+//  out and cleared by the next reply.
+//
+struct AT_Rto
+{
+  uint32_t srtt, rttvar;
+  uint8_t samples, backoff;
+};
+
+//
+//  Adaptive Time Outs.
+//  Enabled: The learned time outs are used.
+//  Rssi: Last signal strength reported by AT+CSQ, RSSI_UNKNOWN for none.
+//  Rto: Estimators of the commands of g_at_timeouts.
+//
+struct AT_Timeouts
+{
+  uint8_t enabled, rssi;
+  struct AT_Rto rto[AT_TIMEOUT_COMMANDS];
+};
+
+//
+//  AT Command.
+//  At: Command to be sent, it must remain valid until it is completed.
+//  Length: Number of bytes of raw data sent as they are instead of a command
+//  line, zero for a command.
+//  Time out: Time to wait for the reply in ms.
+//  Callback: Function called when the command is completed.
+//  Context: User pointer passed to the callback.
+//
+struct AT_Command
+{
+  char *at;
+  uint16_t length, time_out;
+  SIM868_at_callback_t callback;
+  void *context;
+};
+
+//
+//  AT Command Engine.
+//  Queue: Commands waiting to be sent, the first one is the active command.
+//  Head/Count: Position of the active command and number of queued commands.
+//  Busy: The active command was sent and its reply is pending.
+//  Sent at: Tick when the active command was sent.
+//  Response: Lines expected for the active command, null for none.
+//  Line start: Position in the sim ring of the line being assembled.
+//  Line/Line count: Slices of the lines of the reply and number of lines.
+//  Result: Final result code already received, AT_NO_RESULT for none.
+//  Data length: Characters of raw data still to be received.
+//  Urc callback/context: Function of the application called with each
+//  unsolicited result code, and its user pointer.
+//  Time out: Time to wait for the reply of the active command, the one
+//  requested or less when it was learned.
+//  Rto: Index of the estimator of the active command, AT_RTO_NONE for none.
+//
+struct AT_Engine
+{
+  struct AT_Command queue[AT_QUEUE_LENGTH];
+  uint8_t head, count, busy, rto;
+  uint32_t sent_at, time_out;
+  const struct AT_Response *response;
+  uint16_t line_start;
+  struct Slice line[AT_REPLY_LINES];
+  uint8_t line_count, result;
+  uint16_t data_length;
+  SIM868_urc_callback_t urc_callback;
+  void *urc_context;
+};
+static struct AT_Engine gs_at_engine;
+
+//
+//  Task.
+//  Running: A task is running, it is resumed by SIM868_poll() and by the
+//  completion of its AT commands.
+//  AT state: TASK_AT_NONE, TASK_AT_SENT or TASK_AT_DONE, state of the last AT
+//  command of the task.
+//  Error status: Result of the task, or of the last step completed.
+//  State, method, attempts/max attempts: Parameters of the task.
+//  Line: Lines where the steps are resumed, one for each nested step.
+//  Value: Value parsed from a reply.
+//  Length/Window: Size of the json structure and time to download it.
+//  Since: Tick when the task started waiting.
+//  AT: Command built by the task.
+//  Step: First step of the task.
+//  Callback/Context: Function called when the task is completed, and its user
+//  pointer.
+//
+struct Sim_Task
+{
+  uint8_t running, at_state, error_status;
+  uint8_t state, method, attempts, max_attempts;
+  uint16_t line[TASK_DEPTH];
+  uint16_t value;
+  uint32_t length, window, since;
+  char at[TASK_AT_LENGTH];
+  uint8_t (*step)(uint8_t depth);
+  SIM868_task_callback_t callback;
+  void *context;
+};
+static struct Sim_Task gs_sim_task;
+
+//
+//  RTOS Port.
+//  Task: Modem task, it is the only one running the AT engine.
+//  Queue: Requests posted by the other tasks.
+//  Active: Request being run, null for none.
+//
+#if SIM868_RTOS
+struct Rtos_Port
+{
+  TaskHandle_t task;
+  QueueHandle_t queue;
+  struct SIM868_Request *active;
+};
+static struct Rtos_Port gs_rtos_port;
+#endif
+static struct AT_Timeouts gs_at_timeouts = { .enabled = true, .rssi = RSSI_UNKNOWN };
+
 //*****************************************************************************
 //
 //  The following are global arrays to store data and variables
@@ -183,25 +930,133 @@ struct GNSS_Data_Time gs_gnss_data_time;
 //
 //*****************************************************************************
 
-static uint8_t g_gnss_is_data_fixed;
 static uint16_t g_http_status_code;
-static char g_sim_buffer[REPLY_BUFFER_LENGTH];
-static char g_http_buffer[REPLY_BUFFER_LENGTH];
-static char g_gnss_buffer[REPLY_BUFFER_LENGTH];
+static uint32_t g_http_data_length;
+
+//
+//  Receive pool of the SIM868 and GNSS serial ports. It holds a ring for each
+//  port, filled by SIM868_rx_handler() and SIM868_gnss_rx_handler() and
+//  processed by SIM868_poll(), so the GNSS output keeps being parsed while
+//  the SIM868 waits for a reply. The replies are slices of the SIM868 ring.
+//
+static char g_rx_pool[RX_POOL_LENGTH];
+static struct Ring gs_sim_ring = { g_rx_pool, SIM_RX_LENGTH, 0, 0, 0 };
+static struct Ring gs_gnss_ring = { &g_rx_pool[SIM_RX_LENGTH], GNSS_RX_LENGTH, 0, 0, 0 };
+
+//
+//  Statistics.
+//  Snapshot: Counters returned by SIM868_get_stats(), the mean is computed
+//  from the total when it is read.
+//  Total/Replied: Sum of the round trip times and number of commands with a
+//  reply, of each class.
+//
+struct AT_Stats
+{
+  struct SIM868_Stats snapshot;
+  uint32_t total[SIM868_STATS_CLASSES];
+  uint16_t replied[SIM868_STATS_CLASSES];
+};
+
+//
+//  Class of AT Commands.
+//  At: Prefix of the commands.
+//  Class: Counters where the commands are recorded.
+//
+#if SIM868_STATS
+struct AT_Stats_Class
+{
+  char *at;
+  uint8_t class;
+};
+#endif
 
-const static tuint8_t g_utc_hours[] =
+//
+//  Data of the last Http response, it is held in the sim ring
+//  until the next Http request.
+//
+static struct Slice gs_http_response;
+
+//
+//  Counters of the AT commands and of the Http requests.
+//
+#if SIM868_STATS
+static struct AT_Stats gs_at_stats;
+#endif
+
+//
+//  Final result codes that complete an AT command.
+//
+static const struct AT_Result g_at_results[] =
+{
+  {"OK", NO_ERROR},
+  {"DOWNLOAD", NO_ERROR},
+  {"> ", NO_ERROR},
+  {"ERROR", ERROR_REPLY},
+  {"+CME ERROR:", ERROR_REPLY},
+  {"+CMS ERROR:", ERROR_REPLY},
+  {"SEND OK", NO_ERROR},
+  {"SEND FAIL", ERROR_REPLY},
+  {"CLOSE OK", NO_ERROR},
+  {"SHUT OK", NO_ERROR}
+};
+
+//
+//  Commands whose reply does not end with the final result code.
+//
+static const struct AT_Response g_at_responses[] =
+{
+  {"AT+HTTPACTION", "+HTTPACTION: ", 0},
+  {"AT+HTTPREAD", 0, "+HTTPREAD: "},
+  {"AT+CIPSTART", "CONNECT", 0},
+  {"AT+CIPRXGET=2", 0, "+CIPRXGET: 2,"}
+};
+
+//
+//  Commands whose time out is learned, the first prefix matching the command
+//  is used. The time of any other command is the requested one, since
+//  it may depend on its parameters (AT+CGATT=1 and the JSON upload).
+//
+static const struct AT_Timeout g_at_timeouts[AT_TIMEOUT_COMMANDS] =
 {
-  0, 1, 2,
-  3, 4, 5
+  {"AT+CSQ", false},
+  {"AT+CREG?", false},
+  {"AT+CGATT?", false},
+  {"AT+CGATT=1", true},
+  {"AT+SAPBR=0", true},
+  {"AT+SAPBR=1", true},
+  {"AT+SAPBR=2", false},
+  {"AT+SAPBR=3", false},
+  {"AT+HTTPINIT", false},
+  {"AT+HTTPPARA", false},
+  {"AT+HTTPTERM", false},
+  {"AT+HTTPDATA", false},
+  {"AT+HTTPACTION", true},
+  {"AT+HTTPREAD", false}
 };
 
-const static uint8_t g_fix_hours[] =
+//
+//  Classes of the AT commands for the statistics, a command not listed is
+//  recorded as SIM868_STATS_OTHER.
+//
+#if SIM868_STATS
+static const struct AT_Stats_Class g_at_stats_classes[] =
 {
-  18, 19, 20,
-  21, 22, 23
+  {"AT+CREG", SIM868_STATS_NETWORK},
+  {"AT+CGREG", SIM868_STATS_NETWORK},
+  {"AT+CGATT", SIM868_STATS_NETWORK},
+  {"AT+COPS", SIM868_STATS_NETWORK},
+  {"AT+CSQ", SIM868_STATS_NETWORK},
+  {"AT+SAPBR", SIM868_STATS_BEARER},
+  {"AT+HTTPINIT", SIM868_STATS_HTTP_SETUP},
+  {"AT+HTTPPARA", SIM868_STATS_HTTP_SETUP},
+  {"AT+HTTPTERM", SIM868_STATS_HTTP_SETUP},
+  {"AT+HTTPDATA", SIM868_STATS_HTTP_DATA},
+  {"AT+HTTPACTION", SIM868_STATS_HTTP_ACTION},
+  {"AT+HTTPREAD", SIM868_STATS_HTTP_READ}
 };
+#endif
 
-const static uint8_t g_last_day_month[] =
+static const uint8_t g_last_day_month[] =
 {
   0, 31, 28,
   31, 30, 31,
@@ -223,47 +1078,207 @@ static uint8_t sim_power_up(void);
 static uint8_t sim_power_dowm(void);
 static void sim_change_state(void);
 
+//
+//  Low Power.
+//
+static uint8_t sleep_is_ready(void);
+
+//
+//  Trace Buffer.
+//
+static void trace_record(uint8_t event, char *at, uint8_t error_status, uint16_t elapsed);
+
+//
+//  Statistics.
+//
+static void stats_record(char *at, uint8_t error_status, uint16_t elapsed);
+
 //
 //  SIM Card.
 //
-static uint8_t sim_card_pin(void);
-static uint8_t sim_card_status(void);
-static uint8_t sim_card_enable(void);
+static uint8_t task_sim_card_init(uint8_t depth);
 
 //
 //  GPRS/GSM.
 //
 static uint16_t gprs_query(void);
-static uint8_t gprs_network_rssi(void);
-static uint8_t gprs_network_mode(void);
-static uint8_t gsm_network_registration(void);
+static uint8_t task_gprs_enable(uint8_t depth);
+static uint8_t task_gprs_gsm_init(uint8_t depth);
 
 //
 //  GNSS (Global Navigation Satellite System )
 //
-static void gnss_read_data(void);
+static void nmea_process_char(char incoming_char);
+static void nmea_end_field(void);
+static void nmea_identify(void);
+static void nmea_position(uint8_t field);
+static void nmea_time(struct GNSS_Data_Time *time, uint8_t date);
+static uint16_t nmea_speed(void);
+static int32_t nmea_fixed(uint8_t decimals);
 
 //
-//  Http Protocol.
+//  Time Service.
 //
-static uint8_t http_init(void);
-static uint8_t http_read_all(void);
-static uint8_t http_start(uint8_t method);
-static uint8_t http_action(uint16_t time_out, uint8_t method);
+static void time_sync(struct GNSS_Fix *fix);
+static uint8_t time_has_date(struct GNSS_Data_Time *time);
+static uint32_t time_local(uint32_t seconds);
+static uint32_t time_seconds(struct GNSS_Data_Time *time);
+static void time_date(struct GNSS_Data_Time *time, uint32_t seconds);
 
 //
-//  Helper functions to verify responses.
+//  Report Batch.
 //
-static void get_reply(char *at, uint16_t time_out);
-static void read_line(uint16_t time_out, uint8_t lines);
+static uint16_t batch_serialize(struct GNSS_Fix_Record *record, uint8_t head, uint8_t count);
+static uint8_t batch_spill(void);
+static uint8_t batch_post(uint8_t max_attempts);
+static uint16_t encode_varint(uint8_t *buffer, uint32_t value);
+static uint32_t encode_zigzag(int32_t value);
+
+//
+//  Report Store.
+//
+#if SIM868_STORE_SECTORS > 0
+static void store_mount(void);
+static uint8_t store_read(uint8_t sector, uint16_t entry, struct Store_Entry *store_entry);
+static uint8_t store_write(uint8_t type, struct GNSS_Fix_Record *fix);
+static uint8_t store_next_sector(void);
+static uint8_t store_check(struct Store_Entry *store_entry);
+static uint8_t store_load(struct GNSS_Fix_Record *record, uint32_t *last);
+#endif
+static uint16_t batch_print_degrees(char *buffer, int32_t microdegrees);
+
+//
+//  Http Protocol.
+//
+static uint8_t task_http_init(uint8_t depth);
+static char *http_para(uint8_t flag);
+static uint8_t http_build_para(char *command, uint16_t size, const char *name,
+                               const char *value, const char *suffix,
+                               uint8_t flag);
+static uint8_t task_http_start(uint8_t depth);
+static uint8_t task_http_prepare(uint8_t depth);
+static uint8_t task_http_send_request(uint8_t depth);
+static uint8_t task_http_request(uint8_t depth);
+static uint8_t http_action_result(void);
+static void http_request_done(uint8_t error_status, void *context);
+static void http_action_done(uint8_t error_status, void *context);
+static void http_request_end(uint8_t error_status);
+static uint8_t http_read_data(struct Slice *data);
+static void http_sink_slice(struct Slice s, SIM868_http_sink_t sink, void *context);
+
+//
+//  Socket.
+//
+static uint8_t socket_context(void);
+
+//
+//  MQTT Protocol.
+//
+static uint16_t mqtt_put_length(uint8_t *packet, uint32_t length);
+static uint16_t mqtt_put_string(uint8_t *packet, char *string);
+static uint8_t mqtt_send(uint8_t *packet, uint16_t length);
+static uint8_t mqtt_wait(uint8_t type, uint16_t id, uint32_t time_out);
+static void mqtt_receive(void);
+static void mqtt_handle(uint8_t *packet, uint16_t length, uint16_t header);
+static void mqtt_lost(void);
+
+//
+//  AT command engine.
+//
+static uint8_t at_queue(char *at, uint16_t length, uint16_t time_out, SIM868_at_callback_t callback, void *context);
+static uint8_t at_chain(char *line, uint16_t size, const char *at);
+static void at_dispatch(void);
+static void at_wait_idle(void);
+static void at_complete(uint8_t error_status);
+static void at_release(void);
+static void at_end_line(uint16_t end, bool raw);
+static uint8_t at_urc(struct Slice line);
+static void at_process_char(uint16_t position);
+static void at_receive(void);
+static uint32_t at_timeout(char *at, uint16_t time_out);
+static void at_rto_update(uint8_t error_status, uint32_t elapsed);
+static uint8_t at_result(struct Slice line);
+
+//
+//  Tasks.
+//
+static uint8_t task_start(uint8_t (*step)(uint8_t depth), SIM868_task_callback_t callback, void *context);
+static uint8_t task_wait(void);
+static void task_resume(void);
+static uint8_t task_send(char *at, uint16_t time_out);
+static void task_at_done(uint8_t error_status, void *context);
+
+//
+//  RTOS Port.
+//
+#if SIM868_RTOS
+static void rtos_task(void *parameters);
+static void rtos_start(struct SIM868_Request *request);
+static void rtos_done(uint8_t error_status, void *context);
+static void rtos_at_done(uint8_t error_status, void *context);
+#endif
+
+//
+//  Slices of the sim ring.
+//
+static char slice_char(struct Slice s, uint16_t i);
+static bool slice_equals(struct Slice s, char *text);
+static bool slice_starts_with(struct Slice s, char *text);
+static struct Slice slice_skip(struct Slice s, uint16_t n);
+static uint32_t slice_to_uint(struct Slice s);
+static uint32_t slice_to_hex(struct Slice s);
+static uint16_t slice_copy(struct Slice s, char *buffer, uint16_t length);
+
+//
+//  Helper functions to verify responses.
+//
+static void get_reply(char *at, uint16_t time_out);
+static struct Slice *reply_line(uint8_t line);
+static struct Slice *reply_find(char *reply);
+static uint8_t reply_check(char *reply);
 static uint8_t send_check_reply(char *at, char *reply, uint16_t time_out);
+static uint8_t send_check_data(uint8_t *data, uint16_t length, char *reply, uint16_t time_out);
 static uint8_t parse_reply(char *reply, uint16_t *v, char divider, uint8_t index);
-static uint8_t send_parse_reply(char *at, char *reply, uint16_t *v, char divider, uint8_t index, uint16_t time_out);
+static uint8_t reply_tokenize(char *reply, char divider, struct Reply_Field *field, uint8_t max_fields);
+static uint8_t slice_tokenize(struct Slice p, char divider, struct Reply_Field *field, uint8_t max_fields);
+
+//
+//  Handlers of the unsolicited result codes.
+//
+static void urc_creg(struct Slice line);
+static void urc_cgreg(struct Slice line);
+static void urc_bearer_closed(struct Slice line);
+static void urc_pdp_closed(struct Slice line);
+static void urc_socket_data(struct Slice line);
+static void urc_socket_closed(struct Slice line);
+static void urc_power_down(struct Slice line);
 
 //
-//  Delay function for long periods.
+//  Unsolicited result codes, they are taken out of the reply of the active
+//  command before it is matched.
 //
-static void delay_seconds(uint8_t seconds);
+static const struct AT_Urc g_at_urcs[] =
+{
+  {"+CREG: ", "AT+CREG", urc_creg},
+  {"+CGREG: ", "AT+CGREG", urc_cgreg},
+  {"+SAPBR 1: DEACT", 0, urc_bearer_closed},
+  {"+PDP: DEACT", 0, urc_pdp_closed},
+  {"+CIPRXGET: 1", 0, urc_socket_data},
+  {"CLOSED", 0, urc_socket_closed},
+  {"+HTTPACTION: ", "AT+HTTPACTION", 0},
+  {"+CPIN: NOT READY", "AT+CPIN", urc_pdp_closed},
+  {"+CFUN: ", "AT+CFUN", 0},
+  {"RING", 0, 0},
+  {"RDY", 0, 0},
+  {"Call Ready", 0, 0},
+  {"SMS Ready", 0, 0},
+  {"UNDER-VOLTAGE WARNNING", 0, 0},
+  {"OVER-VOLTAGE WARNNING", 0, 0},
+  {"UNDER-VOLTAGE POWER DOWN", 0, urc_power_down},
+  {"OVER-VOLTAGE POWER DOWN", 0, urc_power_down},
+  {"NORMAL POWER DOWN", 0, urc_power_down}
+};
+
 
 //*****************************************************************************
 //
@@ -272,1511 +1287,1548 @@ static void delay_seconds(uint8_t seconds);
 //*****************************************************************************
 //*****************************************************************************
 //
-//! @brief Initialize the SIM868.
+//! @brief Stores a character received from the SIM868.
 //!
-//! This function tries for two seconds to enable the autobaud mode of the
-//! SIM868 to establish a synchronize communication be the module and the MCU.
+//! This function should be called from the receive interrupt of the SIM868
+//! serial port. The character is only stored, the processing is done later by
+//! SIM868_poll().
 //!
-//! @return error_status Result of autobauding, if error_status is equal to
-//!                      false, then the operation was successful, if not,
-//!                      an error_status occurred.
+//! @param[in] incoming_char Character received.
+//!
+//! @return None.
 //
 //*****************************************************************************
-uint8_t
-SIM868_init(void)
+void
+SIM868_rx_handler(char incoming_char)
 {
-  uint8_t error_status = false;
-
-  _debug_printf( "Initializing....\r\n\r\n");
+  uint16_t head = gs_sim_ring.head;
+  uint16_t next = (head + 1) % gs_sim_ring.size;
 
   //
-  //  Wait two sec for autobauding between the SIM868 and the MCU.
+  //  Drop the character if the ring is full.
   //
-  uint16_t time_out = 2000;
-  while (time_out > 0)
+  if (next == gs_sim_ring.tail)
   {
-    //
-    // Flush data.
-    //
-    while (_sim_data_available())
-    {
-      _sim_read_buffer();
-    }
+    #if SIM868_STATS
+        gs_at_stats.snapshot.rx_overruns++;
+    #endif
+    return;
+  }
 
-    //
-    //  Waiting for the SIM868 to echo an "OK".
-    //
-    if (!send_check_reply("AT", "OK", DEFAULT_TIMEOUT))
-    {
-      break;
-    }
+  gs_sim_ring.data[head] = incoming_char;
+  gs_sim_ring.head = next;
 
-    //
-    // Flush data.
-    //
-    while (_sim_data_available())
-    {
-      _sim_read_buffer();
-    }
+  #if SIM868_STATS
+      gs_at_stats.snapshot.bytes_received++;
+  #endif
+}
 
-    //
-    //  Waiting for the SIM868 to echo an "AT".
-    //
-    if (!send_check_reply("AT", "AT", DEFAULT_TIMEOUT))
-    {
-      break;
-    }
+//*****************************************************************************
+//
+//! @brief Stores a block of characters received from the SIM868.
+//!
+//! This function is the same as SIM868_rx_handler() for a DMA transfer or an
+//! idle line interrupt of the SIM868 serial port.
+//!
+//! @param[in] data   Characters received.
+//! @param[in] length Number of characters.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_rx_block(const char *data, uint16_t length)
+{
+  uint16_t i;
 
-    _debug_delay(500);
-    time_out -= 500;
+  for (i = 0; i < length; i++)
+  {
+    SIM868_rx_handler(data[i]);
   }
+}
 
+//*****************************************************************************
+//
+//! @brief Runs the AT command engine.
+//!
+//! This function parses the GNSS output received, processes the characters
+//! received from the SIM868, completes the active command when its reply
+//! arrives or its time out expires, and sends the next queued command. It
+//! never blocks, so it can be called from the main loop of the application.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_poll(void)
+{
   //
-  //  Turn off the echo mode.
+  //  Parse the GNSS output received, the modem task of the RTOS port leaves
+  //  it to the task that reads the fix.
   //
-  send_check_reply("ATE0", "OK", DEFAULT_TIMEOUT);
-  _debug_delay(100);
+  #if !SIM868_RTOS
+      SIM868_gnss_poll();
+  #endif
+
+  at_receive();
 
   //
-  //  Check if the autobauding was successful.
+  //  Check the time out of the active command.
   //
-  if (send_check_reply("ATE0", "OK", DEFAULT_TIMEOUT))
+  if (gs_at_engine.busy)
   {
-    error_status = ERROR_AUTOBAUD_MODE;
+    if ((uint32_t)(_sys_tick_ms() - gs_at_engine.sent_at) >= gs_at_engine.time_out)
+    {
+      at_complete(ERROR_TIMEOUT);
+    }
   }
-  else
+
+  //
+  //  Resume the running task, unless it waits for the reply of its command.
+  //
+  if (gs_sim_task.running && gs_sim_task.at_state != TASK_AT_SENT)
   {
-    _debug_printf("SIM868 auto baud, OK!\r\n\r\n");
-    _debug_delay(DEBUG_SHORT_DELAY);
+    task_resume();
   }
 
-  return error_status;
+  //
+  //  Send the next command, once the SIM868 is awake.
+  //
+  if (!gs_at_engine.busy && gs_at_engine.count)
+  {
+    if (sleep_is_ready())
+    {
+      at_dispatch();
+    }
+  }
+  //
+  //  Sleep once it has been idle long enough.
+  //
+  else if (!gs_at_engine.busy && gs_sleep_mode.idle_time &&
+           (uint32_t)(_sys_tick_ms() - gs_sleep_mode.idle_since) >= gs_sleep_mode.idle_time)
+  {
+    SIM868_sleep();
+  }
 }
 
 //*****************************************************************************
 //
-//! @brief Powers up/down or resets the SIM868.
+//! @brief Queues an AT command.
 //!
-//! This function sets the power level of the SIM868 to a desired state.
+//! This function queues an AT command to be sent by SIM868_poll(), it returns
+//! immediately. The callback is called once the reply is received or the time
+//! out expires.
 //!
-//! @param[in] state Indicates the operation to be performed.
-//!                  Turn Off -> 0.
-//!                  Turn On -> 1.
-//!                  Reset -> 2.
+//! @param[in] at       AT command, it must remain valid until completed.
+//! @param[in] time_out Time for waiting the reply in ms.
+//! @param[in] callback Completion function, it can be null.
+//! @param[in] context  User pointer passed to the callback.
 //!
-//! @return error_status Result of powering up/down or reseting, if
-//!                      error_status is eqaul to false, then the operation was
-//!                      successful, if not, an error_status occurred.
+//! @return error_status Result of queuing the command, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error_status occurred.
 //
 //*****************************************************************************
 uint8_t
-SIM868_set_power_level(uint8_t state)
+SIM868_at_send_async(char *at, uint16_t time_out, SIM868_at_callback_t callback, void *context)
 {
-  uint8_t error_status;
-  uint8_t curr_state = _sim_state();
-
-  switch (state)
-  {
-    //
-    //  Turn it on only if it's already off.
-    //
-    case ON:
-      if(curr_state == OFF)
-      {
-        error_status = sim_power_up();
-      }
-    break;
-
-    //
-    //  Turn it off only if it's already on.
-    //
-    case OFF:
-      if(curr_state == ON)
-      {
-        error_status = sim_power_dowm();
-      }
-    break;
-
-    case RESET:
-      //
-      //  Reset it only if it's already on.
-      //
-      if(curr_state == ON)
-      {
-        error_status = sim_power_dowm();
-        //
-        //  Double check it's off, before turn it on.
-        //
-        if(_sim_state() == OFF)
-        {
-            _debug_delay(2000);
-            error_status = sim_power_up();
-        }
-      }
-      else if(curr_state == OFF)
-      {
-        //
-        //  If it was off, turn it on.
-        //
-        error_status = sim_power_up();
-      }
-    break;
-
-    default:
-      error_status = ERROR_POWER_STATE;
-  }
+  return at_queue(at, 0, time_out, callback, context);
+}
 
-  return error_status;
+//*****************************************************************************
+//
+//! @brief Returns if the AT command engine has pending commands.
+//!
+//! @return true/false Commands are queued or waiting for a reply.
+//
+//*****************************************************************************
+uint8_t
+SIM868_at_is_busy(void)
+{
+  return (gs_at_engine.count > 0);
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the current state of the SIM868.
+//! @brief Returns the number of lines of the last reply.
 //!
-//! @return _sim_state() Macro function to read the state of the SIM868 from
-//!                      the MCU.
+//! @return line_count Number of lines, including the final result code.
 //
 //*****************************************************************************
 uint8_t
-SIM868_get_state(void)
+SIM868_at_get_reply_lines(void)
 {
-    return _sim_state();
+  return gs_at_engine.line_count;
 }
 
 //*****************************************************************************
 //
-//! @brief Initialize the SIM868 SIM Card.
+//! @brief Copies one line of the last reply received from the SIM868.
 //!
-//! This function performs several steps required to initilize successfully
-//! the SIM Card of the SIM868.
+//! @param[in]  line   Index of the line.
+//! @param[out] reply  Buffer where the line is copied.
+//! @param[in]  length Size of the buffer.
 //!
-//! @return error_status Result of SIM Card initialize, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error_status occurred.
+//! @return length Number of characters copied.
 //
 //*****************************************************************************
 uint8_t
-SIM868_sim_card_init(void)
+SIM868_at_read_reply(uint8_t line, char *reply, uint8_t length)
 {
-  uint8_t error_status;
-
-  error_status = sim_card_enable();
-  if (error_status)
-  {
-    return error_status
-  }
-
-  error_status = sim_card_status();
-  if (error_status)
-  {
-    return error_status
-  }
+  struct Slice *p = reply_line(line);
 
-  error_status = sim_card_pin();
-  if (error_status)
+  if (p == 0)
   {
-    return error_status
+    return slice_copy((struct Slice){ 0, 0 }, reply, length);
   }
 
-  _debug_printf("SIM Card ready!\r\n\r\n");
-  _debug_delay(DEBUG_SHORT_DELAY);
-
-  return error_status;
+  return slice_copy(*p, reply, length);
 }
 
 //*****************************************************************************
 //
-//! @brief Set the bearer service provider.
+//! @brief Sets the function called with each unsolicited result code.
 //!
-//! This function sets the bearer sevice provider for later usage with
-//! connecting to the network.
+//! The codes known by the library (RING, voltage warnings, +CREG...) are
+//! taken out of the replies and passed to this function, after the library
+//! has tracked them. The line is null terminated and it is only valid during
+//! the call, a callback should not send AT commands.
 //!
-//! @param[in] serivce Bearer service provider defined in the header file by
-//!                    the @enum Bearer_Service_Provider.
+//! @param[in] callback Function to be called, null for none.
+//! @param[in] context  User pointer passed to the callback.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_gprs_set_apn(uint8_t serivce)
+SIM868_at_set_urc_callback(SIM868_urc_callback_t callback, void *context)
 {
-    switch(serivce)
-    {
-        case M2M:
-            gs_bearer_config.apn = "m2m.amx";
-            gs_bearer_config.user = "jasper";
-            gs_bearer_config.pwd = "jasper";
-        break;
-
-        case ATT:
-            gs_bearer_config.apn = "modem.nexteldata.com.mx";
-            gs_bearer_config.user = " ";
-            gs_bearer_config.pwd = " ";
-        break;
-
-        case IUSACELL:
-            gs_bearer_config.apn = "modem.nexteldata.com.mx";
-            gs_bearer_config.user = " ";
-            gs_bearer_config.pwd = " ";
-        break;
-
-        case MOVISTAR:
-            gs_bearer_config.apn = "internet.movistar.mx";
-            gs_bearer_config.user = "movistar";
-            gs_bearer_config.pwd = "movistar";
-        break;
-
-        case TELCEL:
-            gs_bearer_config.apn = "internet.itelcel.com";
-            gs_bearer_config.user = "webgprs";
-            gs_bearer_config.pwd = "webgprs2003";
-        break;
-
-        default:
-          _debug_printf("The bearer service provider entered is no available!\n\r");
-    }
+  gs_at_engine.urc_callback = callback;
+  gs_at_engine.urc_context = context;
 }
 
 //*****************************************************************************
 //
-//! @brief Enable the GPRS serivce.
+//! @brief Enables the adaptive time outs of the AT commands.
 //!
-//! This function executes a serie of steps to connect the SIM868 to a 2G
-//! network, starting from the configuration of the bearer service provider
-//! up to establishing the physical connection.
+//! The time out of the commands replied in a regular time is learned from
+//! their round trip time, so a command that failed is retried without
+//! waiting for the worst case. The requested time out is never exceeded.
 //!
-//! @param[in] state Action to be perform (connect or disconnect).
+//! @param[in] state true to use the learned time outs (default), false to
+//!                  wait the requested time out.
 //!
-//! @return error_status Result of enabling the GPRS service, if error_status
-//!                      is equal to false, then the operation was successful,
-//!                      if not, an error_status occurred.
+//! @return None.
 //
 //*****************************************************************************
-uint8_t SIM868_gprs_enable(bool state)
+void
+SIM868_at_set_adaptive_timeout(uint8_t state)
 {
-  uint8_t error_status;
-  uint16_t module_state;
-
-  //
-  //  Verify that the GPRS modem is attached to the network.
-  //
-  if(send_parse_reply("AT+CGATT?", "+CGATT: ", &module_state, ',', 0, 20000))
-  {
-    return ERROR_REPLY;
-  }
-
-  //
-  //  If the device is not yet attached to GPRS serivce, then attach it.
-  //
-  if (state && !module_state)
-  {
-    if (send_check_reply("AT+CGATT=1", "OK", 20000))
-    {
-      return ERROR_GPRS_SERVICE;
-    }
-  }
-
-  //
-  //  Get the current bearer connection status.
-  //
-  uint8_t bearer_state = gprs_query();
-
-  //
-  //  If the connection is closed, and should be opend (state == ON),
-  //  then open the connection.
-  //
-  if(state && (bearer_state == CLOSED))
-  {
-    //
-    //  Set the bearer profile -> connection type.
-    //
-    if (send_check_reply("AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\"", "OK", 10000))
-    {
-      return ERROR_REPLY;
-    }
-
-    char bearer_apn[APN_BUFFER_LENGTH];
-    sprintf(bearer_apn, "AT+SAPBR=3,1,\"APN\",\"%s\"", gs_bearer_config.apn);
-
-    //
-    //  Set the bearer profile -> access point name.
-    //
-    if (send_check_reply(bearer_apn, "OK", 10000))
-    {
-      return ERROR_REPLY;
-    }
-
-    char bearer_user[APN_BUFFER_LENGTH];
-    sprintf(bearer_user, "AT+SAPBR=3,1,\"USER\",\"%s\"", gs_bearer_config.user);
-
-    //
-    //  Set APN -> username.
-    //
-    if (send_check_reply(bearer_user, "OK", 10000))
-    {
-      return ERROR_REPLY;
-    }
-
-    char bearer_pwd[APN_BUFFER_LENGTH];
-    sprintf(bearer_pwd, "AT+SAPBR=3,1,\"PWD\",\"%s\"", gs_bearer_config.pwd);
-
-    //
-    //  Set APN -> password.
-    //
-    if (send_check_reply(bearer_pwd , "OK", 10000))
-    {
-      return ERROR_REPLY;
-    }
-
-    //
-    //  Open the GPRS context.
-    //
-    if (send_check_reply("AT+SAPBR=1,1", "OK", 30000))
-    {
-      return ERROR_GPRS_CONTEXT;
-    }
+  gs_at_timeouts.enabled = state;
+}
 
-    if(gprs_query() != CONNECTED)
-    {
-      return ERROR_GPRS_CONTEXT;
-    }
+//*****************************************************************************
+//
+//! @brief Returns if a task is running.
+//!
+//! @return true/false A task started by one of the _async() functions is not
+//!                    completed yet.
+//
+//*****************************************************************************
+uint8_t
+SIM868_task_is_running(void)
+{
+  return gs_sim_task.running;
+}
 
-    _debug_printf("Bearer is connected!\r\n\r\n");
-  }
-  else if(!state && (bearer_state == CONNECTED))
+#if SIM868_RTOS
+//*****************************************************************************
+//
+//! @brief Starts the RTOS port.
+//!
+//! This function creates the request queue and the modem task, it should be
+//! called once SIM868_init() is done and before the scheduler is started. The
+//! modem task runs SIM868_poll() and the requests, one at a time.
+//!
+//! @return error_status Result of creating the port, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_rtos_init(void)
+{
+  gs_rtos_port.queue = xQueueCreate(SIM868_RTOS_QUEUE_LENGTH, sizeof(struct SIM868_Request *));
+  if (gs_rtos_port.queue == NULL)
   {
-    //
-    //  Close the GPRS context.
-    //
-    if (send_check_reply("AT+SAPBR=0,1", "OK", 30000))
-    {
-      return  ERROR_GPRS_CONTEXT;
-    }
-
-    if(gprs_query() != CLOSED)
-    {
-      error_status = ERROR_GPRS_CONTEXT;
-    }
-
-    _debug_printf("Bearer is closed!\r\n\r\n");
+    return ERROR_RTOS;
   }
 
-  //
-  //  If the device is attached to the GPRS service, an shouldn't be (state == OFF),
-  //  then detached it.
-  //
-  if(!state && module_state)
+  if (xTaskCreate(rtos_task, "SIM868", SIM868_RTOS_STACK_SIZE, NULL,
+                  SIM868_RTOS_PRIORITY, &gs_rtos_port.task) != pdPASS)
   {
-      if (send_check_reply("AT+CGATT=0", "OK", 20000))
-      {
-        return ERROR_GPRS_SERVICE;
-      }
+    return ERROR_RTOS;
   }
 
-  _debug_delay(DEBUG_SHORT_DELAY);
-
   return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Initialization of the GPRS/GSM.
+//! @brief Posts a request to the modem task.
 //!
-//! This function performs several steps required to initilize successfully
-//! the GPRS/GSM network services of the SIM868.
+//! This function returns immediately, the task that posted the request gets
+//! a notification (xTaskNotifyGive) once it is done, and the done flag of the
+//! request is set. The requests are run in the order they were posted.
 //!
-//! @return error_status Result of gprs/gsm initialization, if error_status
-//!                      is equal to false, then the operation was successful,
-//!                      if not, an error_status occurred.
+//! @param[in] request Request, it must remain valid until it is done.
+//!
+//! @return error_status Result of posting the request, if error_status is
+//!                      equal to false, then the request is queued, if not,
+//!                      the queue is full.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gprs_gsm_init(void)
+SIM868_rtos_post(struct SIM868_Request *request)
 {
-  uint8_t error_status;
-
-  error_status = gprs_network_mode();
-  if(error_status)
-  {
-    return error_status;
-  }
-
-  error_status = gprs_network_rssi();
-  if(error_status)
-  {
-    return error_status;
-  }
+  request->notify = xTaskGetCurrentTaskHandle();
+  request->done = false;
 
-  error_status = gsm_network_registration();
-  if(error_status)
+  if (xQueueSend(gs_rtos_port.queue, &request, 0) != pdPASS)
   {
-    return error_status;
+    return ERROR_QUEUE_FULL;
   }
 
-  _debug_printf("GSM network registration, OK!\r\n\r\n");
-  _debug_delay(DEBUG_SHORT_DELAY);
-
-  error_status = SIM868_gprs_enable(true);
+  xTaskNotifyGive(gs_rtos_port.task);
 
-  return error_status;
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Sends an Http request.
+//! @brief Runs a request in the modem task.
 //!
-//! This function initilize and executes an new Http request. The number of
-//! attempts to perform this operation is passed as a parameter.
+//! This function posts the request and blocks the calling task until it is
+//! done, the other tasks keep running meanwhile.
 //!
-//! @param[in] method       Http method to be request (POTS/GET).
-//! @param[in] max_attempts Number of attempts to perfrom the full request.
+//! @param[in] request Request to be run.
 //!
-//! @return error_status Result of the Http request, if error_status is equal
-//!                      to false, then the operation was successful, if not,
-//!                      an error_status occurred.
+//! @return error_status Result of the request, if error_status is equal to
+//!                      false, then the operation was successful, if not, an
+//!                      error_status occurred.
 //
 //*****************************************************************************
 uint8_t
-SIM868_http_send_request(uint8_t method, uint8_t max_attempts)
+SIM868_rtos_request(struct SIM868_Request *request)
 {
   uint8_t error_status;
-  uint8_t attempts;
 
-  //
-  //  Initialize Http Service.
-  //
-  attempts = max_attempts;
-  while(attempts--)
+  error_status = SIM868_rtos_post(request);
+  if (error_status)
   {
-    //
-    //  Set all http header parameters.
-    //
-    error_status = http_init();
-    if (error_status == NO_ERROR)
-    {
-      break;
-    }
-    if (attempts == 0)
-    {
-      return ERROR_HTTP_SERVICE;
-    }
+    return error_status;
   }
 
   //
-  //  Start Http Session.
+  //  The calling task may be notified for other reasons, only the done flag
+  //  tells that the request is done. The notification of the request is
+  //  taken even if it was done first.
   //
-  attempts = max_attempts;
-  while(attempts--)
+  do
   {
-    //
-    //  Get response from server.
-    //
-    error_status = http_start(method);
-    if(error_status == NO_ERROR)
-    {
-      break;
-    }
-    if(attempts-- == 0)
-    {
-      return ERROR_HTTP_REQUEST;
-    }
-  }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  } while (!request->done);
 
-  return error_status;
+  return request->error_status;
 }
 
 //*****************************************************************************
 //
-//! @brief Sets user agent.
+//! @brief Receives a character from the UART interrupt.
 //!
-//! This function copies the user agent passed into the Http header parameters.
+//! This function stores the character as SIM868_rx_handler() does, and wakes
+//! the modem task at the end of each line or at the data prompt.
 //!
-//! @param[in] user_agent Http user agent parameter.
+//! @param[in] incoming_char Character received.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_http_set_user_agent(char *user_agent)
+SIM868_rtos_rx_isr(char incoming_char)
 {
-  strcpy(gs_http_header.userAgent, user_agent);
+  BaseType_t woken = pdFALSE;
+
+  SIM868_rx_handler(incoming_char);
+
+  if (incoming_char == '\n' || incoming_char == '>')
+  {
+    vTaskNotifyGiveFromISR(gs_rtos_port.task, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
 }
 
 //*****************************************************************************
 //
-//! @brief Sets content-type.
+//! @brief Receives a block of characters from the UART interrupt.
 //!
-//! This function copies the content-type passed into the Http header
-//! parameters.
+//! This function is the same as SIM868_rtos_rx_isr() for a DMA transfer or an
+//! idle line interrupt, the modem task is woken once for the whole block.
 //!
-//! @param[in] content_type Http content-type parameter.
+//! @param[in] data   Characters received.
+//! @param[in] length Number of characters.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_http_set_content_type(char *content_type)
+SIM868_rtos_rx_block_isr(const char *data, uint16_t length)
 {
-  strcpy(gs_http_header.content_type, content_type);
+  BaseType_t woken = pdFALSE;
+
+  SIM868_rx_block(data, length);
+
+  vTaskNotifyGiveFromISR(gs_rtos_port.task, &woken);
+  portYIELD_FROM_ISR(woken);
 }
+#endif
 
 //*****************************************************************************
 //
-//! @brief Sets user data.
+//! @brief Returns the number of entries of the trace buffer.
 //!
-//! This function copies the user data passed into the Http header
-//! parameters.
-//!
-//! @param[in] user_data Http user data parameter.
-//!
-//! @return None.
+//! @return count Zero when the trace buffer is removed (SIM868_TRACE_LENGTH).
 //
 //*****************************************************************************
-void
-SIM868_http_set_user_data(char *user_data)
+uint8_t
+SIM868_trace_get_count(void)
 {
-  strcpy(gs_http_header.userData, user_data);
+  #if SIM868_TRACE_LENGTH > 0
+      if (gs_trace_buffer.key == TRACE_KEY)
+      {
+        return gs_trace_buffer.count;
+      }
+  #endif
+
+  return 0;
 }
 
 //*****************************************************************************
 //
-//! @brief Sets root.
+//! @brief Reads an entry of the trace buffer.
 //!
-//! This function copies the root passed into the Http header parameters.
-//!
-//! @param[in] root Http root parameter.
+//! @param[in]  index Index of the entry, zero is the oldest one.
+//! @param[out] entry Entry read.
 //!
-//! @return None.
+//! @return true/false The entry exists.
 //
 //*****************************************************************************
-void
-SIM868_http_set_root(char *root)
+uint8_t
+SIM868_trace_read(uint8_t index, struct SIM868_Trace_Entry *entry)
 {
-  strcpy(gs_http_header.root, root);
+  if (index >= SIM868_trace_get_count())
+  {
+    return false;
+  }
+
+  #if SIM868_TRACE_LENGTH > 0
+      *entry = gs_trace_buffer.entry[(gs_trace_buffer.head + index) % SIM868_TRACE_LENGTH];
+  #else
+      (void)entry;
+  #endif
+
+  return true;
 }
 
 //*****************************************************************************
 //
-//! @brief Sets web service.
-//!
-//! This function copies the web service passed into the Http header parameters.
-//!
-//! @param[in] web_serivce Http web service parameter.
+//! @brief Clears the trace buffer.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_http_set_web_serivce(char *web_serivce)
+SIM868_trace_clear(void)
 {
-  strcpy(gs_http_header.web_service, web_serivce);
+  #if SIM868_TRACE_LENGTH > 0
+      gs_trace_buffer.head = 0;
+      gs_trace_buffer.count = 0;
+      gs_trace_buffer.key = TRACE_KEY;
+  #endif
 }
 
 //*****************************************************************************
 //
-//! @brief Sets json structure.
+//! @brief Copies the counters of the AT commands and of the Http requests.
 //!
-//! This function copies the json structure passed into the Http header
-//! parameters.
+//! The snapshot is all zeros when the counters are removed (SIM868_STATS).
 //!
-//! @param[in] json_structure Http json structure parameter.
+//! @param[out] stats Snapshot of the counters.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_http_set_json_structure(char *json_structure)
+SIM868_get_stats(struct SIM868_Stats *stats)
 {
-  strcpy(gs_http_header.json_structure, json_structure);
+  #if SIM868_STATS
+      uint8_t i;
+
+      *stats = gs_at_stats.snapshot;
+      for (i = 0; i < SIM868_STATS_CLASSES; i++)
+      {
+        if (gs_at_stats.replied[i])
+        {
+          stats->command[i].mean = gs_at_stats.total[i] / gs_at_stats.replied[i];
+        }
+      }
+  #else
+      memset(stats, 0, sizeof(*stats));
+  #endif
 }
 
 //*****************************************************************************
 //
-//! @brief Sets the GNSS module power state (ON/OFF).
+//! @brief Clears the counters of the AT commands and of the Http requests.
 //!
 //! @return None.
 //
 //*****************************************************************************
 void
-SIM868_gnss_set_power_level(uint8_t state)
-{
-    _gnss_enable(state);
-}
-
-//*****************************************************************************
-//
-//! @brief Returns the fix data status.
-//!
-//! This function reads the GNSS serial port to determine if the data is valid.
-//!
-//! @return g_gnss_is_data_fixed Fix data status.
-//
-//*****************************************************************************
-uint8_t
-SIM868_gnss_get_fix_status(void)
+SIM868_clear_stats(void)
 {
-  //
-  //  Read the output data from the GNSS serial port,
-  //  this will update the data fix status.
-  //
-  gnss_read_data();
-
-  return g_gnss_is_data_fixed;
+  #if SIM868_STATS
+      memset(&gs_at_stats, 0, sizeof(gs_at_stats));
+  #endif
 }
 
 //*****************************************************************************
 //
-//! @brief Get the data from the GNSS output.
+//! @brief Initialize the SIM868.
 //!
-//! This function parses and store the GNSS output. The latitud, longitude and
-//! speed will be assigened to the address of the variables passed. The data
-//! and time can be access through getter fucntions.
+//! This function tries for two seconds to enable the autobaud mode of the
+//! SIM868 to establish a synchronize communication be the module and the MCU.
 //!
-//! @return None.
+//! @return error_status Result of autobauding, if error_status is equal to
+//!                      false, then the operation was successful, if not,
+//!                      an error_status occurred.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gnss_get_data(float *lat, float *lon, uint8_t *speed_kph)
+SIM868_init(void)
 {
-  //
-  //  IMPORTANT: This functios considers time zone
-  //  UTC-6 for the data and time calculations.
-  //
-  char sec[2];
-  char min[2];
-  char hour[2];
-  char time[10];
-
-  char day[2];
-  char month[2];
-  char year[2];
-  char date[6];
-
-  double latitude;
-  double longitude;
-  double minutes;
-  float degrees;
+  uint8_t error_status = false;
 
-  uint8_t i;
-  uint8_t one_more_day;
+  _debug_printf( "Initializing....\r\n\r\n");
 
   //
-  //  Skip output mode.
-  //
-  char *tok = strtok(g_gnss_buffer, delimiter);
-  if (!tok)
-  {
-    return false;
-  }
-  //
-  //  Grab output time.
+  //  Warm start: the SIM868 was set up before the MCU was reset, a single
+  //  AT probe confirms it is still powered.
   //
-  char *timep = strtok(NULL, delimiter);
-  if (!timep)
+  if (gs_warm_start.key == WARM_START_KEY && _sim_state() == ON &&
+      !send_check_reply("AT", "OK", DEFAULT_TIMEOUT))
   {
-    return false;
+    _debug_printf("SIM868 warm start, OK!\r\n\r\n");
+    return NO_ERROR;
   }
 
-  //
-  //  Get current time.
-  //
-  strcpy(time, timep);
-  //
-  //  Get UTC hour.
-  //
-  hour[0] = time[0];
-  hour[1] = time[1];
-  //
-  //  Get minutes.
-  //
-  min[0] = time[2];
-  min[1] = time[3];
-  //
-  //  Get seconds.
-  //
-  sec[0] = time[4];
-  sec[1] = time[5];
-
-  //
-  //  Convert seconds, minutes and hours into integers.
-  //
-  gs_gnss_data_time.seconds = (uint8_t)atoi(sec);
-  gs_gnss_data_time.minutes = (uint8_t)atoi(min);
-  gs_gnss_data_time.hour = (uint8_t)atoi(hour);
+  gs_warm_start.key = 0;
+  gs_warm_start.sim_card_ready = false;
 
   //
-  //  If hour is about to change, then modify it.
+  //  Wait two sec for autobauding between the SIM868 and the MCU.
   //
-  if(gs_gnss_data_time.minutes == 59)
+  uint16_t time_out = 2000;
+  while (time_out > 0)
   {
-    if(gs_gnss_data_time.hour < 23)
+    //
+    // Flush data.
+    //
+    while (_sim_data_available())
     {
-      gs_gnss_data_time.hour += 1;
+      _sim_read_buffer();
     }
-    else
+
+    //
+    //  Waiting for the SIM868 to echo an "OK".
+    //
+    if (!send_check_reply("AT", "OK", DEFAULT_TIMEOUT))
     {
-      gs_gnss_data_time.hour = 0;
+      break;
     }
-  }
 
-  //
-  //  Adjust hour to UTC-6
-  //
-  if(gs_gnss_data_time.hour >= 6)
-  {
-    gs_gnss_data_time.hour -= 6;
-    one_more_day = false;
-  }
-  else
-  {
     //
-    // One day must be subtracted from current date.
+    // Flush data.
     //
-    one_more_day = true;
-    for(i = 0; i < 6; i++)
+    while (_sim_data_available())
     {
-      if(gs_gnss_data_time.hour == g_utc_hours[i])
-      {
-        gs_gnss_data_time.hour = g_fix_hours[i];
-      }
+      _sim_read_buffer();
     }
-  }
-
-  //
-  //  Skip fix identifier.
-  //
-  tok = strtok(NULL, delimiter);
-  if (!tok)
-  {
-    return false;
-  }
-  //
-  //  Grab the latitude.
-  //
-  char *latp = strtok(NULL, delimiter);
-  if (!latp)
-  {
-    return false;
-  }
-  //
-  //  Grab latitude direction.
-  //
-  char *latdir = strtok(NULL, delimiter);
-  if (!latdir)
-  {
-    return false;
-  }
-  //
-  //  Grab longitude.
-  //
-  char *longp = strtok(NULL, delimiter);
-  if (!longp)
-  {
-    return false;
-  }
-  //
-  //  Grab longitude direction.
-  //
-  char *longdir = strtok(NULL, delimiter);
-  if (!longdir)
-  {
-    return false;
-  }
-
-  latitude = atof(latp);
-  longitude = atof(longp);
 
-  //
-  // Convert latitude from minutes to decimal.
-  //
-  degrees = floor(latitude / 100);
-  minutes = latitude - (100 * degrees);
-  minutes /= 60;
-  degrees += minutes;
+    //
+    //  Waiting for the SIM868 to echo an "AT".
+    //
+    if (!send_check_reply("AT", "AT", DEFAULT_TIMEOUT))
+    {
+      break;
+    }
 
-  //
-  //  Turn direction into + or -
-  //
-  if (latdir[0] == 'S')
-  {
-    degrees *= -1;
+    _debug_delay(500);
+    time_out -= 500;
   }
 
-  *lat = degrees;
-
   //
-  //  Convert longitude from minutes to decimal.
+  //  Turn off the echo mode.
   //
-  degrees = floor(longitude / 100);
-  minutes = longitude - (100 * degrees);
-  minutes /= 60;
-  degrees += minutes;
+  send_check_reply("ATE0", "OK", DEFAULT_TIMEOUT);
+  _debug_delay(100);
 
   //
-  //  Turn direction into + or -
+  //  Check if the autobauding was successful.
   //
-  if (longdir[0] == 'W')
+  if (send_check_reply("ATE0", "OK", DEFAULT_TIMEOUT))
   {
-    degrees *= -1;
+    error_status = ERROR_AUTOBAUD_MODE;
   }
+  else
+  {
+    _debug_printf("SIM868 auto baud, OK!\r\n\r\n");
 
-  *lon = degrees;
-
-  //
-  //  Grab the speed in knots.
-  //
-  char *speedp = strtok(NULL, delimiter);
-
-  //
-  //  Convert to kph.
-  //
-  *speed_kph = atof(speedp) * 1.852;
+    //
+    //  Fix the baud rate and save the profile (echo off), so the next
+    //  start only needs to probe the SIM868.
+    //
+    char baud_rate[18];
+    sprintf(baud_rate, "AT+IPR=%lu", (unsigned long)SIM868_BAUD_RATE);
+    if (!send_check_reply(baud_rate, "OK", DEFAULT_TIMEOUT) &&
+        !send_check_reply("AT&W", "OK", DEFAULT_TIMEOUT))
+    {
+      gs_warm_start.key = WARM_START_KEY;
+    }
 
-  //
-  //  Skip track angle.
-  //
-  tok = strtok(NULL, delimiter);
-  if (!tok)
-  {
-    return false;
-  }
-  //
-  //  Grab date.
-  //
-  char *datep = strtok(NULL, delimiter);
-  if (!datep)
-  {
-    return false;
+    _debug_pause(DEBUG_SHORT_DELAY);
   }
 
-  //
-  //  Get current date.
-  //
-  strcpy(date, datep);
-  //
-  //  Get day.
-  //
-  day[0] = date[0];
-  day[1] = date[1];
-  //
-  //  Get month.
-  //
-  month[0] = date[2];
-  month[1] = date[3];
-  //
-  //  Get seconds.
-  //
-  year[0] = date[4];
-  year[1] = date[5];
+  return error_status;
+}
 
-  //
-  //  Convert days, months and years into integers.
-  //
-  gs_gnss_data_time.day = (uint8_t)atoi(day);
-  gs_gnss_data_time.month = (uint8_t)atoi(month);
-  gs_gnss_data_time.year = (uint8_t)atoi(year);
+//*****************************************************************************
+//
+//! @brief Powers up/down or resets the SIM868.
+//!
+//! This function sets the power level of the SIM868 to a desired state.
+//!
+//! @param[in] state Indicates the operation to be performed.
+//!                  Turn Off -> 0.
+//!                  Turn On -> 1.
+//!                  Reset -> 2.
+//!
+//! @return error_status Result of powering up/down or reseting, if
+//!                      error_status is eqaul to false, then the operation was
+//!                      successful, if not, an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_set_power_level(uint8_t state)
+{
+  uint8_t error_status = NO_ERROR;
+  uint8_t curr_state = _sim_state();
 
-  //
-  //  Check if there is one day less compare to UTC-6.
-  //
-  if(one_more_day)
+  switch (state)
   {
     //
-    //  If it is not the first day of the month, then only substract one day.
-    //  Otherwise, the current month has to be adjusted and maybe the year too.
+    //  Turn it on only if it's already off.
     //
-    if(gs_gnss_data_time.day == 1)
-    {
-      //
-      //  If it is not the first month of the year, then
-      //  only subtract one month, otherwise adjust both.
-      //
-      if(gs_gnss_data_time.month > 1)
+    case ON:
+      if(curr_state == OFF)
       {
-        gs_gnss_data_time.month -= 1;
+        error_status = sim_power_up();
       }
-      else
+    break;
+
+    //
+    //  Turn it off only if it's already on.
+    //
+    case OFF:
+      if(curr_state == ON)
       {
-        gs_gnss_data_time.month = 12;
-        gs_gnss_data_time.year -= 1;
+        error_status = sim_power_dowm();
       }
+    break;
 
+    case RESET:
       //
-      //  Use a table to get the last day of the month.
+      //  Reset it only if it's already on.
       //
-      for(i = 0; i < 13; i++)
+      if(curr_state == ON)
       {
-        if(gs_gnss_data_time.month == i)
+        error_status = sim_power_dowm();
+        //
+        //  Double check it's off, before turn it on.
+        //
+        if(_sim_state() == OFF)
         {
-          gs_gnss_data_time.day = g_last_day_month[i];
+            _debug_delay(2000);
+            error_status = sim_power_up();
         }
       }
-    }
-    else
-    {
-      gs_gnss_data_time.day -= 1;
-    }
+      else if(curr_state == OFF)
+      {
+        //
+        //  If it was off, turn it on.
+        //
+        error_status = sim_power_up();
+      }
+    break;
+
+    default:
+      error_status = ERROR_POWER_STATE;
   }
+
+  return error_status;
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the seconds of the current time.
+//! @brief Enables the sleep mode of the SIM868.
 //!
-//! @return seconds.
+//! This function enables the slow clock (AT+CSCLK=1). The SIM868 keeps the
+//! network registration and the bearer while it sleeps, so it is ready to
+//! send as soon as it is woken up with the DTR line.
+//!
+//! @param[in] idle_time Time in ms without commands before the SIM868 is put
+//!                      to sleep by SIM868_poll(), zero to only sleep when
+//!                      SIM868_sleep() is called.
+//!
+//! @return error_status Result of enabling the sleep mode, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error occurred.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gnss_get_seconds(void)
+SIM868_sleep_enable(uint16_t idle_time)
 {
-    return gs_gnss_data_time.seconds;
+  _sim_dtr(OFF);
+
+  if (send_check_reply("AT+CSCLK=1", "OK", DEFAULT_TIMEOUT))
+  {
+    return ERROR_REPLY;
+  }
+
+  gs_sleep_mode.enabled = true;
+  gs_sleep_mode.idle_time = idle_time;
+  gs_sleep_mode.idle_since = _sys_tick_ms();
+
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the minutes of the current time.
+//! @brief Disables the sleep mode of the SIM868.
 //!
-//! @return minutes.
+//! @return error_status Result of disabling the sleep mode, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error occurred.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gnss_get_minutes(void)
+SIM868_sleep_disable(void)
 {
-    return gs_gnss_data_time.minutes;
+  gs_sleep_mode.idle_time = 0;
+
+  if (send_check_reply("AT+CSCLK=0", "OK", DEFAULT_TIMEOUT))
+  {
+    return ERROR_REPLY;
+  }
+
+  gs_sleep_mode.enabled = false;
+
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the hour of the current time.
+//! @brief Puts the SIM868 to sleep.
 //!
-//! @return hour.
+//! This function releases the DTR line, the SIM868 sleeps once its serial
+//! port is idle. The next AT command wakes it up.
+//!
+//! @return error_status ERROR_POWER_STATE if the sleep mode is not enabled or
+//!                      a command is pending, NO_ERROR otherwise.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gnss_get_hour(void)
+SIM868_sleep(void)
 {
-    return gs_gnss_data_time.hour;
+  if (!gs_sleep_mode.enabled || gs_at_engine.busy || gs_at_engine.count)
+  {
+    return ERROR_POWER_STATE;
+  }
+
+  if (gs_sleep_mode.state != SLEEP_ASLEEP)
+  {
+    _sim_dtr(ON);
+    gs_sleep_mode.state = SLEEP_ASLEEP;
+  }
+
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the day of the current date.
+//! @brief Wakes up the SIM868.
 //!
-//! @return day.
+//! This function pulls the DTR line low and returns at once, the queued
+//! commands are sent SLEEP_WAKE_DELAY ms later, once the serial port of the
+//! SIM868 is ready. Calling it ahead of a batch hides that delay.
+//!
+//! @return None.
 //
 //*****************************************************************************
-uint8_t
-SIM868_gnss_get_day(void)
+void
+SIM868_wake(void)
 {
-    return gs_gnss_data_time.day;
+  if (gs_sleep_mode.state == SLEEP_ASLEEP)
+  {
+    _sim_dtr(OFF);
+    gs_sleep_mode.state = SLEEP_WAKING;
+    gs_sleep_mode.woken_at = _sys_tick_ms();
+    gs_sleep_mode.idle_since = gs_sleep_mode.woken_at;
+  }
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the month of the current date.
+//! @brief Returns if the SIM868 was put to sleep.
 //!
-//! @return month.
+//! @return true/false The SIM868 is sleeping or waking up.
 //
 //*****************************************************************************
 uint8_t
-SIM868_gnss_get_month(void)
+SIM868_is_sleeping(void)
 {
-    return gs_gnss_data_time.month;
+  return (gs_sleep_mode.state != SLEEP_AWAKE);
 }
 
 //*****************************************************************************
 //
-//! @brief Returns the year of the current date.
+//! @brief Returns the current state of the SIM868.
 //!
-//! @return year.
+//! @return _sim_state() Macro function to read the state of the SIM868 from
+//!                      the MCU.
 //
 //*****************************************************************************
-uint16_t
-SIM868_gnss_get_year(void)
+uint8_t
+SIM868_get_state(void)
 {
-    return (2000 + gs_gnss_data_time.year);
+    return _sim_state();
 }
 
 //*****************************************************************************
 //
-//! @brief Powers up the SIM868.
+//! @brief Initialization of the SIM Card.
 //!
-//! This function change the current state of the SIM868 to power it up.
+//! This function performs several steps required to initilize successfully
+//! the SIM Card of the SIM868, it runs SIM868_poll() until they are done.
 //!
-//! @return error_status Result of powering up, if error_status is equal to
-//!                      false, then the operation was successful, if not, an
-//!                      error occurred.
+//! @return error_status Result of SIM Card initialize, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error_status occurred.
 //
 //*****************************************************************************
-static uint8_t
-sim_power_up(void)
+uint8_t
+SIM868_sim_card_init(void)
 {
-  uint8_t error_status;
-  uint16_t time_out = 1000;
-
-  //
-  //  Change the state from off to on
-  //
-  sim_change_state();
-
-  //
-  //  Wait for 1 sec to see if the module goes on
-  //
-  while(time_out--)
+  if (task_start(task_sim_card_init, NULL, NULL))
   {
-    //
-    //  Read the current state of the SIM868 to see if it changed
-    //
-    if(_sim_state())
-    {
-      error_status = NO_ERROR;
-      break;
-    }
-    else
-    {
-      error_status = ERROR_POWER_STATE;
-    }
-
-    _debug_delay(1);
+    return ERROR_TASK_BUSY;
   }
 
-  return error_status;
+  return task_wait();
 }
 
 //*****************************************************************************
 //
-//  Private Functions.
-//
-//*****************************************************************************
-//*****************************************************************************
-//
-//! @brief Powers down the SIM868.
+//! @brief Starts the initialization of the SIM Card.
 //!
-//! This function change the current state of the SIM868 to power it down.
+//! This function returns immediately, the steps of SIM868_sim_card_init() are
+//! run by SIM868_poll() while the SIM868 is waited for.
 //!
-//! @return error_status Result of powering down, if error_status is equal to
-//!                      false, then the operation was successful, if not, an
-//!                      error occurred.
+//! @param[in] callback Function called when the task is completed, it can be
+//!                     null.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the task, if error_status is equal
+//!                      to false, then the task is running, if not, another
+//!                      task is running.
 //
 //*****************************************************************************
-static uint8_t
-sim_power_dowm(void)
+uint8_t
+SIM868_sim_card_init_async(SIM868_task_callback_t callback, void *context)
 {
-  uint8_t error_status;
-  uint16_t time_out = 1000;
-
-  //
-  //  Change the state from off to on
-  //
-  sim_change_state();
-
-  //
-  //  Wait for 1 sec to see if the module goes off
-  //
-  while(time_out--)
-  {
-    //
-    //  Read the current state of the SIM868 to see if it changed
-    //
-    if(!_sim_state())
-    {
-      error_status = NO_ERROR;
-      break;
-    }
-    else
-    {
-      error_status = ERROR_POWER_STATE;
-    }
-
-    _debug_delay(1);
-  }
-
-  return error_status;
+  return task_start(task_sim_card_init, callback, context);
 }
 
 //*****************************************************************************
 //
-//! @brief Changes the SIM868 current state.
+//! @brief Set the bearer service provider.
 //!
-//! This function switches the SIM868 state either from on to off or off to on.
+//! This function sets the bearer sevice provider for later usage with
+//! connecting to the network.
+//!
+//! @param[in] serivce Bearer service provider defined in the header file by
+//!                    the @enum Bearer_Service_Provider.
 //!
 //! @return None.
 //
 //*****************************************************************************
-static void
-sim_change_state(void)
+void
+SIM868_gprs_set_apn(uint8_t serivce)
 {
-    //
-    //  Change the SIM868 current state
-    //
-    _sim_power(ON);
-    _debug_delay(2000);
-    _sim_power(OFF);
-    _debug_delay(100);
+    switch(serivce)
+    {
+        case M2M:
+            SIM868_gprs_set_bearer("m2m.amx", "jasper", "jasper");
+        break;
+
+        case ATT:
+            SIM868_gprs_set_bearer("modem.nexteldata.com.mx", " ", " ");
+        break;
+
+        case IUSACELL:
+            SIM868_gprs_set_bearer("modem.nexteldata.com.mx", " ", " ");
+        break;
+
+        case MOVISTAR:
+            SIM868_gprs_set_bearer("internet.movistar.mx", "movistar", "movistar");
+        break;
+
+        case TELCEL:
+            SIM868_gprs_set_bearer("internet.itelcel.com", "webgprs", "webgprs2003");
+        break;
+
+        default:
+          _debug_printf("The bearer service provider entered is no available!\n\r");
+    }
 }
 
 //*****************************************************************************
 //
-//! @brief Enables the SIM Card detecting mode.
+//! @brief Set the bearer parameters.
 //!
-//! This function checks if the detecting mode of the SIM Card is already
-//! activated, if not, it is activated.
+//! This function builds the AT+SAPBR command line of the bearer profile and
+//! the AT+CSTT command of the TCP/IP stack, they are sent the next time the
+//! GPRS service is enabled.
 //!
-//! @return error_status Result of SIM Card operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @param[in] apn  Acces Point Name.
+//! @param[in] user Name of the service provider.
+//! @param[in] pwd  Password of the user.
+//!
+//! @return error_status If error_status is equal to false, then the
+//!                      parameters were set, if not, they do not fit the
+//!                      commands and the last ones are kept.
 //
 //*****************************************************************************
-static uint8_t
-sim_card_enable(void)
+uint8_t
+SIM868_gprs_set_bearer(const char *apn, const char *user, const char *pwd)
 {
-  uint16_t state;
+  uint16_t length = strlen(apn) + strlen(user) + strlen(pwd);
 
   //
-  //  First check the SIM Card detecting mode, this mode will
-  //  allow the SIM868 to detect if the SIM Card is inserted.
+  //  Each command adds its prefix, quotes and separator to the parameters.
   //
-  if(send_parse_reply("AT+CSDT?", "+CSDT: ", &state, ',', 0, DEFAULT_TIMEOUT))
+  if (length + sizeof(BEARER_PROFILE) > PROFILE_BUFFER_LENGTH ||
+      length + sizeof("AT+CSTT=\"\",\"\",\"\"") > CSTT_BUFFER_LENGTH)
   {
-    return ERROR_REPLY;
+    _debug_printf("The bearer parameters are too long!\n\r");
+    return ERROR_CONFIG;
   }
 
-  //
-  //  If the detecting mode is not set, then set it.
-  //
-  if(state != 1)
-  {
-    if (send_check_reply("AT+CSDT=1", "OK", DEFAULT_TIMEOUT))
-    {
-      return ERROR_REPLY;
-    }
-  }
+  sprintf(gs_bearer_config.profile, BEARER_PROFILE, apn, user, pwd);
+  sprintf(gs_bearer_config.cstt, "AT+CSTT=\"%s\",\"%s\",\"%s\"", apn, user, pwd);
+  gs_bearer_config.dirty = true;
 
   return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Check the SIM Card status.
+//! @brief Enable the GPRS serivce.
 //!
-//! This function checks if the SIM Card is inserted, if not then an error_status
-//! is returned.
+//! This function executes a serie of steps to connect the SIM868 to a 2G
+//! network, starting from the configuration of the bearer service provider
+//! up to establishing the physical connection. It runs SIM868_poll() until
+//! they are done.
 //!
-//! @return error_status Result of SIM Card operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @param[in] state ON to connect, OFF to disconnect.
+//!
+//! @return error_status Result of the GPRS service, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
 //
 //*****************************************************************************
-static uint8_t
-sim_card_status(void)
+uint8_t SIM868_gprs_enable(uint8_t state)
 {
-  uint16_t state;
-
-  //
-  //  Check if the SIM Card is inserted.
-  //
-  if(send_parse_reply("AT+CSMINS?", "+CSMINS: ", &state, ',', 1, DEFAULT_TIMEOUT))
-  {
-    return ERROR_REPLY;
-  }
-
-  //
-  //  If the SIM Card is not inserted, then send an error_status.
-  //
-  if(state != 1)
+  if (SIM868_gprs_enable_async(state, NULL, NULL))
   {
-    return ERROR_SIMCARD_STATUS;
+    return ERROR_TASK_BUSY;
   }
 
-  return NO_ERROR;
+  return task_wait();
 }
 
 //*****************************************************************************
 //
-//! @brief Check the SIM Card pin.
+//! @brief Starts enabling the GPRS serivce.
 //!
-//! This function checks if the SIM Card requires any password, if it does,
-//! then an error_status is returned.
+//! This function returns immediately, the steps of SIM868_gprs_enable() are
+//! run by SIM868_poll() while the SIM868 is waited for.
 //!
-//! @return error_status Result of SIM Card operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @param[in] state    ON to connect, OFF to disconnect.
+//! @param[in] callback Function called when the task is completed, it can be
+//!                     null.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the task, if error_status is equal
+//!                      to false, then the task is running, if not, another
+//!                      task is running.
 //
 //*****************************************************************************
-static uint8_t
-sim_card_pin(void)
+uint8_t
+SIM868_gprs_enable_async(uint8_t state, SIM868_task_callback_t callback, void *context)
 {
-  //
-  //  Request the pin state of the SIM Card.
-  //
-  get_reply("AT+CPIN?", 5000);
-
-  //
-  //  Parse the reply.
-  //
-  char *p = strstr(g_sim_buffer, "+CPIN: ");
-  if (p == 0)
+  if (task_start(task_gprs_enable, callback, context))
   {
-    return ERROR_REPLY;
+    return ERROR_TASK_BUSY;
   }
-  p += strlen("+CPIN: ");
 
-  //
-  //  Check if the SIM Card require any password.
-  //
-  if(strcmp(p, "READY") != 0)
-  {
-    return ERROR_SIMCARD_PIN
-  }
+  gs_sim_task.state = state;
 
   return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Get the status of the network.
+//! @brief Initialization of the GPRS/GSM.
 //!
-//! This function request the status of the bearer connection.
+//! This function performs several steps required to initilize successfully
+//! the GPRS/GSM network services of the SIM868, it runs SIM868_poll() until
+//! they are done.
 //!
-//! @return bearer_status Status of the network.
+//! @return error_status Result of gprs/gsm initialization, if error_status
+//!                      is equal to false, then the operation was successful,
+//!                      if not, an error_status occurred.
 //
 //*****************************************************************************
-static uint16_t
-gprs_query(void)
+uint8_t
+SIM868_gprs_gsm_init(void)
 {
-  uint16_t bearer_status;
-
-  //
-  //  Check the status of the bearer service provider.
-  //
-  if (send_parse_reply("AT+SAPBR=2,1", "+SAPBR: ", &bearer_status, ',', 1, 10000)) return ERROR_REPLY;
+  if (task_start(task_gprs_gsm_init, NULL, NULL))
+  {
+    return ERROR_TASK_BUSY;
+  }
 
-  return bearer_status;
+  return task_wait();
 }
 
 //*****************************************************************************
 //
-//! @brief Set network selection.
+//! @brief Starts the initialization of the GPRS/GSM.
 //!
-//! This function sets the automatic network selection mode of the SIM868.
+//! This function returns immediately, the steps of SIM868_gprs_gsm_init() are
+//! run by SIM868_poll() while the SIM868 is waited for, including the wait
+//! for the network registration.
 //!
-//! @return error_status Result of network selection mode, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @param[in] callback Function called when the task is completed, it can be
+//!                     null.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the task, if error_status is equal
+//!                      to false, then the task is running, if not, another
+//!                      task is running.
 //
 //*****************************************************************************
-static uint8_t
-gprs_network_mode(void)
+uint8_t
+SIM868_gprs_gsm_init_async(SIM868_task_callback_t callback, void *context)
 {
-  uint16_t state;
-
-  //
-  //  Verify that the currect selection of is in automatic mode.
-  //
-  if(send_parse_reply("AT+COPS?", "+COPS: ", &state, ',' , 0, DEFAULT_TIMEOUT))
-  {
-    return ERROR_REPLY;
-  }
-
-  //
-  //  If the selection mode is no in "automatic network selection", then set it.
-  //
-  if(state != 0 && error_status == false)
-  {
-    if (send_check_reply("AT+COPS=0", "OK", DEFAULT_TIMEOUT))
-    {
-      return ERROR_REPLY;
-    }
-  }
-
-  return NO_ERROR;
+  return task_start(task_gprs_gsm_init, callback, context);
 }
 
 //*****************************************************************************
 //
-//! @brief Evalutes the signal strength (RSSI).
+//! @brief Sets the time to wait for the GSM network registration.
 //!
-//! This function evalutes if the signal strength reciben by the service
-//! provider is strong enough to continue performing.
+//! @param[in] time_out Time in ms, GSM_REGISTRATION_TIMEOUT by default.
 //!
-//! @return error_status Result of network rssi operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @return None.
 //
 //*****************************************************************************
-static uint8_t
-gprs_network_rssi(void)
+void
+SIM868_gsm_set_registration_timeout(uint32_t time_out)
 {
-  uint16_t state;
+  gs_gsm_registration.time_out = time_out;
+}
 
-  //
-  //  Request the signal strength indicator (RSSI).
-  //
-  if (send_parse_reply("AT+CSQ", "+CSQ: ", &state, ',', 0, DEFAULT_TIMEOUT))
-  {
-    return ERROR_REPLY;
-  }
+//*****************************************************************************
+//
+//! @brief Returns the last GSM registration status reported.
+//!
+//! @return status NOT_REGISTERED, REGISTERED_HOME_NET, SEARCHING,
+//!                REGISTRATION_DENIED or REGISTRED_NO_HOME_NET.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gsm_get_registration_status(void)
+{
+  return gs_gsm_registration.status;
+}
 
-  //
-  //  Signal strength:
-  //  state < 9  - Unusable intensity.
-  //  state < 15  - Low intensity.
-  //  state < 20  - Medium intensity.
-  //  state < 32  - High intensity.
-  //
-  if(state < 9 && state > 32)
-  {
-    return ERROR_NETWORK_RSSI;
-  }
+//*****************************************************************************
+//
+//! @brief Returns the location area code of the serving cell.
+//!
+//! @return lac.
+//
+//*****************************************************************************
+uint16_t
+SIM868_gsm_get_lac(void)
+{
+  return gs_gsm_registration.lac;
+}
 
-  return NO_ERROR;
+//*****************************************************************************
+//
+//! @brief Returns the identifier of the serving cell.
+//!
+//! @return cell id.
+//
+//*****************************************************************************
+uint32_t
+SIM868_gsm_get_cell_id(void)
+{
+  return gs_gsm_registration.cell_id;
 }
 
 //*****************************************************************************
 //
-//! @brief Evalutes the signal strength (RSSI).
+//! @brief Sends an Http request.
 //!
-//! This function evalutes if the signal strength reciben by the service
-//! provider is strong enough to continue performing.
+//! This function initilize and executes an new Http request. The number of
+//! attempts to perform this operation is passed as a parameter. It runs
+//! SIM868_poll() until the request is done.
 //!
-//! @return error_status Result of network registration, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @param[in] method       Http method to be request (POTS/GET).
+//! @param[in] max_attempts Number of attempts to perfrom the full request.
+//!
+//! @return error_status Result of the Http request, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
 //
 //*****************************************************************************
-static uint8_t
-gsm_network_registration(void)
+uint8_t
+SIM868_http_send_request(uint8_t method, uint8_t max_attempts)
 {
-  uint16_t status;
   uint8_t error_status;
 
-  //
-  //  Perform GSM network registration in periods of 15-30 sec for 2 min.
-  //
-  uint8_t seconds;
-  uint8_t minutes;
-
-  for(minutes = 0; minutes < 2; minutes++)
+  error_status = SIM868_http_send_request_async(method, max_attempts, NULL, NULL);
+  if (error_status)
   {
-    seconds = 30;
+    return error_status;
+  }
 
-    while (seconds > 0)
-    {
-      //
-      //  Request the GSM network registration status.
-      //
-      send_parse_reply("AT+CREG?", "+CREG: ", &status, ',', 1, DEFAULT_TIMEOUT);
+  return task_wait();
+}
 
-      //
-      //  Both REGISTERED_HOME_NET and REGISTRED_NO_HOME_NET are successful
-      //  network registration results.
-      //
-      switch(status)
-      {
-        case NOT_REGISTERED:
-          error_status = ERROR_NETWORK_REGISTRATION;
-        break;
+//*****************************************************************************
+//
+//! @brief Starts an Http request.
+//!
+//! This function returns immediately, the steps of SIM868_http_send_request()
+//! are run by SIM868_poll() while the SIM868 is waited for. The response is
+//! read the same way, with SIM868_http_get_response() once the task is done.
+//!
+//! @param[in] method       Http method to be request (POTS/GET).
+//! @param[in] max_attempts Number of attempts to perfrom the full request.
+//! @param[in] callback     Function called when the task is completed, it can
+//!                         be null.
+//! @param[in] context      User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the task, if error_status is equal
+//!                      to false, then the task is running, if not, an
+//!                      error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_send_request_async(uint8_t method, uint8_t max_attempts, SIM868_task_callback_t callback, void *context)
+{
+  if (gs_http_request.pending)
+  {
+    return ERROR_HTTP_BUSY;
+  }
 
-        case REGISTERED_HOME_NET:
-        case REGISTRED_NO_HOME_NET:
-          error_status = NO_ERROR;
-        break;
+  if (task_start(task_http_send_request, callback, context))
+  {
+    return ERROR_TASK_BUSY;
+  }
 
-        case SEARCHING:
-          _debug_printf("Searching network...\r\n\r\n");
-        break;
+  gs_sim_task.method = method;
+  gs_sim_task.max_attempts = max_attempts;
 
-        case REGISTRATION_DENIED:
-          _debug_printf("Network registration denied\r\n\r\n");
-        break;
+  return NO_ERROR;
+}
 
-        default:
-          error_status = ERROR_REPLY;
-        break;
-      }
+//*****************************************************************************
+//
+//! @brief Sends an Http request without waiting for the server.
+//!
+//! This function returns immediately, the Http service is initialized and the
+//! JSON structure downloaded for the POST method by a task run by
+//! SIM868_poll(), which then queues the AT+HTTPACTION command. The callback is
+//! called from SIM868_poll() once the server replied or the request failed,
+//! or SIM868_http_is_pending() can be polled instead. The response data is
+//! left in the SIM868 to be read with SIM868_http_read_stream().
+//!
+//! @param[in] method   Http method to be request (POTS/GET).
+//! @param[in] callback Function called when the request is completed, it can
+//!                     be null. It should not send AT commands.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the Http request, if error_status
+//!                      is equal to false, then the request is pending, if
+//!                      not, another request or task is running.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_request_async(uint8_t method, SIM868_http_callback_t callback, void *context)
+{
+  struct Http_Request *request = &gs_http_request;
 
-      delay_seconds(15);
-      seconds -= 15;
-    }
+  if (request->pending)
+  {
+    return ERROR_HTTP_BUSY;
   }
 
-  return error_status;
+  if (task_start(task_http_request, http_request_done, NULL))
+  {
+    return ERROR_TASK_BUSY;
+  }
+
+  gs_sim_task.method = method;
+  request->callback = callback;
+  request->context = context;
+  request->pending = true;
+  request->error_status = NO_ERROR;
+
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Initilize an Http request.
+//! @brief Returns if an asynchronous Http request is waiting for the server.
 //!
-//! This function configues the handles any pending request, configues the
-//! header parameters for the new Http request.
+//! @return true/false The request is pending.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_is_pending(void)
+{
+  return gs_http_request.pending;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the result of the last asynchronous Http request.
 //!
-//! @return error_status Result of the Http request initialization, if
-//!                      error_status is equal to false, then the operation was
-//!                      successful, if not, an error occurred.
+//! @return error_status NO_ERROR, ERROR_HTTP_STATUS_CODE when the server
+//!                      failed, or the error that aborted the request.
 //
 //*****************************************************************************
-static uint8_t
-http_init(void)
+uint8_t
+SIM868_http_get_error_status(void)
 {
-  //
-  //  Handle any pending.
-  //
-  send_check_reply("AT+HTTPTERM", "OK", DEFAULT_TIMEOUT);
+  return gs_http_request.error_status;
+}
 
-  //
-  //  Init HTTP service.
-  //
-  if(send_check_reply("AT+HTTPINIT", "OK", DEFAULT_TIMEOUT))
+//*****************************************************************************
+//
+//! @brief Returns the status code sent by the server for the last request.
+//!
+//! @return status code.
+//
+//*****************************************************************************
+uint16_t
+SIM868_http_get_status_code(void)
+{
+  return g_http_status_code;
+}
+
+//*****************************************************************************
+//
+//! @brief Keeps the Http session alive between requests.
+//!
+//! While the session is kept alive, the Http service is not terminated after
+//! a request, and the next request only sends the header parameters that
+//! changed since the last one. The session is started again after an error.
+//!
+//! @param[in] state Keep alive (true) or terminate after each request (false).
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_http_set_keep_alive(uint8_t state)
+{
+  gs_http_session.keep_alive = state;
+  gs_http_session.active = false;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets user agent.
+//!
+//! This function builds the AT+HTTPPARA command of the user agent, it is sent
+//! with the next request.
+//!
+//! @param[in] user_agent Http user agent parameter.
+//!
+//! @return error_status If error_status is equal to false, then the parameter
+//!                      was set, if not, it does not fit the command and the
+//!                      last one is kept.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_set_user_agent(const char *user_agent)
+{
+  return http_build_para(gs_http_header.user_agent, UA_BUFFER_LENGTH, "UA",
+                         user_agent, "", HTTP_PARA_UA);
+}
+
+//*****************************************************************************
+//
+//! @brief Sets content-type.
+//!
+//! This function builds the AT+HTTPPARA command of the content-type, it is
+//! sent with the next request.
+//!
+//! @param[in] content_type Http content-type parameter.
+//!
+//! @return error_status If error_status is equal to false, then the parameter
+//!                      was set, if not, it does not fit the command and the
+//!                      last one is kept.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_set_content_type(const char *content_type)
+{
+  return http_build_para(gs_http_header.content_type, CONTENT_BUFFER_LENGTH,
+                         "CONTENT", content_type, "", HTTP_PARA_CONTENT);
+}
+
+//*****************************************************************************
+//
+//! @brief Sets user data.
+//!
+//! This function builds the AT+HTTPPARA command of the user data, it is sent
+//! with the next request.
+//!
+//! @param[in] user_data Http user data parameter.
+//!
+//! @return error_status If error_status is equal to false, then the parameter
+//!                      was set, if not, it does not fit the command and the
+//!                      last one is kept.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_set_user_data(const char *user_data)
+{
+  return http_build_para(gs_http_header.user_data, UD_BUFFER_LENGTH,
+                         "USERDATA", user_data, "", HTTP_PARA_USERDATA);
+}
+
+//*****************************************************************************
+//
+//! @brief Sets root.
+//!
+//! This function copies the root passed into the Http header parameters, and
+//! builds the AT+HTTPPARA command of the URL with the web service.
+//!
+//! @param[in] root Http root parameter.
+//!
+//! @return error_status If error_status is equal to false, then the parameter
+//!                      was set, if not, it does not fit the URL and the last
+//!                      one is kept.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_set_root(const char *root)
+{
+  if (strlen(root) >= ROOT_BUFFER_LENGTH ||
+      http_build_para(gs_http_header.url, URL_BUFFER_LENGTH, "URL", root,
+                      gs_http_header.web_service, HTTP_PARA_URL))
   {
-    return ERROR_HTTP_SERVICE;
+    return ERROR_CONFIG;
   }
 
-  //
-  //  Set bearer profile identifier.
-  //
-  if (send_check_reply("AT+HTTPPARA=\"CID\",1", "OK", DEFAULT_TIMEOUT))
+  strcpy(gs_http_header.root, root);
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets web service.
+//!
+//! This function copies the web service passed into the Http header
+//! parameters, and builds the AT+HTTPPARA command of the URL with the root.
+//!
+//! @param[in] web_serivce Http web service parameter.
+//!
+//! @return error_status If error_status is equal to false, then the parameter
+//!                      was set, if not, it does not fit the URL and the last
+//!                      one is kept.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_set_web_serivce(const char *web_serivce)
+{
+  if (strlen(web_serivce) >= WS_BUFFER_LENGTH ||
+      http_build_para(gs_http_header.url, URL_BUFFER_LENGTH, "URL",
+                      gs_http_header.root, web_serivce, HTTP_PARA_URL))
   {
-    return ERROR_REPLY;
+    return ERROR_CONFIG;
   }
 
+  strcpy(gs_http_header.web_service, web_serivce);
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets json structure.
+//!
+//! This function sets the json structure sent with the next POST request, it
+//! is not copied, so it has to be kept until the request is completed.
+//!
+//! @param[in] json_structure Http json structure parameter.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_http_set_json_structure(char *json_structure)
+{
+  gs_http_header.json_structure = json_structure;
+}
+
+//*****************************************************************************
+//
+//! @brief Copies the data of the last Http response.
+//!
+//! The data is held in the receive buffer until the next Http request, or
+//! until the buffer needs the room for new replies. This function is the only
+//! place where it is copied.
+//!
+//! @param[out] response Buffer where the data is copied.
+//! @param[in]  length   Size of the buffer.
+//!
+//! @return length Number of characters copied.
+//
+//*****************************************************************************
+uint16_t
+SIM868_http_get_response(char *response, uint16_t length)
+{
+  return slice_copy(gs_http_response, response, length);
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the length of the data of the last Http response.
+//!
+//! @return g_http_data_length Length given by the server.
+//
+//*****************************************************************************
+uint32_t
+SIM868_http_get_response_length(void)
+{
+  return g_http_data_length;
+}
+
+//*****************************************************************************
+//
+//! @brief Reads the data of the last Http response in chunks.
+//!
+//! This function reads the response with AT+HTTPREAD=<start>,<size> one chunk
+//! at a time, and passes each chunk to the sink as soon as it is received, so
+//! responses of any length are read in constant memory. A chunk is passed in
+//! two parts if it wraps around the receive buffer, the parts are not null
+//! terminated. The Http session is terminated once all the data is read.
+//!
+//! @param[in] sink       Function that receives the data.
+//! @param[in] chunk_size Characters requested per chunk, zero for the largest
+//!                       chunk the receive buffer can hold.
+//! @param[in] context    User pointer passed to the sink.
+//!
+//! @return error_status Result of the reading operation, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error occurred. ERROR_HTTP_BUSY while an
+//!                      asynchronous request or a task is running.
+//
+//*****************************************************************************
+uint8_t
+SIM868_http_read_stream(SIM868_http_sink_t sink, uint16_t chunk_size, void *context)
+{
+  uint32_t start;
+  struct Slice data;
+  char http_read[32];
+
   //
-  //  Set user agent.
+  //  The response is not there until the server replied, and the reads would
+  //  be interleaved with the commands of the task.
   //
-  char userAgent[35];
-  sprintf(userAgent, "AT+HTTPPARA=\"UA\",\"%s\"", gs_http_header.user_agent);
-  if (send_check_reply(userAgent, "OK", DEFAULT_TIMEOUT))
+  if (gs_http_request.pending || gs_sim_task.running)
   {
-    return ERROR_REPLY;
+    return ERROR_HTTP_BUSY;
   }
 
-  //
-  //  Set Content-type.
-  //
-  char contentType[CONTENT_BUFFER_LENGTH];
-  sprintf(contentType, "AT+HTTPPARA=\"CONTENT\",\"%s\"", gs_http_header.content_type);
-  if (send_check_reply(contentType, "OK", DEFAULT_TIMEOUT))
+  if (chunk_size == 0 || chunk_size > HTTP_CHUNK_LENGTH)
   {
-    return ERROR_REPLY;
+    chunk_size = HTTP_CHUNK_LENGTH;
   }
 
   //
-  //  Set user data (Authorization).
+  //  A short response was already read by the Http request.
   //
-  char userData[UD_BUFFER_LENGTH];
-  sprintf(userData, "AT+HTTPPARA=\"USERDATA\",\"%s\"", gs_http_header.user_data);
-  if (send_check_reply(userData, "OK", DEFAULT_TIMEOUT))
+  if (!gs_http_request.data_left)
   {
-    return ERROR_REPLY;
+    http_sink_slice(gs_http_response, sink, context);
+    return NO_ERROR;
+  }
+
+  for (start = 0; start < g_http_data_length; start += data.length)
+  {
+    sprintf(http_read, "AT+HTTPREAD=%lu,%u", (unsigned long)start, chunk_size);
+    get_reply(http_read, 5000);
+
+    if (http_read_data(&data) || data.length == 0)
+    {
+      return ERROR_REPLY;
+    }
+
+    http_sink_slice(data, sink, context);
   }
+  gs_http_request.data_left = false;
 
   //
-  //  Set Http URL.
+  //  Terminate Http service, unless the session is kept alive.
   //
-  char URL[URL_BUFFER_LENGTH];
-  sprintf(URL, "AT+HTTPPARA=\"URL\",\"%s%s\"", gs_http_header.root, gs_http_header.web_service);
-  if (send_check_reply(URL, "OK", DEFAULT_TIMEOUT))
+  if (!gs_http_session.keep_alive)
   {
-    return ERROR_REPLY;
+    gs_http_session.active = false;
+    if (send_check_reply("AT+HTTPTERM", "OK", DEFAULT_TIMEOUT))
+    {
+      return ERROR_REPLY;
+    }
   }
 
   return NO_ERROR;
@@ -1784,544 +2836,5962 @@ http_init(void)
 
 //*****************************************************************************
 //
-//! @brief Perform Http action.
+//! @brief Opens the socket connection.
 //!
-//! This function send an specifc Http request method to the server.
+//! This function connects to the server with TCP, or sets the remote end of
+//! UDP. The connection is persistent, it is kept when it is already open with
+//! the same parameters. The GPRS service must be enabled.
 //!
-//! @param[in] method   Http request method (POST/GET).
-//! @param[in] time_out Time for exectuing the reading operation.
+//! @param[in] protocol SIM868_SOCKET_TCP or SIM868_SOCKET_UDP.
+//! @param[in] host     Domain name or IP address of the server.
+//! @param[in] port     Port of the server.
 //!
-//! @return error_status Result of the Http action, if error_status is equal to
+//! @return error_status Result of the connection, if error_status is equal to
 //!                      false, then the operation was successful, if not, an
-//!                      error occurred.
+//!                      error_status occurred.
 //
 //*****************************************************************************
-static uint8_t
-http_action(uint16_t time_out, uint8_t method)
+uint8_t
+SIM868_socket_open(uint8_t protocol, char *host, uint16_t port)
 {
-  uint16_t status;
+  char start[SOCKET_START_LENGTH];
+  uint8_t error_status;
 
-  //
-  //  Only for POST method.
-  //
-  if(method)
+  if (strlen(host) > SOCKET_START_LENGTH - 32)
   {
-    //
-    //  Prepare the POST : JSON structure of 255 characters
-    //  to send and the timing is fixed to 8 seconds.
-    //
-    if (send_check_reply("AT+HTTPDATA=200,8000", "DOWNLOAD", DEFAULT_TIMEOUT))
-    {
-      return ERROR_REPLY;
-    }
+    return ERROR_SOCKET;
+  }
+
+  sprintf(start, "AT+CIPSTART=\"%s\",\"%s\",\"%u\"",
+          (protocol == SIM868_SOCKET_UDP) ? "UDP" : "TCP", host, port);
 
-    if (send_check_reply(gs_http_header.json_structure, "OK", 16000))
+  if (gs_socket.connected)
+  {
+    if (strcmp(start, gs_socket.start) == 0)
     {
-      return ERROR_JSON_STRUCTURE;
+      return NO_ERROR;
     }
 
-    //
-    //  IMPORTANT: The 2 above lines must be completed within 12 seconds
-    //  to avoid error_status message such as "JSON structure empty".
-    //
+    SIM868_socket_close();
   }
 
-  //
-  //  Build the Http action query (method).
-  //
-  char http_method[18];
-  sprintf(http_method, "AT+HTTPACTION=%u", method);
-
-  //
-  //  Send request.
-  //
-  if (send_check_reply(http_method, "OK", time_out))
+  error_status = socket_context();
+  if (error_status)
   {
-    return ERROR_HTTP_REQUEST;
+    return error_status;
   }
 
-  //
-  //  Parse status response.
-  //
-  read_line(time_out, SINGLE_LINE);
-  if(parse_reply("+HTTPACTION: ", &status, ',', 1))
+  strcpy(gs_socket.start, start);
+  get_reply(gs_socket.start, SOCKET_CONNECT_TIMEOUT);
+  if (!reply_find("CONNECT OK"))
   {
-    return ERROR_REPLY;
+    //
+    //  The context is brought up again on the next attempt.
+    //
+    gs_socket.context = false;
+    return ERROR_SOCKET;
+  }
+
+  gs_socket.connected = true;
+  gs_socket.available = false;
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Closes the socket connection.
+//!
+//! @return error_status Result of closing the connection, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_socket_close(void)
+{
+  if (!gs_socket.connected)
+  {
+    return NO_ERROR;
+  }
+
+  gs_socket.connected = false;
+  gs_socket.available = false;
+
+  if (send_check_reply("AT+CIPCLOSE=1", "CLOSE OK", DEFAULT_TIMEOUT))
+  {
+    //
+    //  The state is unknown, start again from the initial state.
+    //
+    gs_socket.context = false;
+    return ERROR_SOCKET;
+  }
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns if the socket connection is open.
+//!
+//! @return true/false The connection is open, it was not closed by the
+//!                    server.
+//
+//*****************************************************************************
+uint8_t
+SIM868_socket_is_open(void)
+{
+  return gs_socket.connected;
+}
+
+//*****************************************************************************
+//
+//! @brief Sends data through the socket connection.
+//!
+//! This function sends binary data of a known length after the data prompt,
+//! in parts of up to SOCKET_SEND_LENGTH bytes. Each part is a datagram with
+//! UDP.
+//!
+//! @param[in] data   Data to be sent.
+//! @param[in] length Number of bytes of the data.
+//!
+//! @return error_status Result of sending the data, if error_status is equal
+//!                      to false, then the server received it (TCP) or it was
+//!                      sent (UDP), if not, an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_socket_send(uint8_t *data, uint16_t length)
+{
+  char cip_send[20];
+  uint16_t part;
+
+  if (!gs_socket.connected)
+  {
+    return ERROR_SOCKET;
+  }
+
+  while (length)
+  {
+    part = (length > SOCKET_SEND_LENGTH) ? SOCKET_SEND_LENGTH : length;
+
+    sprintf(cip_send, "AT+CIPSEND=%u", part);
+    if (send_check_reply(cip_send, "> ", DEFAULT_TIMEOUT))
+    {
+      return ERROR_SOCKET;
+    }
+
+    if (send_check_data(data, part, "SEND OK", SOCKET_SEND_TIMEOUT))
+    {
+      return ERROR_SOCKET;
+    }
+
+    data += part;
+    length -= part;
+  }
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns if the socket has data to be read.
+//!
+//! @return true/false Data was received, it is read with
+//!                    SIM868_socket_receive().
+//
+//*****************************************************************************
+uint8_t
+SIM868_socket_available(void)
+{
+  return gs_socket.available;
+}
+
+//*****************************************************************************
+//
+//! @brief Reads data received by the socket connection.
+//!
+//! This function reads up to SOCKET_CHUNK_LENGTH bytes of the data held by the
+//! SIM868, it should be called again while SIM868_socket_available().
+//!
+//! @param[out] data   Buffer where the data is copied, it is not null
+//!                    terminated.
+//! @param[in]  length Size of the buffer.
+//!
+//! @return length Number of bytes read.
+//
+//*****************************************************************************
+uint16_t
+SIM868_socket_receive(uint8_t *data, uint16_t length)
+{
+  char cip_rxget[24];
+  struct Slice *line;
+  uint16_t received;
+  uint16_t left;
+  uint16_t i;
+
+  if (!gs_socket.available)
+  {
+    return 0;
+  }
+
+  if (length > SOCKET_CHUNK_LENGTH)
+  {
+    length = SOCKET_CHUNK_LENGTH;
+  }
+
+  sprintf(cip_rxget, "AT+CIPRXGET=2,%u", length);
+  get_reply(cip_rxget, DEFAULT_TIMEOUT);
+
+  line = reply_find("+CIPRXGET: 2,");
+  if (!line ||
+      parse_reply("+CIPRXGET: 2,", &received, ',', 0) ||
+      parse_reply("+CIPRXGET: 2,", &left, ',', 1))
+  {
+    return 0;
   }
 
   //
-  //  Print status from last request.
+  //  The raw data is the line that follows, the modem notifies again when
+  //  more data is received.
   //
-  char http_status[18];
-  sprintf(http_status, "Status code: %lu\r\n\r\n", (unsigned long)status);
-  _debug_printf(http_status);
+  gs_socket.available = (left > 0);
+
+  if (received == 0 || (line + 1) >= &gs_at_engine.line[gs_at_engine.line_count])
+  {
+    return 0;
+  }
+
+  line++;
+  for (i = 0; i < received && i < line->length; i++)
+  {
+    data[i] = (uint8_t)slice_char(*line, i);
+  }
+
+  return i;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets the storage of the MQTT packets.
+//!
+//! The MQTT client allocates no memory, the packets are built and received in
+//! a static buffer of MQTT_BUFFER_LENGTH bytes unless the host provides one.
+//! Half of the buffer is the maximum size of a packet.
+//!
+//! @param[in] buffer Storage of the packets, it must remain valid.
+//! @param[in] length Size of the buffer.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_mqtt_set_buffer(uint8_t *buffer, uint16_t length)
+{
+  gs_mqtt_client.buffer = buffer;
+  gs_mqtt_client.length = length;
+  gs_mqtt_client.rx_length = 0;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets the callback of the messages published by the broker.
+//!
+//! @param[in] callback Function called from SIM868_mqtt_poll(), it can be
+//!                     null. It should not publish or subscribe.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_mqtt_set_callback(SIM868_mqtt_callback_t callback, void *context)
+{
+  gs_mqtt_client.callback = callback;
+  gs_mqtt_client.context = context;
+}
+
+//*****************************************************************************
+//
+//! @brief Connects to the MQTT broker.
+//!
+//! This function opens the TCP connection and starts a clean session. The
+//! GPRS service must be enabled.
+//!
+//! @param[in] host       Domain name or IP address of the broker.
+//! @param[in] port       Port of the broker.
+//! @param[in] client_id  Client identifier.
+//! @param[in] user       User name, null for none.
+//! @param[in] pwd        Password, null for none.
+//! @param[in] keep_alive Maximum time in seconds between two packets, zero
+//!                       to disable the PINGREQ.
+//!
+//! @return error_status Result of the connection, if error_status is equal to
+//!                      false, then the broker accepted it, if not, an
+//!                      error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_mqtt_connect(char *host, uint16_t port, char *client_id, char *user, char *pwd, uint16_t keep_alive)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t *packet = client->buffer;
+  uint32_t length;
+  uint16_t i;
+  uint8_t error_status;
+
+  length = 10 + 2 + strlen(client_id);
+  length += user ? (2 + strlen(user)) : 0;
+  length += pwd ? (2 + strlen(pwd)) : 0;
+  if (length + 5 > client->length / 2)
+  {
+    return ERROR_MQTT;
+  }
+
+  client->connected = false;
+  client->rx_length = 0;
+  client->rx_skip = 0;
 
   //
-  //  Check if everything went OK.
+  //  A new session needs a new connection.
   //
-  if(status == OK || status == CREATED)
+  SIM868_socket_close();
+
+  error_status = SIM868_socket_open(SIM868_SOCKET_TCP, host, port);
+  if (error_status)
   {
-    return NO_ERROR;
+    return error_status;
   }
 
   //
-  //  At this point something went wrong,
-  //  hold the status code to check it later.
+  //  Fixed header, protocol name and level, flags and keep alive.
   //
-  g_http_status_code = status;
+  i = 0;
+  packet[i++] = MQTT_CONNECT;
+  i += mqtt_put_length(&packet[i], length);
+  i += mqtt_put_string(&packet[i], "MQTT");
+  packet[i++] = 4;
+  packet[i++] = 0x02 | (user ? 0x80 : 0) | (pwd ? 0x40 : 0);
+  packet[i++] = keep_alive >> 8;
+  packet[i++] = keep_alive & 0xFF;
 
-  return ERROR_HTTP_STATUS_CODE;
+  //
+  //  Payload.
+  //
+  i += mqtt_put_string(&packet[i], client_id);
+  if (user)
+  {
+    i += mqtt_put_string(&packet[i], user);
+  }
+  if (pwd)
+  {
+    i += mqtt_put_string(&packet[i], pwd);
+  }
+
+  client->keep_alive = keep_alive;
+  client->ping_at = 0;
+
+  error_status = mqtt_send(packet, i);
+  if (error_status == NO_ERROR)
+  {
+    error_status = mqtt_wait(MQTT_CONNACK, 0, MQTT_ACK_TIMEOUT);
+  }
+  if (error_status)
+  {
+    SIM868_socket_close();
+    return error_status;
+  }
+
+  client->connected = true;
+
+  return NO_ERROR;
 }
 
 //*****************************************************************************
 //
-//! @brief Read server response.
-//!
-//! This function reads the reponse form the server and copys it into the http
-//! buffer.
+//! @brief Disconnects from the MQTT broker.
 //!
-//! @return error_status Result of the reding operation, if error_status is
+//! @return error_status Result of closing the connection, if error_status is
 //!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//!                      not, an error_status occurred.
 //
 //*****************************************************************************
-static uint8_t
-http_read_all(void)
+uint8_t
+SIM868_mqtt_disconnect(void)
 {
-    get_reply("AT+HTTPREAD", DEFAULT_TIMEOUT);
+  uint8_t packet[2] = { MQTT_DISCONNECT, 0 };
 
-    //
-    //  Check if the server returned an OK.
-    //
-    if(strstr(g_sim_buffer,"+HTTPREAD: ") == 0)
+  if (gs_mqtt_client.connected)
+  {
+    gs_mqtt_client.connected = false;
+    SIM868_socket_send(packet, sizeof(packet));
+  }
+
+  return SIM868_socket_close();
+}
+
+//*****************************************************************************
+//
+//! @brief Returns if the MQTT client is connected.
+//!
+//! @return true/false The broker accepted the connection and it was not lost.
+//
+//*****************************************************************************
+uint8_t
+SIM868_mqtt_is_connected(void)
+{
+  return gs_mqtt_client.connected && SIM868_socket_is_open();
+}
+
+//*****************************************************************************
+//
+//! @brief Publishes a message.
+//!
+//! This function sends a PUBLISH packet, and with QoS 1 it waits for the
+//! PUBACK of the broker.
+//!
+//! @param[in] topic   Topic name.
+//! @param[in] payload Application message.
+//! @param[in] length  Number of bytes of the message.
+//! @param[in] qos     Quality of service, 0 or 1.
+//!
+//! @return error_status Result of the publication, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_mqtt_publish(char *topic, uint8_t *payload, uint16_t length, uint8_t qos)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t *packet = client->buffer;
+  uint32_t remaining;
+  uint16_t i;
+  uint8_t error_status;
+
+  if (!SIM868_mqtt_is_connected())
+  {
+    return ERROR_MQTT;
+  }
+
+  qos = qos ? 1 : 0;
+  remaining = 2 + strlen(topic) + (qos ? 2 : 0) + length;
+  if (remaining + 5 > client->length / 2)
+  {
+    return ERROR_MQTT;
+  }
+
+  i = 0;
+  packet[i++] = MQTT_PUBLISH | (qos << 1);
+  i += mqtt_put_length(&packet[i], remaining);
+  i += mqtt_put_string(&packet[i], topic);
+  if (qos)
+  {
+    if (++client->packet_id == 0)
     {
-      return ERROR_REPLY;
+      client->packet_id = 1;
     }
+    packet[i++] = client->packet_id >> 8;
+    packet[i++] = client->packet_id & 0xFF;
+  }
+  memcpy(&packet[i], payload, length);
+  i += length;
 
-    //
-    //  Copy response from sim buffer to http buffer.
-    //
-    read_line(5000, SINGLE_LINE);
-    strcpy(g_http_buffer, g_sim_buffer);
+  error_status = mqtt_send(packet, i);
+  if (error_status == NO_ERROR && qos)
+  {
+    error_status = mqtt_wait(MQTT_PUBACK, client->packet_id, MQTT_ACK_TIMEOUT);
+  }
 
-    return NO_ERROR;
+  return error_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Subscribes to a topic.
+//!
+//! This function sends a SUBSCRIBE packet and waits for the SUBACK of the
+//! broker. The messages are passed to the callback set with
+//! SIM868_mqtt_set_callback().
+//!
+//! @param[in] topic Topic filter.
+//! @param[in] qos   Maximum quality of service, 0 or 1.
+//!
+//! @return error_status Result of the subscription, if error_status is equal
+//!                      to false, then the broker granted it, if not, an
+//!                      error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_mqtt_subscribe(char *topic, uint8_t qos)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t *packet = client->buffer;
+  uint32_t remaining;
+  uint16_t i;
+  uint8_t error_status;
+
+  if (!SIM868_mqtt_is_connected())
+  {
+    return ERROR_MQTT;
+  }
+
+  remaining = 2 + 2 + strlen(topic) + 1;
+  if (remaining + 5 > client->length / 2)
+  {
+    return ERROR_MQTT;
+  }
+
+  if (++client->packet_id == 0)
+  {
+    client->packet_id = 1;
+  }
+
+  i = 0;
+  packet[i++] = MQTT_SUBSCRIBE;
+  i += mqtt_put_length(&packet[i], remaining);
+  packet[i++] = client->packet_id >> 8;
+  packet[i++] = client->packet_id & 0xFF;
+  i += mqtt_put_string(&packet[i], topic);
+  packet[i++] = qos ? 1 : 0;
+
+  error_status = mqtt_send(packet, i);
+  if (error_status == NO_ERROR)
+  {
+    error_status = mqtt_wait(MQTT_SUBACK, client->packet_id, MQTT_ACK_TIMEOUT);
+  }
+
+  return error_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Runs the MQTT client.
+//!
+//! This function reads the packets received, passes the messages published
+//! by the broker to the callback and keeps the connection alive. It should be
+//! called from the main loop, along with SIM868_poll().
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_mqtt_poll(void)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t packet[2] = { MQTT_PINGREQ, 0 };
+  uint32_t keep_alive = (uint32_t)client->keep_alive * 1000;
+
+  SIM868_poll();
+
+  if (!client->connected)
+  {
+    return;
+  }
+
+  if (!SIM868_socket_is_open())
+  {
+    mqtt_lost();
+    return;
+  }
+
+  mqtt_receive();
+
+  if (keep_alive == 0)
+  {
+    return;
+  }
+
+  //
+  //  The connection is lost when the broker does not answer the PINGREQ
+  //  within the keep alive time.
+  //
+  if (client->ping_at)
+  {
+    if ((uint32_t)(_sys_tick_ms() - client->ping_at) >= keep_alive)
+    {
+      mqtt_lost();
+    }
+  }
+  else if ((uint32_t)(_sys_tick_ms() - client->sent_at) >= keep_alive)
+  {
+    if (mqtt_send(packet, sizeof(packet)) == NO_ERROR)
+    {
+      client->ping_at = client->sent_at ? client->sent_at : 1;
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Sets the GNSS module power state (ON/OFF).
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_gnss_set_power_level(uint8_t state)
+{
+    _gnss_enable(state);
+}
+
+//*****************************************************************************
+//
+//! @brief Stores a character received from the GNSS serial port.
+//!
+//! This function should be called from the receive interrupt of the GNSS
+//! serial port. The character is only stored, it is parsed later by
+//! SIM868_gnss_poll() or SIM868_poll(), so the fix is never updated from the
+//! interrupt.
+//!
+//! @param[in] incoming_char Character received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_gnss_rx_handler(char incoming_char)
+{
+  uint16_t head = gs_gnss_ring.head;
+  uint16_t next = (head + 1) % gs_gnss_ring.size;
+
+  //
+  //  Drop the character if the ring is full, the parser skips the sentence
+  //  by its checksum.
+  //
+  if (next == gs_gnss_ring.tail)
+  {
+    #if SIM868_STATS
+        gs_at_stats.snapshot.gnss_overruns++;
+    #endif
+    return;
+  }
+
+  gs_gnss_ring.data[head] = incoming_char;
+  gs_gnss_ring.head = next;
+}
+
+//*****************************************************************************
+//
+//! @brief Stores a block of characters received from the GNSS serial port.
+//!
+//! This function is the same as SIM868_gnss_rx_handler() for a DMA transfer
+//! or an idle line interrupt of the GNSS serial port.
+//!
+//! @param[in] data   Characters received.
+//! @param[in] length Number of characters.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_gnss_rx_block(const char *data, uint16_t length)
+{
+  uint16_t i;
+
+  for (i = 0; i < length; i++)
+  {
+    SIM868_gnss_rx_handler(data[i]);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Parses a slice of the GNSS output.
+//!
+//! This function feeds the characters passed to the NMEA parser, a sentence
+//! may be split across any number of slices.
+//!
+//! @param[in] data   Characters received from the GNSS, not null terminated.
+//! @param[in] length Number of characters.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_gnss_parse(char *data, uint16_t length)
+{
+  uint16_t i;
+
+  for (i = 0; i < length; i++)
+  {
+    nmea_process_char(data[i]);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Parses the characters received from the GNSS serial port.
+//!
+//! This function never blocks, the fix is updated each time a sentence with
+//! a valid checksum is completed. It is also called by SIM868_poll(), so the
+//! blocking functions of the SIM868 keep parsing the GNSS output.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_gnss_poll(void)
+{
+  while (gs_gnss_ring.scan != gs_gnss_ring.head)
+  {
+    nmea_process_char(gs_gnss_ring.data[gs_gnss_ring.scan]);
+    gs_gnss_ring.scan = (gs_gnss_ring.scan + 1) % gs_gnss_ring.size;
+  }
+
+  gs_gnss_ring.tail = gs_gnss_ring.scan;
+
+  //
+  //  Parse any character held by the UART driver as it is read, this is only
+  //  required when SIM868_gnss_rx_handler() is not used in the ISR. Going
+  //  through the ring would drop the output of a second larger than it.
+  //
+  while (_gnss_data_available())
+  {
+    nmea_process_char(_gnss_read_buffer());
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the fix data status.
+//!
+//! This function parses the GNSS output received and returns whether the last
+//! RMC sentence reported a valid position.
+//!
+//! @return true/false Fix data status.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_fix_status(void)
+{
+  SIM868_gnss_poll();
+
+  return gs_gnss_fix.valid;
+}
+
+//*****************************************************************************
+//
+//! @brief Get the data from the GNSS output.
+//!
+//! This function reads the last fix parsed from the GNSS output. The latitud,
+//! longitude and speed will be assigened to the address of the variables
+//! passed. The data and time can be access through getter fucntions.
+//!
+//! This is a floating point wrapper of SIM868_gnss_get_position().
+//!
+//! @return true/false The fix is valid.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_data(float *lat, float *lon, uint8_t *speed_kph)
+{
+  int32_t lat_micro;
+  int32_t lon_micro;
+  uint16_t speed_cms;
+
+  if (!SIM868_gnss_get_position(&lat_micro, &lon_micro, &speed_cms))
+  {
+    return false;
+  }
+
+  *lat = lat_micro / 1000000.0f;
+  *lon = lon_micro / 1000000.0f;
+
+  //
+  //  Convert to kph.
+  //
+  *speed_kph = ((uint32_t)speed_cms * 36) / 1000;
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Get the position from the GNSS output in fixed point.
+//!
+//! This function reads the last fix parsed from the GNSS output without any
+//! floating point math. The data and time can be access through getter
+//! fucntions.
+//!
+//! @param[out] lat       Latitude in microdegrees.
+//! @param[out] lon       Longitude in microdegrees.
+//! @param[out] speed_cms Speed over ground in cm/s.
+//!
+//! @return true/false The fix is valid.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_position(int32_t *lat, int32_t *lon, uint16_t *speed_cms)
+{
+  SIM868_gnss_poll();
+
+  if (!gs_gnss_fix.valid)
+  {
+    return false;
+  }
+
+  *lat = gs_gnss_fix.lat;
+  *lon = gs_gnss_fix.lon;
+  *speed_cms = gs_gnss_fix.speed_cms;
+
+  //
+  //  Date and time of the fix in the time zone of SIM868_time_set_zone(),
+  //  they are kept until the date is reported.
+  //
+  if (time_has_date(&gs_gnss_fix.time))
+  {
+    time_date(&gs_gnss_data_time, time_local(time_seconds(&gs_gnss_fix.time)));
+  }
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the seconds of the current time.
+//!
+//! @return seconds.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_seconds(void)
+{
+    return gs_gnss_data_time.seconds;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the minutes of the current time.
+//!
+//! @return minutes.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_minutes(void)
+{
+    return gs_gnss_data_time.minutes;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the hour of the current time.
+//!
+//! @return hour.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_hour(void)
+{
+    return gs_gnss_data_time.hour;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the day of the current date.
+//!
+//! @return day.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_day(void)
+{
+    return gs_gnss_data_time.day;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the month of the current date.
+//!
+//! @return month.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_month(void)
+{
+    return gs_gnss_data_time.month;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the year of the current date.
+//!
+//! @return year.
+//
+//*****************************************************************************
+uint16_t
+SIM868_gnss_get_year(void)
+{
+    return (2000 + gs_gnss_data_time.year);
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the horizontal dilution of precision of the last fix.
+//!
+//! @return hdop.
+//
+//*****************************************************************************
+float
+SIM868_gnss_get_hdop(void)
+{
+    return gs_gnss_fix.hdop / 100.0f;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the horizontal dilution of precision of the last fix in
+//! hundredths.
+//!
+//! @return hdop x 100.
+//
+//*****************************************************************************
+uint16_t
+SIM868_gnss_get_hdop_x100(void)
+{
+    return gs_gnss_fix.hdop;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of satellites used in the last fix.
+//!
+//! @return satellites.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_satellites(void)
+{
+    return gs_gnss_fix.satellites;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of satellites in view of all the constellations.
+//!
+//! @return satellites in view.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_satellites_in_view(void)
+{
+    return gs_gnss_fix.satellites_in_view;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the mode of the last fix (1 no fix, 2 2D, 3 3D).
+//!
+//! @return mode.
+//
+//*****************************************************************************
+uint8_t
+SIM868_gnss_get_fix_mode(void)
+{
+    return gs_gnss_fix.mode;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the altitude above mean sea level of the last fix.
+//!
+//! @return altitude in meters.
+//
+//*****************************************************************************
+float
+SIM868_gnss_get_altitude(void)
+{
+    return gs_gnss_fix.altitude / 100.0f;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the course over ground of the last fix.
+//!
+//! @return course in degrees.
+//
+//*****************************************************************************
+float
+SIM868_gnss_get_course(void)
+{
+    return gs_gnss_fix.course / 100.0f;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets the time zone of the local time.
+//!
+//! This function sets the offset from UTC of the local time returned by
+//! SIM868_time_get_local() and SIM868_time_read(), and of the date and time
+//! of the fixes. It is SIM868_TIME_ZONE until it is set.
+//!
+//! @param[in] minutes Offset from UTC in minutes, e.g. -360 for UTC-6.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_time_set_zone(int16_t minutes)
+{
+  gs_time_sync.zone = minutes;
+}
+
+//*****************************************************************************
+//
+//! @brief Stores a pulse of the PPS line.
+//!
+//! This function should be called from the interrupt of the rising edge of
+//! the PPS line of the GNSS. Once it is called, the RTC is synced to the
+//! pulse that starts the second reported by the next RMC or ZDA sentence,
+//! instead of to the end of the sentence.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_time_pps_isr(void)
+{
+  gs_time_sync.pps_at = _sys_tick_ms();
+  gs_time_sync.pps = true;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the UTC time of the RTC.
+//!
+//! This function reads the RTC synced by the GNSS output parsed, it does not
+//! read the GNSS. Between the sentences the time is kept with the tick.
+//!
+//! @param[out] seconds Seconds since 2000-01-01 00:00:00 UTC.
+//! @param[out] ms      Milliseconds of the second, it can be null.
+//!
+//! @return true/false The RTC was synced.
+//
+//*****************************************************************************
+uint8_t
+SIM868_time_get_utc(uint32_t *seconds, uint16_t *ms)
+{
+  uint32_t elapsed;
+
+  if (!gs_time_sync.valid)
+  {
+    return false;
+  }
+
+  elapsed = (uint32_t)(_sys_tick_ms() - gs_time_sync.synced_at) + gs_time_sync.ms;
+
+  *seconds = gs_time_sync.seconds + (elapsed / 1000);
+  if (ms)
+  {
+    *ms = elapsed % 1000;
+  }
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the local time of the RTC.
+//!
+//! This function is the same as SIM868_time_get_utc() in the time zone of
+//! SIM868_time_set_zone().
+//!
+//! @param[out] seconds Local seconds since 2000-01-01 00:00:00.
+//! @param[out] ms      Milliseconds of the second, it can be null.
+//!
+//! @return true/false The RTC was synced.
+//
+//*****************************************************************************
+uint8_t
+SIM868_time_get_local(uint32_t *seconds, uint16_t *ms)
+{
+  if (!SIM868_time_get_utc(seconds, ms))
+  {
+    return false;
+  }
+
+  *seconds = time_local(*seconds);
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Reads the local date and time of the RTC.
+//!
+//! This function updates the date and time returned by the getters, such as
+//! SIM868_gnss_get_hour(), from the RTC instead of from the last fix.
+//!
+//! @return true/false The RTC was synced.
+//
+//*****************************************************************************
+uint8_t
+SIM868_time_read(void)
+{
+  uint32_t seconds;
+
+  if (!SIM868_time_get_local(&seconds, NULL))
+  {
+    return false;
+  }
+
+  time_date(&gs_gnss_data_time, seconds);
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Sets when the report batch is due.
+//!
+//! @param[in] count   Number of fixes that makes the batch due, up to
+//!                    BATCH_LENGTH.
+//! @param[in] max_age Age in seconds of the oldest fix that makes the batch
+//!                    due, zero to only use the count.
+//!
+//! @return None.
+//
+//*****************************************************************************
+void
+SIM868_batch_set_threshold(uint8_t count, uint16_t max_age)
+{
+  if (count == 0 || count > BATCH_LENGTH)
+  {
+    count = BATCH_LENGTH;
+  }
+
+  gs_report_batch.max_count = count;
+  gs_report_batch.max_age = max_age;
+}
+
+//*****************************************************************************
+//
+//! @brief Adds a fix to the report batch.
+//!
+//! This function queues the position passed with the UTC time of the time
+//! service, or of the last fix until the time service is synced. A fix queued
+//! before the GNSS reported a date is uploaded without a time. When the
+//! batch is full the oldest fix is moved to the report store, or it is
+//! dropped if there is no store.
+//!
+//! @param[in] lat       Latitude in degrees.
+//! @param[in] lon       Longitude in degrees.
+//! @param[in] speed_kph Speed in kph.
+//!
+//! @return true/false The batch is due and should be sent.
+//
+//*****************************************************************************
+uint8_t
+SIM868_batch_add_fix(float lat, float lon, uint8_t speed_kph)
+{
+  return SIM868_batch_add_position((int32_t)(lat * 1000000.0f),
+                                   (int32_t)(lon * 1000000.0f), speed_kph);
+}
+
+//*****************************************************************************
+//
+//! @brief Adds a fix in fixed point to the report batch.
+//!
+//! This function is the same as SIM868_batch_add_fix() for the position
+//! returned by SIM868_gnss_get_position().
+//!
+//! @param[in] lat       Latitude in microdegrees.
+//! @param[in] lon       Longitude in microdegrees.
+//! @param[in] speed_kph Speed in kph.
+//!
+//! @return true/false The batch is due and should be sent.
+//
+//*****************************************************************************
+uint8_t
+SIM868_batch_add_position(int32_t lat, int32_t lon, uint8_t speed_kph)
+{
+  struct GNSS_Fix_Record *record;
+
+  if (gs_report_batch.count == BATCH_LENGTH)
+  {
+    #if SIM868_STORE_SECTORS > 0
+        store_write(STORE_FIX, &gs_report_batch.record[gs_report_batch.head]);
+    #endif
+    gs_report_batch.head = (gs_report_batch.head + 1) % BATCH_LENGTH;
+    gs_report_batch.count--;
+  }
+
+  if (gs_report_batch.count == 0)
+  {
+    gs_report_batch.first_at = _sys_tick_ms();
+  }
+
+  record = &gs_report_batch.record[(gs_report_batch.head + gs_report_batch.count) % BATCH_LENGTH];
+  record->lat = lat;
+  record->lon = lon;
+  record->speed_kph = speed_kph;
+  if (!SIM868_time_get_utc(&record->seconds, &record->ms))
+  {
+    record->seconds = time_has_date(&gs_gnss_fix.time) ? time_seconds(&gs_gnss_fix.time) : 0;
+    record->ms = gs_gnss_fix.time_ms;
+  }
+  gs_report_batch.count++;
+
+  return SIM868_batch_is_due();
+}
+
+//*****************************************************************************
+//
+//! @brief Returns if the report batch is due.
+//!
+//! @return true/false The count or the age threshold was reached.
+//
+//*****************************************************************************
+uint8_t
+SIM868_batch_is_due(void)
+{
+  if (gs_report_batch.count == 0)
+  {
+    return false;
+  }
+
+  if (gs_report_batch.count >= gs_report_batch.max_count)
+  {
+    return true;
+  }
+
+  return (gs_report_batch.max_age &&
+          (uint32_t)(_sys_tick_ms() - gs_report_batch.first_at) >= ((uint32_t)gs_report_batch.max_age * 1000));
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of fixes in the report batch.
+//!
+//! @return count Number of fixes.
+//
+//*****************************************************************************
+uint8_t
+SIM868_batch_get_count(void)
+{
+  return gs_report_batch.count;
+}
+
+//*****************************************************************************
+//
+//! @brief Encodes the report batch in binary.
+//!
+//! This function packs the queued fixes, from the oldest to the newest, into
+//! a compact record to be sent instead of the JSON array, for instance with
+//! SIM868_mqtt_publish(). The batch is kept, it is cleared by
+//! SIM868_batch_send() only. The record is:
+//!
+//!   version (1 byte), count (1 byte), then for each fix
+//!   latitude, longitude (zigzag varints, microdegrees),
+//!   time (zigzag varint, UTC seconds since 2000-01-01 00:00:00),
+//!   milliseconds (varint, absolute), speed (1 byte, kph).
+//!
+//! The first fix is absolute and each following one is the difference with
+//! the previous fix. A fix without a date has 1000 milliseconds and a time
+//! difference of zero, the next time is the difference with the last dated
+//! fix. A varint is little endian in groups of 7 bits, with the
+//! high bit set on all the bytes but the last.
+//!
+//! @param[out] buffer Buffer where the record is written.
+//! @param[in]  length Size of the buffer.
+//!
+//! @return length Number of bytes written, zero if the buffer is too small.
+//
+//*****************************************************************************
+uint16_t
+SIM868_batch_encode(uint8_t *buffer, uint16_t length)
+{
+  struct GNSS_Fix_Record *record;
+  struct GNSS_Fix_Record previous = { 0 };
+  uint16_t i = 0;
+  uint8_t j;
+
+  if (length < 2 + ((uint32_t)gs_report_batch.count * BATCH_ENCODED_FIX_LENGTH))
+  {
+    return 0;
+  }
+
+  buffer[i++] = BATCH_ENCODING_VERSION;
+  buffer[i++] = gs_report_batch.count;
+
+  for (j = 0; j < gs_report_batch.count; j++)
+  {
+    record = &gs_report_batch.record[(gs_report_batch.head + j) % BATCH_LENGTH];
+
+    i += encode_varint(&buffer[i], encode_zigzag(record->lat - previous.lat));
+    i += encode_varint(&buffer[i], encode_zigzag(record->lon - previous.lon));
+    if (record->seconds)
+    {
+      i += encode_varint(&buffer[i], encode_zigzag((int32_t)(record->seconds - previous.seconds)));
+      i += encode_varint(&buffer[i], record->ms);
+      previous.seconds = record->seconds;
+    }
+    else
+    {
+      i += encode_varint(&buffer[i], 0);
+      i += encode_varint(&buffer[i], BATCH_UNDATED_MS);
+    }
+    buffer[i++] = record->speed_kph;
+
+    previous.lat = record->lat;
+    previous.lon = record->lon;
+  }
+
+  return i;
+}
+
+//*****************************************************************************
+//
+//! @brief Sends the report batch.
+//!
+//! This function sends all the queued fixes as a single JSON array with an
+//! Http POST request, the array is sent instead of the json structure of the
+//! Http header, which is kept for the next requests. The fixes kept in the report store are forwarded first. If the
+//! request fails, the fixes are moved to the report store, or they are kept
+//! in the batch if there is no store.
+//!
+//! @param[in] max_attempts Number of attempts to perfrom the full request.
+//!
+//! @return error_status Result of the Http request, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_batch_send(uint8_t max_attempts)
+{
+  uint8_t error_status;
+
+  if (gs_report_batch.count == 0)
+  {
+    return NO_ERROR;
+  }
+
+  //
+  //  Keep the order of the fixes, the stored ones are older.
+  //
+  error_status = SIM868_store_forward(0, max_attempts);
+  if (error_status == NO_ERROR)
+  {
+    batch_serialize(gs_report_batch.record, gs_report_batch.head, gs_report_batch.count);
+    error_status = batch_post(max_attempts);
+  }
+
+  if (error_status == NO_ERROR)
+  {
+    gs_report_batch.count = 0;
+  }
+  else
+  {
+    batch_spill();
+  }
+
+  return error_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of fixes in the report store.
+//!
+//! @return count Fixes waiting to be forwarded.
+//
+//*****************************************************************************
+uint16_t
+SIM868_store_get_count(void)
+{
+  #if SIM868_STORE_SECTORS > 0
+      store_mount();
+      return gs_report_store.count;
+  #else
+      return 0;
+  #endif
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of fixes lost by the report store.
+//!
+//! @return dropped Fixes erased before they were forwarded, since the start.
+//
+//*****************************************************************************
+uint16_t
+SIM868_store_get_dropped(void)
+{
+  #if SIM868_STORE_SECTORS > 0
+      return gs_report_store.dropped;
+  #else
+      return 0;
+  #endif
+}
+
+//*****************************************************************************
+//
+//! @brief Forwards the fixes of the report store.
+//!
+//! This function sends the stored fixes from the oldest one, up to
+//! BATCH_LENGTH fixes in each Http POST request. The fixes are marked as
+//! forwarded only once the server accepted them, so they are sent again
+//! after a failure or a reset.
+//!
+//! @param[in] max_batches  Maximum number of requests, zero to forward all
+//!                         the fixes.
+//! @param[in] max_attempts Number of attempts to perfrom each request.
+//!
+//! @return error_status Result of the Http requests, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
+//
+//*****************************************************************************
+uint8_t
+SIM868_store_forward(uint8_t max_batches, uint8_t max_attempts)
+{
+  #if SIM868_STORE_SECTORS > 0
+      struct GNSS_Fix_Record record[BATCH_LENGTH];
+      uint8_t error_status;
+      uint8_t batches = 0;
+      uint8_t count;
+      uint32_t last;
+
+      store_mount();
+
+      while (gs_report_store.count && (max_batches == 0 || batches++ < max_batches))
+      {
+        count = store_load(record, &last);
+        if (count == 0)
+        {
+          //
+          //  The fixes left were lost, there is nothing to send.
+          //
+          gs_report_store.count = 0;
+          break;
+        }
+
+        batch_serialize(record, 0, count);
+        error_status = batch_post(max_attempts);
+        if (error_status)
+        {
+          return error_status;
+        }
+
+        gs_report_store.sent = last;
+        gs_report_store.count = (gs_report_store.count > count) ? (gs_report_store.count - count) : 0;
+        if (store_write(STORE_SENT, NULL))
+        {
+          return ERROR_STORE;
+        }
+      }
+  #else
+      (void)max_batches;
+      (void)max_attempts;
+  #endif
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Checks if the SIM868 is ready for the next command.
+//!
+//! This function wakes up the SIM868 if it is sleeping, and tells when the
+//! wake up delay is over.
+//!
+//! @return true/false The command can be sent.
+//
+//*****************************************************************************
+static uint8_t
+sleep_is_ready(void)
+{
+  SIM868_wake();
+
+  if (gs_sleep_mode.state == SLEEP_WAKING)
+  {
+    if ((uint32_t)(_sys_tick_ms() - gs_sleep_mode.woken_at) < SLEEP_WAKE_DELAY)
+    {
+      return false;
+    }
+    gs_sleep_mode.state = SLEEP_AWAKE;
+  }
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Records an event in the trace buffer.
+//!
+//! @param[in] event        SIM868_TRACE_SENT, SIM868_TRACE_DONE or
+//!                         SIM868_TRACE_URC.
+//! @param[in] at           AT command or unsolicited result code, only its
+//!                         beginning is kept.
+//! @param[in] error_status Result of the command.
+//! @param[in] elapsed      Round trip time of the command in ms.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+trace_record(uint8_t event, char *at, uint8_t error_status, uint16_t elapsed)
+{
+  #if SIM868_TRACE_LENGTH > 0
+      struct SIM868_Trace_Entry *entry;
+      uint8_t i;
+
+      //
+      //  The retention RAM holds anything after a power up.
+      //
+      if (gs_trace_buffer.key != TRACE_KEY || gs_trace_buffer.count > SIM868_TRACE_LENGTH ||
+          gs_trace_buffer.head >= SIM868_TRACE_LENGTH)
+      {
+        SIM868_trace_clear();
+      }
+
+      if (gs_trace_buffer.count == SIM868_TRACE_LENGTH)
+      {
+        gs_trace_buffer.head = (gs_trace_buffer.head + 1) % SIM868_TRACE_LENGTH;
+        gs_trace_buffer.count--;
+      }
+
+      entry = &gs_trace_buffer.entry[(gs_trace_buffer.head + gs_trace_buffer.count) % SIM868_TRACE_LENGTH];
+      gs_trace_buffer.count++;
+
+      //
+      //  Skip the "AT" common to all the commands.
+      //
+      if (!strncmp(at, "AT", 2))
+      {
+        at += 2;
+      }
+      for (i = 0; i < sizeof(entry->at) - 1 && at[i]; i++)
+      {
+        entry->at[i] = at[i];
+      }
+      entry->at[i] = 0;
+
+      entry->tick = _sys_tick_ms();
+      entry->event = event;
+      entry->error_status = error_status;
+      entry->elapsed = elapsed;
+  #else
+      (void)event;
+      (void)at;
+      (void)error_status;
+      (void)elapsed;
+  #endif
+}
+
+//*****************************************************************************
+//
+//! @brief Records a completed AT command in the counters of its class.
+//!
+//! @param[in] at           AT command.
+//! @param[in] error_status Result of the command.
+//! @param[in] elapsed      Round trip time of the command in ms.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+stats_record(char *at, uint8_t error_status, uint16_t elapsed)
+{
+  #if SIM868_STATS
+      struct SIM868_Command_Stats *command;
+      uint8_t class = SIM868_STATS_OTHER;
+      uint8_t i;
+
+      for (i = 0; i < sizeof(g_at_stats_classes) / sizeof(g_at_stats_classes[0]); i++)
+      {
+        if (strncmp(at, g_at_stats_classes[i].at, strlen(g_at_stats_classes[i].at)) == 0)
+        {
+          class = g_at_stats_classes[i].class;
+          break;
+        }
+      }
+
+      command = &gs_at_stats.snapshot.command[class];
+      command->count++;
+
+      //
+      //  The time of a command without reply is its time out, it is not
+      //  part of the round trip time.
+      //
+      if (error_status == ERROR_TIMEOUT)
+      {
+        command->timeouts++;
+        return;
+      }
+      if (error_status)
+      {
+        command->errors++;
+      }
+
+      if (gs_at_stats.replied[class] == 0 || elapsed < command->min)
+      {
+        command->min = elapsed;
+      }
+      if (elapsed > command->max)
+      {
+        command->max = elapsed;
+      }
+      gs_at_stats.total[class] += elapsed;
+      gs_at_stats.replied[class]++;
+  #else
+      (void)at;
+      (void)error_status;
+      (void)elapsed;
+  #endif
+}
+
+//*****************************************************************************
+//
+//! @brief Powers up the SIM868.
+//!
+//! This function change the current state of the SIM868 to power it up.
+//!
+//! @return error_status Result of powering up, if error_status is equal to
+//!                      false, then the operation was successful, if not, an
+//!                      error occurred.
+//
+//*****************************************************************************
+static uint8_t
+sim_power_up(void)
+{
+  uint8_t error_status;
+  uint16_t time_out = 1000;
+
+  //
+  //  Change the state from off to on
+  //
+  sim_change_state();
+
+  //
+  //  Wait for 1 sec to see if the module goes on
+  //
+  while(time_out--)
+  {
+    //
+    //  Read the current state of the SIM868 to see if it changed
+    //
+    if(_sim_state())
+    {
+      error_status = NO_ERROR;
+      break;
+    }
+    else
+    {
+      error_status = ERROR_POWER_STATE;
+    }
+
+    _debug_delay(1);
+  }
+
+  return error_status;
+}
+
+//*****************************************************************************
+//
+//  Private Functions.
+//
+//*****************************************************************************
+//*****************************************************************************
+//
+//! @brief Powers down the SIM868.
+//!
+//! This function change the current state of the SIM868 to power it down.
+//!
+//! @return error_status Result of powering down, if error_status is equal to
+//!                      false, then the operation was successful, if not, an
+//!                      error occurred.
+//
+//*****************************************************************************
+static uint8_t
+sim_power_dowm(void)
+{
+  uint8_t error_status;
+  uint16_t time_out = 1000;
+
+  //
+  //  Change the state from off to on
+  //
+  sim_change_state();
+
+  //
+  //  Wait for 1 sec to see if the module goes off
+  //
+  while(time_out--)
+  {
+    //
+    //  Read the current state of the SIM868 to see if it changed
+    //
+    if(!_sim_state())
+    {
+      error_status = NO_ERROR;
+      break;
+    }
+    else
+    {
+      error_status = ERROR_POWER_STATE;
+    }
+
+    _debug_delay(1);
+  }
+
+  return error_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Changes the SIM868 current state.
+//!
+//! This function switches the SIM868 state either from on to off or off to on.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+sim_change_state(void)
+{
+    //
+    //  Change the SIM868 current state
+    //
+    _sim_pwm(ON);
+    _debug_delay(2000);
+    _sim_pwm(OFF);
+    _debug_delay(100);
+
+    //
+    //  The SIM868 has to be set up again after a power cycle,
+    //  and the slow clock is disabled.
+    //
+    gs_warm_start.key = 0;
+    gs_warm_start.sim_card_ready = false;
+
+    _sim_dtr(OFF);
+    gs_sleep_mode.enabled = false;
+    gs_sleep_mode.state = SLEEP_AWAKE;
+
+    //
+    //  Nothing is known about the connection after a power cycle.
+    //
+    gs_gprs_connection.known = false;
+    gs_bearer_config.dirty = true;
+    gs_http_session.active = false;
+    gs_socket.context = false;
+    gs_socket.connected = false;
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of the SIM Card initialization.
+//!
+//! This function enables the SIM Card detecting mode, checks if the SIM Card
+//! is inserted and if it requires any password. On a warm start only the pin
+//! state is confirmed.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_sim_card_init(uint8_t depth)
+{
+  struct Slice *p;
+
+  TASK_BEGIN(depth);
+
+  //
+  //  On a warm start the detection mode and the SIM Card were already
+  //  checked, only the pin state is confirmed.
+  //
+  if (!(gs_warm_start.key == WARM_START_KEY && gs_warm_start.sim_card_ready))
+  {
+    //
+    //  First check the SIM Card detecting mode, this mode will
+    //  allow the SIM868 to detect if the SIM Card is inserted.
+    //
+    TASK_SEND(depth, "AT+CSDT?", DEFAULT_TIMEOUT);
+    if (parse_reply("+CSDT: ", &gs_sim_task.value, ',', 0))
+    {
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+
+    //
+    //  If the detecting mode is not set, then set it.
+    //
+    if (gs_sim_task.value != 1)
+    {
+      TASK_SEND(depth, "AT+CSDT=1", DEFAULT_TIMEOUT);
+      if (reply_check("OK"))
+      {
+        TASK_EXIT(depth, ERROR_REPLY);
+      }
+    }
+
+    //
+    //  Check if the SIM Card is inserted.
+    //
+    TASK_SEND(depth, "AT+CSMINS?", DEFAULT_TIMEOUT);
+    if (parse_reply("+CSMINS: ", &gs_sim_task.value, ',', 1))
+    {
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+
+    if (gs_sim_task.value != 1)
+    {
+      TASK_EXIT(depth, ERROR_SIMCARD_STATUS);
+    }
+  }
+
+  //
+  //  Request the pin state of the SIM Card.
+  //
+  TASK_SEND(depth, "AT+CPIN?", 5000);
+
+  p = reply_find("+CPIN: ");
+  if (p == 0)
+  {
+    TASK_EXIT(depth, ERROR_REPLY);
+  }
+
+  //
+  //  Check if the SIM Card require any password.
+  //
+  if (!slice_equals(slice_skip(*p, strlen("+CPIN: ")), "READY"))
+  {
+    TASK_EXIT(depth, ERROR_SIMCARD_PIN);
+  }
+
+  gs_warm_start.sim_card_ready = true;
+
+  _debug_printf("SIM Card ready!\r\n\r\n");
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Get the status of the network.
+//!
+//! This function parses the status of the bearer connection, from the reply
+//! of the last AT+SAPBR=2,1 command.
+//!
+//! @return bearer_status Status of the network.
+//
+//*****************************************************************************
+static uint16_t
+gprs_query(void)
+{
+  uint16_t bearer_status;
+
+  if (parse_reply("+SAPBR: ", &bearer_status, ',', 1)) return ERROR_REPLY;
+
+  return bearer_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of the GPRS service.
+//!
+//! This function attaches the SIM868 to the GPRS service and opens the bearer
+//! for the ON state, or closes and detaches them for the OFF state. The state
+//! is a parameter of the task.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_gprs_enable(uint8_t depth)
+{
+  struct Gprs_Connection *connection = &gs_gprs_connection;
+
+  TASK_BEGIN(depth);
+
+  //
+  //  Nothing to do if the cached state is the requested one.
+  //
+  if (connection->known &&
+      ((gs_sim_task.state && connection->attached && connection->bearer == CONNECTED) ||
+       (!gs_sim_task.state && !connection->attached && connection->bearer == CLOSED)))
+  {
+    TASK_EXIT(depth, NO_ERROR);
+  }
+
+  if (!connection->known)
+  {
+    //
+    //  Get notified when the GPRS registration changes.
+    //
+    TASK_SEND(depth, "AT+CGREG=1", DEFAULT_TIMEOUT);
+
+    //
+    //  Verify that the GPRS modem is attached to the network.
+    //
+    TASK_SEND(depth, "AT+CGATT?", 20000);
+    if (parse_reply("+CGATT: ", &gs_sim_task.value, ',', 0))
+    {
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+    connection->attached = (gs_sim_task.value != 0);
+
+    //
+    //  Get the current bearer connection status.
+    //
+    TASK_SEND(depth, "AT+SAPBR=2,1", 10000);
+    connection->bearer = gprs_query();
+  }
+
+  //
+  //  The cache is only trusted again once every step succeeds.
+  //
+  connection->known = false;
+
+  //
+  //  If the device is not yet attached to GPRS serivce, then attach it.
+  //
+  if (gs_sim_task.state && !connection->attached)
+  {
+    TASK_SEND(depth, "AT+CGATT=1", 20000);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_GPRS_SERVICE);
+    }
+    connection->attached = true;
+  }
+
+  //
+  //  If the connection is closed, and should be opend (state == ON),
+  //  then open the connection.
+  //
+  if (gs_sim_task.state && (connection->bearer == CLOSED))
+  {
+    if (gs_bearer_config.profile[0] == 0)
+    {
+      TASK_EXIT(depth, ERROR_GPRS_CONTEXT);
+    }
+
+    //
+    //  Set the bearer profile -> connection type, access point name,
+    //  username and password, in one command line. The SIM868 stops at the
+    //  first command that fails.
+    //
+    if (gs_bearer_config.dirty)
+    {
+      TASK_SEND(depth, gs_bearer_config.profile, 10000);
+      if (reply_check("OK"))
+      {
+        TASK_EXIT(depth, ERROR_REPLY);
+      }
+
+      gs_bearer_config.dirty = false;
+    }
+
+    //
+    //  Open the GPRS context.
+    //
+    TASK_SEND(depth, "AT+SAPBR=1,1", 30000);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_GPRS_CONTEXT);
+    }
+
+    TASK_SEND(depth, "AT+SAPBR=2,1", 10000);
+    connection->bearer = gprs_query();
+    if (connection->bearer != CONNECTED)
+    {
+      TASK_EXIT(depth, ERROR_GPRS_CONTEXT);
+    }
+
+    _debug_printf("Bearer is connected!\r\n\r\n");
+  }
+  else if (!gs_sim_task.state && (connection->bearer == CONNECTED))
+  {
+    //
+    //  Close the GPRS context.
+    //
+    TASK_SEND(depth, "AT+SAPBR=0,1", 30000);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_GPRS_CONTEXT);
+    }
+
+    //
+    //  The Http session does not survive the bearer.
+    //
+    gs_http_session.active = false;
+
+    TASK_SEND(depth, "AT+SAPBR=2,1", 10000);
+    connection->bearer = gprs_query();
+    if (connection->bearer != CLOSED)
+    {
+      TASK_EXIT(depth, ERROR_GPRS_CONTEXT);
+    }
+
+    _debug_printf("Bearer is closed!\r\n\r\n");
+  }
+
+  //
+  //  If the device is attached to the GPRS service, an shouldn't be (state == OFF),
+  //  then detached it.
+  //
+  if (!gs_sim_task.state && connection->attached)
+  {
+    TASK_SEND(depth, "AT+CGATT=0", 20000);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_GPRS_SERVICE);
+    }
+    connection->attached = false;
+  }
+
+  //
+  //  A bearer that is still connecting or closing is queried again.
+  //
+  connection->known = (connection->bearer == CONNECTED || connection->bearer == CLOSED);
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of the GPRS/GSM initialization.
+//!
+//! This function sets the automatic network selection mode, evalutes the
+//! signal strength (RSSI) and waits for the GSM network registration, then it
+//! enables the GPRS service.
+//!
+//! The registration is tracked by the +CREG unsolicited result codes with the
+//! location information, there is no polling of the status.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_gprs_gsm_init(uint8_t depth)
+{
+  struct Gsm_Registration *registration = &gs_gsm_registration;
+
+  TASK_BEGIN(depth);
+
+  //
+  //  Verify that the currect selection of is in automatic mode.
+  //
+  TASK_SEND(depth, "AT+COPS?", DEFAULT_TIMEOUT);
+  if (parse_reply("+COPS: ", &gs_sim_task.value, ',' , 0))
+  {
+    TASK_EXIT(depth, ERROR_REPLY);
+  }
+
+  //
+  //  If the selection mode is no in "automatic network selection", then set it.
+  //
+  if (gs_sim_task.value != 0)
+  {
+    TASK_SEND(depth, "AT+COPS=0", DEFAULT_TIMEOUT);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+  }
+
+  //
+  //  Request the signal strength indicator (RSSI).
+  //
+  TASK_SEND(depth, "AT+CSQ", DEFAULT_TIMEOUT);
+  if (parse_reply("+CSQ: ", &gs_sim_task.value, ',', 0))
+  {
+    TASK_EXIT(depth, ERROR_REPLY);
+  }
+
+  gs_at_timeouts.rssi = (uint8_t)gs_sim_task.value;
+
+  //
+  //  Signal strength:
+  //  state < 9  - Unusable intensity.
+  //  state < 15  - Low intensity.
+  //  state < 20  - Medium intensity.
+  //  state < 32  - High intensity.
+  //
+  if (gs_sim_task.value < 9 && gs_sim_task.value > 32)
+  {
+    TASK_EXIT(depth, ERROR_NETWORK_RSSI);
+  }
+
+  //
+  //  Report the changes of the registration status with the cell, then get
+  //  the current status, the replies are tracked by at_urc().
+  //
+  TASK_SEND(depth, "AT+CREG=2", DEFAULT_TIMEOUT);
+  if (reply_check("OK"))
+  {
+    TASK_EXIT(depth, ERROR_REPLY);
+  }
+
+  TASK_SEND(depth, "AT+CREG?", DEFAULT_TIMEOUT);
+  if (reply_check("OK"))
+  {
+    TASK_EXIT(depth, ERROR_REPLY);
+  }
+
+  gs_sim_task.since = _sys_tick_ms();
+  gs_sim_task.value = 0xFF;
+
+  //
+  //  Both REGISTERED_HOME_NET and REGISTRED_NO_HOME_NET are successful
+  //  network registration results.
+  //
+  while (registration->status != REGISTERED_HOME_NET &&
+         registration->status != REGISTRED_NO_HOME_NET)
+  {
+    if (registration->status != gs_sim_task.value)
+    {
+      gs_sim_task.value = registration->status;
+
+      if (gs_sim_task.value == SEARCHING)
+      {
+        _debug_printf("Searching network...\r\n\r\n");
+      }
+      else if (gs_sim_task.value == REGISTRATION_DENIED)
+      {
+        _debug_printf("Network registration denied\r\n\r\n");
+      }
+    }
+
+    if ((uint32_t)(_sys_tick_ms() - gs_sim_task.since) >= registration->time_out)
+    {
+      TASK_EXIT(depth, ERROR_NETWORK_REGISTRATION);
+    }
+
+    TASK_YIELD(depth);
+  }
+
+  _debug_printf("GSM network registration, OK!\r\n\r\n");
+
+  gs_sim_task.state = ON;
+  TASK_SPAWN(depth, task_gprs_enable);
+  if (gs_sim_task.error_status)
+  {
+    TASK_EXIT(depth, gs_sim_task.error_status);
+  }
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Serializes a report batch.
+//!
+//! This function writes the fixes into the batch buffer as a JSON array, from
+//! the oldest to the newest.
+//!
+//! @param[in] record Ring of BATCH_LENGTH fixes.
+//! @param[in] head   Position of the oldest fix.
+//! @param[in] count  Number of fixes, up to BATCH_LENGTH.
+//!
+//! @return length Number of characters written.
+//
+//*****************************************************************************
+static uint16_t
+batch_serialize(struct GNSS_Fix_Record *record, uint8_t head, uint8_t count)
+{
+  uint8_t i;
+  uint16_t length = 0;
+
+  g_batch_json[length++] = '[';
+
+  for (i = 0; i < count; i++)
+  {
+    struct GNSS_Fix_Record *fix = &record[(head + i) % BATCH_LENGTH];
+    struct GNSS_Data_Time time;
+
+    if (i)
+    {
+      g_batch_json[length++] = ',';
+    }
+
+    length += sprintf(&g_batch_json[length], "{\"lat\":");
+    length += batch_print_degrees(&g_batch_json[length], fix->lat);
+    length += sprintf(&g_batch_json[length], ",\"lon\":");
+    length += batch_print_degrees(&g_batch_json[length], fix->lon);
+    length += sprintf(&g_batch_json[length], ",\"speed\":%u,\"time\":", fix->speed_kph);
+
+    //
+    //  The time is printed in the time zone of SIM868_time_set_zone(), a fix
+    //  without a date has a null time.
+    //
+    if (fix->seconds)
+    {
+      time_date(&time, time_local(fix->seconds));
+      length += sprintf(&g_batch_json[length], "\"20%02u-%02u-%02u %02u:%02u:%02u\"}",
+                        time.year, time.month, time.day, time.hour, time.minutes, time.seconds);
+    }
+    else
+    {
+      length += sprintf(&g_batch_json[length], "null}");
+    }
+  }
+
+  g_batch_json[length++] = ']';
+  g_batch_json[length] = 0;
+
+  return length;
+}
+
+//*****************************************************************************
+//
+//! @brief Prints a coordinate in degrees.
+//!
+//! This function prints microdegrees as degrees with six decimals, without
+//! floating point formatting.
+//!
+//! @param[out] buffer       Buffer where the coordinate is printed.
+//! @param[in]  microdegrees Coordinate in microdegrees.
+//!
+//! @return length Number of characters printed.
+//
+//*****************************************************************************
+static uint16_t
+batch_print_degrees(char *buffer, int32_t microdegrees)
+{
+  uint32_t value = (microdegrees < 0) ? -microdegrees : microdegrees;
+
+  return sprintf(buffer, "%s%lu.%06lu", (microdegrees < 0) ? "-" : "",
+                 (unsigned long)(value / 1000000), (unsigned long)(value % 1000000));
+}
+
+//*****************************************************************************
+//
+//! @brief Writes an unsigned varint.
+//!
+//! @param[out] buffer Position of the varint.
+//! @param[in]  value  Value to be written.
+//!
+//! @return length Number of bytes written, from 1 to 5.
+//
+//*****************************************************************************
+static uint16_t
+encode_varint(uint8_t *buffer, uint32_t value)
+{
+  uint16_t i = 0;
+
+  while (value >= 0x80)
+  {
+    buffer[i++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  buffer[i++] = value;
+
+  return i;
+}
+
+//*****************************************************************************
+//
+//! @brief Maps a signed value to an unsigned one for a varint.
+//!
+//! The values close to zero, positive or negative, get the shortest varints
+//! (0, -1, 1, -2... become 0, 1, 2, 3...).
+//!
+//! @param[in] value Signed value.
+//!
+//! @return value Unsigned value.
+//
+//*****************************************************************************
+static uint32_t
+encode_zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+//*****************************************************************************
+//
+//! @brief Moves the report batch to the report store.
+//!
+//! @return error_status Result of the flash write, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error occurred and the fixes left are kept in the
+//!                      batch.
+//
+//*****************************************************************************
+static uint8_t
+batch_spill(void)
+{
+  #if SIM868_STORE_SECTORS > 0
+      while (gs_report_batch.count)
+      {
+        if (store_write(STORE_FIX, &gs_report_batch.record[gs_report_batch.head]))
+        {
+          return ERROR_STORE;
+        }
+
+        gs_report_batch.head = (gs_report_batch.head + 1) % BATCH_LENGTH;
+        gs_report_batch.count--;
+      }
+  #endif
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Posts the serialized report batch.
+//!
+//! This function sends the batch buffer with an Http POST request in place of
+//! the json structure set by the host, which is restored afterwards.
+//!
+//! @param[in] max_attempts Number of attempts to perfrom the full request.
+//!
+//! @return error_status Result of the Http request.
+//
+//*****************************************************************************
+static uint8_t
+batch_post(uint8_t max_attempts)
+{
+  char *json_structure = gs_http_header.json_structure;
+  uint8_t error_status;
+
+  gs_http_header.json_structure = g_batch_json;
+  error_status = SIM868_http_send_request(POST, max_attempts);
+  gs_http_header.json_structure = json_structure;
+
+  return error_status;
+}
+
+#if SIM868_STORE_SECTORS > 0
+//*****************************************************************************
+//
+//! @brief Scans the report store.
+//!
+//! This function finds the last entry of the log, the sequence of the last
+//! fix forwarded and the number of fixes left. It runs only once.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+store_mount(void)
+{
+  struct Report_Store *store = &gs_report_store;
+  struct Store_Sector sector;
+  struct Store_Entry entry;
+  uint8_t i;
+  uint16_t j;
+
+  if (store->mounted)
+  {
+    return;
+  }
+
+  store->mounted = true;
+  store->sector = 0;
+  store->entry = STORE_ENTRIES;
+  store->sector_sequence = 0;
+  store->sequence = 1;
+  store->sent = 0;
+  store->count = 0;
+
+  //
+  //  The sector in use is the one with the highest sequence. The entry with
+  //  the highest sequence holds the last sent sequence, it may be in another
+  //  sector when the one in use was just erased.
+  //
+  for (i = 0; i < SIM868_STORE_SECTORS; i++)
+  {
+    _flash_read(SIM868_STORE_ADDRESS + ((uint32_t)i * SIM868_STORE_SECTOR_SIZE), &sector, sizeof(sector));
+    if (sector.key != STORE_KEY)
+    {
+      continue;
+    }
+
+    for (j = 0; j < STORE_ENTRIES && store_read(i, j, &entry); j++)
+    {
+      if (store_check(&entry) && entry.sequence >= store->sequence)
+      {
+        store->sequence = entry.sequence + 1;
+        store->sent = entry.sent;
+      }
+    }
+
+    if (sector.sequence >= store->sector_sequence)
+    {
+      store->sector = i;
+      store->sector_sequence = sector.sequence;
+      store->entry = j;
+    }
+  }
+
+  //
+  //  Count the fixes not forwarded yet.
+  //
+  for (i = 0; i < SIM868_STORE_SECTORS; i++)
+  {
+    for (j = 0; j < STORE_ENTRIES && store_read(i, j, &entry); j++)
+    {
+      if (store_check(&entry) && entry.type == STORE_FIX && entry.sequence > store->sent)
+      {
+        store->count++;
+      }
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Reads an entry of the report store.
+//!
+//! @param[in]  sector      Index of the sector.
+//! @param[in]  entry       Index of the entry within the sector.
+//! @param[out] store_entry Entry read.
+//!
+//! @return true/false The entry is not erased and the sector is in use.
+//
+//*****************************************************************************
+static uint8_t
+store_read(uint8_t sector, uint16_t entry, struct Store_Entry *store_entry)
+{
+  uint32_t address = SIM868_STORE_ADDRESS + ((uint32_t)sector * SIM868_STORE_SECTOR_SIZE);
+  struct Store_Sector header;
+
+  _flash_read(address, &header, sizeof(header));
+  if (header.key != STORE_KEY)
+  {
+    return false;
+  }
+
+  address += sizeof(struct Store_Sector) + ((uint32_t)entry * sizeof(struct Store_Entry));
+  _flash_read(address, store_entry, sizeof(*store_entry));
+
+  return (store_entry->sequence != STORE_ERASED);
+}
+
+//*****************************************************************************
+//
+//! @brief Appends an entry to the report store.
+//!
+//! @param[in] type STORE_FIX or STORE_SENT.
+//! @param[in] fix  Fix of a STORE_FIX entry, null for STORE_SENT.
+//!
+//! @return error_status Result of the flash write, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error occurred.
+//
+//*****************************************************************************
+static uint8_t
+store_write(uint8_t type, struct GNSS_Fix_Record *fix)
+{
+  struct Report_Store *store = &gs_report_store;
+  struct Store_Entry entry;
+  uint32_t address;
+  uint8_t *byte = (uint8_t *)&entry;
+  uint8_t check = 0;
+  uint8_t i;
+
+  store_mount();
+
+  if (store->entry >= STORE_ENTRIES && store_next_sector())
+  {
+    return ERROR_STORE;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.sequence = store->sequence;
+  entry.sent = store->sent;
+  entry.type = type;
+  if (fix)
+  {
+    entry.fix = *fix;
+  }
+  for (i = 0; i < sizeof(entry); i++)
+  {
+    check += byte[i];
+  }
+  entry.check = check;
+
+  address = SIM868_STORE_ADDRESS + ((uint32_t)store->sector * SIM868_STORE_SECTOR_SIZE) +
+            sizeof(struct Store_Sector) + ((uint32_t)store->entry * sizeof(struct Store_Entry));
+
+  //
+  //  The entry is used even if the write failed, it cannot be programmed
+  //  twice.
+  //
+  store->entry++;
+  store->sequence++;
+  if (_flash_write(address, &entry, sizeof(entry)))
+  {
+    return ERROR_STORE;
+  }
+
+  if (type == STORE_FIX)
+  {
+    store->count++;
+  }
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Starts the next sector of the report store.
+//!
+//! This function erases the sector after the one in use, the fixes in it not
+//! forwarded yet are lost.
+//!
+//! @return error_status Result of the flash erase, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error occurred.
+//
+//*****************************************************************************
+static uint8_t
+store_next_sector(void)
+{
+  struct Report_Store *store = &gs_report_store;
+  struct Store_Sector sector;
+  struct Store_Entry entry;
+  uint32_t address;
+  uint16_t j;
+
+  store->sector = (store->sector + 1) % SIM868_STORE_SECTORS;
+  address = SIM868_STORE_ADDRESS + ((uint32_t)store->sector * SIM868_STORE_SECTOR_SIZE);
+
+  for (j = 0; j < STORE_ENTRIES && store_read(store->sector, j, &entry); j++)
+  {
+    if (store_check(&entry) && entry.type == STORE_FIX && entry.sequence > store->sent)
+    {
+      store->count--;
+      store->dropped++;
+    }
+  }
+
+  if (_flash_erase(address))
+  {
+    return ERROR_STORE;
+  }
+
+  sector.key = STORE_KEY;
+  sector.sequence = ++store->sector_sequence;
+  store->entry = 0;
+
+  return _flash_write(address, &sector, sizeof(sector)) ? ERROR_STORE : NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Checks an entry of the report store.
+//!
+//! @param[in] store_entry Entry read.
+//!
+//! @return true/false The entry was programmed completely.
+//
+//*****************************************************************************
+static uint8_t
+store_check(struct Store_Entry *store_entry)
+{
+  struct Store_Entry entry = *store_entry;
+  uint8_t *byte = (uint8_t *)&entry;
+  uint8_t check = 0;
+  uint8_t i;
+
+  entry.check = 0;
+  for (i = 0; i < sizeof(entry); i++)
+  {
+    check += byte[i];
+  }
+
+  return (check == store_entry->check);
+}
+
+//*****************************************************************************
+//
+//! @brief Loads the oldest fixes not forwarded.
+//!
+//! This function reads the log from the oldest sector, the entries are in the
+//! order they were written.
+//!
+//! @param[out] record Fixes loaded, up to BATCH_LENGTH.
+//! @param[out] last   Sequence of the last fix loaded.
+//!
+//! @return count Number of fixes loaded.
+//
+//*****************************************************************************
+static uint8_t
+store_load(struct GNSS_Fix_Record *record, uint32_t *last)
+{
+  struct Store_Entry entry;
+  uint8_t count = 0;
+  uint8_t i;
+  uint8_t sector;
+  uint16_t j;
+
+  for (i = 1; i <= SIM868_STORE_SECTORS && count < BATCH_LENGTH; i++)
+  {
+    sector = (gs_report_store.sector + i) % SIM868_STORE_SECTORS;
+    for (j = 0; j < STORE_ENTRIES && count < BATCH_LENGTH && store_read(sector, j, &entry); j++)
+    {
+      if (store_check(&entry) && entry.type == STORE_FIX && entry.sequence > gs_report_store.sent)
+      {
+        record[count++] = entry.fix;
+        *last = entry.sequence;
+      }
+    }
+  }
+
+  return count;
+}
+#endif
+
+//*****************************************************************************
+//
+//! @brief Steps of the Http initialization.
+//!
+//! This function starts a new Http session, unless the last one is kept alive,
+//! and sets the Http header parameters that were not sent to it yet.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_http_init(uint8_t depth)
+{
+  uint8_t flag;
+
+  TASK_BEGIN(depth);
+
+  //
+  //  Release the data of the last response.
+  //
+  gs_http_response.length = 0;
+  gs_http_request.data_left = false;
+
+  //
+  //  A session kept alive is reused as it is, otherwise start a new one.
+  //
+  if (!(gs_http_session.keep_alive && gs_http_session.active))
+  {
+    gs_http_session.active = false;
+    gs_http_header.dirty = HTTP_PARA_ALL;
+
+    //
+    //  Handle any pending.
+    //
+    TASK_SEND(depth, "AT+HTTPTERM", DEFAULT_TIMEOUT);
+
+    //
+    //  Init HTTP service.
+    //
+    TASK_SEND(depth, "AT+HTTPINIT", DEFAULT_TIMEOUT);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_HTTP_SERVICE);
+    }
+
+  }
+
+  //
+  //  Set bearer profile identifier of a new session, then user agent,
+  //  Content-type, user data (Authorization) and Http URL, in one command
+  //  line. The ones never set are skipped.
+  //
+  g_at_chain[0] = 0;
+  gs_sim_task.value = 0;
+
+  if (!gs_http_session.active)
+  {
+    at_chain(g_at_chain, AT_LINE_LENGTH, "AT+HTTPPARA=\"CID\",1");
+  }
+
+  for (flag = HTTP_PARA_UA; flag <= HTTP_PARA_URL; flag <<= 1)
+  {
+    if ((gs_http_header.dirty & flag) && http_para(flag)[0] &&
+        at_chain(g_at_chain, AT_LINE_LENGTH, http_para(flag)) == NO_ERROR)
+    {
+      gs_sim_task.value |= flag;
+    }
+  }
+
+  if (g_at_chain[0])
+  {
+    TASK_SEND(depth, g_at_chain, DEFAULT_TIMEOUT);
+    if (reply_check("OK"))
+    {
+      gs_http_session.active = false;
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+
+    gs_http_header.dirty &= ~gs_sim_task.value;
+  }
+
+  gs_http_session.active = true;
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the command of an Http parameter.
+//!
+//! @param[in] flag HTTP_PARA_* flag of the parameter.
+//!
+//! @return para AT+HTTPPARA command, empty if the parameter was never set.
+//
+//*****************************************************************************
+static char *
+http_para(uint8_t flag)
+{
+  if (flag == HTTP_PARA_UA)
+  {
+    return gs_http_header.user_agent;
+  }
+  if (flag == HTTP_PARA_CONTENT)
+  {
+    return gs_http_header.content_type;
+  }
+  if (flag == HTTP_PARA_USERDATA)
+  {
+    return gs_http_header.user_data;
+  }
+
+  return gs_http_header.url;
+}
+
+//*****************************************************************************
+//
+//! @brief Build an Http parameter.
+//!
+//! This function builds the AT+HTTPPARA command of a parameter, and flags it
+//! to be sent with the next request.
+//!
+//! @param[out] command AT+HTTPPARA command, kept if the value does not fit.
+//! @param[in]  size    Size of the command buffer.
+//! @param[in]  name    Name of the parameter (UA, URL...).
+//! @param[in]  value   Value of the parameter.
+//! @param[in]  suffix  Appended to the value, used by the URL.
+//! @param[in]  flag    HTTP_PARA_* flag of the parameter.
+//!
+//! @return error_status If error_status is equal to false, then the command
+//!                      was built, if not, it does not fit the buffer.
+//
+//*****************************************************************************
+static uint8_t
+http_build_para(char *command, uint16_t size, const char *name,
+                const char *value, const char *suffix, uint8_t flag)
+{
+  if (strlen(name) + strlen(value) + strlen(suffix) +
+      sizeof("AT+HTTPPARA=\"\",\"\"") > size)
+  {
+    _debug_printf("The Http parameter is too long!\n\r");
+    return ERROR_CONFIG;
+  }
+
+  sprintf(command, "AT+HTTPPARA=\"%s\",\"%s%s\"", name, value, suffix);
+  gs_http_header.dirty |= flag;
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of the Http action preparation.
+//!
+//! This function downloads the JSON structure to the SIM868 for the POST
+//! method, nothing has to be done for the GET method. The method is a
+//! parameter of the task.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_http_prepare(uint8_t depth)
+{
+  TASK_BEGIN(depth);
+
+  //
+  //  Only for POST method.
+  //
+  if (gs_sim_task.method)
+  {
+    gs_sim_task.length = gs_http_header.json_structure ? strlen(gs_http_header.json_structure) : 0;
+
+    if (gs_sim_task.length == 0 || gs_sim_task.length > HTTP_DATA_MAX_LENGTH)
+    {
+      TASK_EXIT(depth, ERROR_JSON_STRUCTURE);
+    }
+
+    //
+    //  The download window is the time to send the JSON structure at the
+    //  baud rate of the SIM868 (10 bits per character), plus one second.
+    //
+    gs_sim_task.window = ((gs_sim_task.length * 10 * 1000) / SIM868_BAUD_RATE) + HTTP_DATA_MIN_TIME;
+    if (gs_sim_task.window > HTTP_DATA_MAX_TIME)
+    {
+      gs_sim_task.window = HTTP_DATA_MAX_TIME;
+    }
+
+    //
+    //  Prepare the POST : JSON structure of the exact length
+    //  to send within the download window.
+    //
+    snprintf(gs_sim_task.at, TASK_AT_LENGTH, "AT+HTTPDATA=%lu,%lu",
+             (unsigned long)gs_sim_task.length, (unsigned long)gs_sim_task.window);
+    TASK_SEND(depth, gs_sim_task.at, DEFAULT_TIMEOUT);
+    if (reply_check("DOWNLOAD"))
+    {
+      TASK_EXIT(depth, ERROR_REPLY);
+    }
+
+    //
+    //  The SIM868 replies as soon as it gets all the characters,
+    //  or once the window expired.
+    //
+    TASK_SEND(depth, gs_http_header.json_structure, gs_sim_task.window + DEFAULT_TIMEOUT);
+    if (reply_check("OK"))
+    {
+      TASK_EXIT(depth, ERROR_JSON_STRUCTURE);
+    }
+  }
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Checks the result of the Http action.
+//!
+//! This function parses the +HTTPACTION line of the last reply, it holds the
+//! status code and the length of the response data.
+//!
+//! @return error_status Result of the Http action, if error_status is equal to
+//!                      false, then the server replied OK or CREATED.
+//
+//*****************************************************************************
+static uint8_t
+http_action_result(void)
+{
+  uint16_t status;
+  struct Reply_Field field[3];
+
+  //
+  //  Parse the status code and the length of the response data,
+  //  the +HTTPACTION: <method>,<status>,<length> line is part of the reply.
+  //
+  if(reply_tokenize("+HTTPACTION: ", ',', field, 3) < 3 ||
+     field[1].type != FIELD_NUMBER || field[2].type != FIELD_NUMBER)
+  {
+    return ERROR_REPLY;
+  }
+  status = field[1].value;
+  g_http_data_length = field[2].value;
+
+  //
+  //  Hold the status code to check it later.
+  //
+  g_http_status_code = status;
+
+  //
+  //  Print status from last request.
+  //
+  #if SIM868_LOG_LEVEL >= SIM868_LOG_INFO
+      char http_status[24];
+      sprintf(http_status, "Status code: %lu\r\n\r\n", (unsigned long)status);
+      _debug_printf(http_status);
+  #endif
+
+  //
+  //  Check if everything went OK.
+  //
+  if(status == OK || status == CREATED)
+  {
+    return NO_ERROR;
+  }
+
+  return ERROR_HTTP_STATUS_CODE;
+}
+
+//*****************************************************************************
+//
+//! @brief Completes an asynchronous Http request.
+//!
+//! This function is the callback of the AT+HTTPACTION command, the response
+//! data is left in the SIM868 to be read with SIM868_http_read_stream().
+//!
+//! @param[in] error_status Result of the AT+HTTPACTION command.
+//! @param[in] context      Not used.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+http_action_done(uint8_t error_status, void *context)
+{
+  struct Http_Request *request = &gs_http_request;
+
+  (void)context;
+
+  error_status = error_status ? ERROR_HTTP_REQUEST : http_action_result();
+
+  //
+  //  Start a new session on the next request, unless it was the server
+  //  which failed. A session not kept alive is terminated by the next
+  //  request, or once the response data is read.
+  //
+  if (error_status && error_status != ERROR_HTTP_STATUS_CODE)
+  {
+    gs_http_session.active = false;
+  }
+  else
+  {
+    request->data_left = (g_http_data_length > 0);
+    if (!request->data_left && !gs_http_session.keep_alive)
+    {
+      gs_http_session.active = false;
+    }
+  }
+
+  http_request_end(error_status);
+}
+
+//*****************************************************************************
+//
+//! @brief Completes the task of an asynchronous Http request.
+//!
+//! This function is the callback of the task, the request is only completed
+//! here when it failed before the AT+HTTPACTION command was queued.
+//!
+//! @param[in] error_status Result of the task.
+//! @param[in] context      Not used.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+http_request_done(uint8_t error_status, void *context)
+{
+  (void)context;
+
+  if (error_status)
+  {
+    g_http_status_code = 0;
+    g_http_data_length = 0;
+    http_request_end(error_status);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Ends an asynchronous Http request.
+//!
+//! @param[in] error_status Result of the request.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+http_request_end(uint8_t error_status)
+{
+  struct Http_Request *request = &gs_http_request;
+
+  request->pending = false;
+  request->error_status = error_status;
+
+  #if SIM868_STATS
+      if (error_status)
+      {
+        gs_at_stats.snapshot.http_failures++;
+      }
+  #endif
+
+  if (request->callback)
+  {
+    request->callback(error_status, g_http_status_code, g_http_data_length, request->context);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Get the data of an Http read.
+//!
+//! This function finds the data in the reply of the last AT+HTTPREAD command,
+//! the data is the line after +HTTPREAD.
+//!
+//! @param[out] data Slice where the data is stored.
+//!
+//! @return error_status Result of the reding operation, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error occurred.
+//
+//*****************************************************************************
+static uint8_t
+http_read_data(struct Slice *data)
+{
+    uint8_t i;
+
+    //
+    //  Check if the server returned an OK.
+    //
+    for (i = 0; i < gs_at_engine.line_count; i++)
+    {
+      if (slice_starts_with(gs_at_engine.line[i], "+HTTPREAD: "))
+      {
+        break;
+      }
+    }
+    if (i == gs_at_engine.line_count)
+    {
+      return ERROR_REPLY;
+    }
+
+    if (slice_to_uint(slice_skip(gs_at_engine.line[i], strlen("+HTTPREAD: "))) == 0)
+    {
+      data->length = 0;
+    }
+    else if (reply_line(i + 1))
+    {
+      *data = *reply_line(i + 1);
+    }
+    else
+    {
+      return ERROR_REPLY;
+    }
+
+    return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Pass a slice to an Http sink.
+//!
+//! This function passes the slice without copying it, as one part or as two
+//! parts if it wraps around the end of the sim ring.
+//!
+//! @param[in] s       Slice of the sim ring.
+//! @param[in] sink    Function that receives the data.
+//! @param[in] context User pointer passed to the sink.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+http_sink_slice(struct Slice s, SIM868_http_sink_t sink, void *context)
+{
+    uint16_t first = gs_sim_ring.size - s.offset;
+
+    if (first > s.length)
+    {
+      first = s.length;
+    }
+
+    if (first)
+    {
+      sink(&gs_sim_ring.data[s.offset], first, context);
+    }
+    if (s.length > first)
+    {
+      sink(&gs_sim_ring.data[0], s.length - first, context);
+    }
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of an Http session.
+//!
+//! This function start an Http session for the requested method and downloads
+//! the data returned from the server. The method is a parameter of the task.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_http_start(uint8_t depth)
+{
+    uint8_t error_status;
+
+    TASK_BEGIN(depth);
+
+    TASK_SPAWN(depth, task_http_prepare);
+    if (gs_sim_task.error_status)
+    {
+      gs_http_session.active = false;
+      TASK_EXIT(depth, gs_sim_task.error_status);
+    }
+
+    //
+    //  Http Request session start.
+    //
+    snprintf(gs_sim_task.at, TASK_AT_LENGTH, "AT+HTTPACTION=%u", gs_sim_task.method);
+    TASK_SEND(depth, gs_sim_task.at, 30000);
+
+    error_status = reply_check("OK") ? ERROR_HTTP_REQUEST : http_action_result();
+    if (error_status)
+    {
+      //
+      //  Start a new session on the next request, unless it was the server
+      //  which failed.
+      //
+      if (error_status != ERROR_HTTP_STATUS_CODE)
+      {
+        gs_http_session.active = false;
+      }
+      TASK_EXIT(depth, error_status);
+    }
+
+    //
+    //  A response larger than one chunk is left in the SIM868, and the
+    //  session open, to be read with SIM868_http_read_stream().
+    //
+    if (g_http_data_length > HTTP_CHUNK_LENGTH)
+    {
+      gs_http_request.data_left = true;
+      _debug_printf("HTTP request, done! Response left for streaming.\r\n\r\n");
+      TASK_EXIT(depth, NO_ERROR);
+    }
+
+    //
+    //  Http response data, it is held in the sim ring instead of copying it.
+    //
+    TASK_SEND(depth, "AT+HTTPREAD", 5000);
+    error_status = http_read_data(&gs_http_response);
+    if (error_status)
+    {
+      TASK_EXIT(depth, error_status);
+    }
+
+    //
+    //  Terminate Http service, unless the session is kept alive.
+    //
+    if (!gs_http_session.keep_alive)
+    {
+      gs_http_session.active = false;
+      TASK_SEND(depth, "AT+HTTPTERM", DEFAULT_TIMEOUT);
+      if (reply_check("OK"))
+      {
+        TASK_EXIT(depth, ERROR_REPLY);
+      }
+    }
+
+    _debug_printf("HTTP request, done!\r\n\r\n");
+
+    TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of an Http request.
+//!
+//! This function initilize and executes an new Http request, each part is
+//! attempted up to the maximum number of attempts of the task.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_http_send_request(uint8_t depth)
+{
+  TASK_BEGIN(depth);
+
+  #if SIM868_STATS
+      gs_at_stats.snapshot.http_requests++;
+  #endif
+
+  //
+  //  Initialize Http Service.
+  //
+  gs_sim_task.attempts = gs_sim_task.max_attempts;
+  while (gs_sim_task.attempts--)
+  {
+    //
+    //  Set all http header parameters.
+    //
+    TASK_SPAWN(depth, task_http_init);
+    if (gs_sim_task.error_status == NO_ERROR)
+    {
+      break;
+    }
+    if (gs_sim_task.attempts == 0)
+    {
+      #if SIM868_STATS
+          gs_at_stats.snapshot.http_failures++;
+      #endif
+      TASK_EXIT(depth, ERROR_HTTP_SERVICE);
+    }
+
+    #if SIM868_STATS
+        gs_at_stats.snapshot.http_retries++;
+    #endif
+  }
+
+  //
+  //  Start Http Session.
+  //
+  gs_sim_task.attempts = gs_sim_task.max_attempts;
+  while (gs_sim_task.attempts--)
+  {
+    //
+    //  Get response from server.
+    //
+    TASK_SPAWN(depth, task_http_start);
+    if (gs_sim_task.error_status == NO_ERROR)
+    {
+      break;
+    }
+    if (gs_sim_task.attempts == 0)
+    {
+      #if SIM868_STATS
+          gs_at_stats.snapshot.http_failures++;
+      #endif
+      TASK_EXIT(depth, ERROR_HTTP_REQUEST);
+    }
+
+    #if SIM868_STATS
+        gs_at_stats.snapshot.http_retries++;
+    #endif
+  }
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Steps of an asynchronous Http request.
+//!
+//! This function initilize the Http service and downloads the JSON structure
+//! for the POST method, then it queues the AT+HTTPACTION command without
+//! waiting for the server, http_action_done() completes the request.
+//!
+//! @param[in] depth Nesting level of the step.
+//!
+//! @return TASK_RUNNING/TASK_DONE The result is kept in the error status of
+//!                                the task.
+//
+//*****************************************************************************
+static uint8_t
+task_http_request(uint8_t depth)
+{
+  TASK_BEGIN(depth);
+
+  TASK_SPAWN(depth, task_http_init);
+  if (gs_sim_task.error_status)
+  {
+    TASK_EXIT(depth, gs_sim_task.error_status);
+  }
+
+  TASK_SPAWN(depth, task_http_prepare);
+  if (gs_sim_task.error_status)
+  {
+    gs_http_session.active = false;
+    TASK_EXIT(depth, gs_sim_task.error_status);
+  }
+
+  sprintf(gs_http_request.action, "AT+HTTPACTION=%u", gs_sim_task.method);
+  if (at_queue(gs_http_request.action, 0, 30000, http_action_done, NULL))
+  {
+    gs_http_session.active = false;
+    TASK_EXIT(depth, ERROR_QUEUE_FULL);
+  }
+
+  #if SIM868_STATS
+      gs_at_stats.snapshot.http_requests++;
+  #endif
+
+  TASK_END(depth);
+}
+
+//*****************************************************************************
+//
+//! @brief Activates the GPRS context of the TCP/IP stack.
+//!
+//! This function brings up the context with the APN of the bearer service,
+//! on the GPRS attachment made by SIM868_gprs_enable(). The data received is
+//! kept in the SIM868 until it is read with AT+CIPRXGET.
+//!
+//! @return error_status Result of the GPRS context, if error_status is equal
+//!                      to false, then the operation was successful, if not,
+//!                      an error_status occurred.
+//
+//*****************************************************************************
+static uint8_t
+socket_context(void)
+{
+  if (gs_socket.context)
+  {
+    return NO_ERROR;
+  }
+
+  if (!gs_gprs_connection.attached)
+  {
+    return ERROR_GPRS_SERVICE;
+  }
+
+  if (gs_bearer_config.cstt[0] == 0)
+  {
+    return ERROR_GPRS_CONTEXT;
+  }
+
+  //
+  //  Start from the initial state, a single connection with manual receive.
+  //
+  if (send_check_reply("AT+CIPSHUT", "SHUT OK", SOCKET_SHUT_TIMEOUT) ||
+      send_check_reply("AT+CIPMUX=0", "OK", DEFAULT_TIMEOUT) ||
+      send_check_reply("AT+CIPRXGET=1", "OK", DEFAULT_TIMEOUT))
+  {
+    return ERROR_REPLY;
+  }
+
+  if (send_check_reply(gs_bearer_config.cstt, "OK", DEFAULT_TIMEOUT))
+  {
+    return ERROR_REPLY;
+  }
+
+  //
+  //  Bring up the wireless connection and get the local IP address.
+  //
+  if (send_check_reply("AT+CIICR", "OK", SOCKET_CONTEXT_TIMEOUT) ||
+      send_check_reply("AT+CIFSREX", "OK", DEFAULT_TIMEOUT))
+  {
+    return ERROR_GPRS_CONTEXT;
+  }
+
+  gs_socket.context = true;
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Writes the remaining length of an MQTT packet.
+//!
+//! @param[out] packet Position of the remaining length.
+//! @param[in]  length Remaining length, up to 268435455.
+//!
+//! @return length Number of bytes written, from 1 to 4.
+//
+//*****************************************************************************
+static uint16_t
+mqtt_put_length(uint8_t *packet, uint32_t length)
+{
+  uint16_t i = 0;
+
+  do
+  {
+    packet[i] = length & 0x7F;
+    length >>= 7;
+    if (length)
+    {
+      packet[i] |= 0x80;
+    }
+    i++;
+  } while (length);
+
+  return i;
+}
+
+//*****************************************************************************
+//
+//! @brief Writes a string of an MQTT packet.
+//!
+//! @param[out] packet Position of the string.
+//! @param[in]  string String, null terminated.
+//!
+//! @return length Number of bytes written, the length prefix included.
+//
+//*****************************************************************************
+static uint16_t
+mqtt_put_string(uint8_t *packet, char *string)
+{
+  uint16_t length = strlen(string);
+
+  packet[0] = length >> 8;
+  packet[1] = length & 0xFF;
+  memcpy(&packet[2], string, length);
+
+  return length + 2;
+}
+
+//*****************************************************************************
+//
+//! @brief Sends an MQTT packet.
+//!
+//! @param[in] packet Packet to be sent.
+//! @param[in] length Number of bytes of the packet.
+//!
+//! @return error_status Result of sending the packet, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error_status occurred.
+//
+//*****************************************************************************
+static uint8_t
+mqtt_send(uint8_t *packet, uint16_t length)
+{
+  if (SIM868_socket_send(packet, length))
+  {
+    mqtt_lost();
+    return ERROR_SOCKET;
+  }
+
+  gs_mqtt_client.sent_at = _sys_tick_ms();
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Waits for an acknowledgement of the MQTT broker.
+//!
+//! This function reads the packets received until the one waited for, the
+//! messages published meanwhile are passed to the callback.
+//!
+//! @param[in] type     Packet type waited for.
+//! @param[in] id       Packet identifier, zero for CONNACK.
+//! @param[in] time_out Time to wait for the packet in ms.
+//!
+//! @return error_status Result of the acknowledgement, if error_status is
+//!                      equal to false, then it was received, if not, an
+//!                      error_status occurred.
+//
+//*****************************************************************************
+static uint8_t
+mqtt_wait(uint8_t type, uint16_t id, uint32_t time_out)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint32_t start = _sys_tick_ms();
+
+  client->acked = false;
+  client->ack_type = type;
+  client->ack_id = id;
+
+  while (!client->acked)
+  {
+    if (!SIM868_socket_is_open())
+    {
+      mqtt_lost();
+      return ERROR_SOCKET;
+    }
+
+    if ((uint32_t)(_sys_tick_ms() - start) >= time_out)
+    {
+      client->ack_type = 0;
+      return ERROR_TIMEOUT;
+    }
+
+    SIM868_poll();
+    mqtt_receive();
+    _sim_idle();
+  }
+
+  client->ack_type = 0;
+
+  //
+  //  The return code of CONNACK and of SUBACK is the last byte.
+  //
+  return (client->acked == 1) ? NO_ERROR : ERROR_MQTT;
+}
+
+//*****************************************************************************
+//
+//! @brief Reads the MQTT packets received.
+//!
+//! This function appends the data held by the SIM868 to the packet being
+//! received, and handles each packet once it is complete.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+mqtt_receive(void)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t *packet = client->buffer + (client->length / 2);
+  uint16_t size = client->length - (client->length / 2);
+  uint32_t remaining;
+  uint16_t header;
+  uint16_t received;
+  uint16_t i;
+
+  while (SIM868_socket_available())
+  {
+    //
+    //  The data of a packet that does not fit is read and dropped.
+    //
+    if (client->rx_skip)
+    {
+      received = SIM868_socket_receive(packet, (client->rx_skip < size) ? client->rx_skip : size);
+      client->rx_skip -= (received < client->rx_skip) ? received : client->rx_skip;
+      continue;
+    }
+
+    received = SIM868_socket_receive(&packet[client->rx_length], size - client->rx_length);
+    client->rx_length += received;
+
+    //
+    //  Handle every complete packet.
+    //
+    while (client->rx_length >= 2)
+    {
+      remaining = 0;
+      for (i = 1; i < client->rx_length && i <= 4; i++)
+      {
+        remaining |= (uint32_t)(packet[i] & 0x7F) << (7 * (i - 1));
+        if (!(packet[i] & 0x80))
+        {
+          break;
+        }
+      }
+      //
+      //  The remaining length takes at most four bytes, the stream cannot be
+      //  resynchronized past a longer one.
+      //
+      if (i > 4)
+      {
+        mqtt_lost();
+        return;
+      }
+      if (i >= client->rx_length)
+      {
+        break;
+      }
+
+      header = i + 1;
+      if (header + remaining > size)
+      {
+        client->rx_skip = header + remaining - client->rx_length;
+        client->rx_length = 0;
+        break;
+      }
+      if (header + remaining > client->rx_length)
+      {
+        break;
+      }
+
+      mqtt_handle(packet, header + remaining, header);
+
+      //
+      //  The packet is dropped with the connection if it was lost.
+      //
+      if (client->rx_length < header + remaining)
+      {
+        return;
+      }
+
+      client->rx_length -= header + remaining;
+      memmove(packet, &packet[header + remaining], client->rx_length);
+    }
+
+    if (received == 0)
+    {
+      break;
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Handles an MQTT packet received.
+//!
+//! @param[in] packet Packet received.
+//! @param[in] length Number of bytes of the packet.
+//! @param[in] header Number of bytes of the fixed header.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+mqtt_handle(uint8_t *packet, uint16_t length, uint16_t header)
+{
+  struct Mqtt_Client *client = &gs_mqtt_client;
+  uint8_t ack[4];
+  uint8_t type = packet[0] & 0xF0;
+  uint8_t qos = (packet[0] >> 1) & 0x03;
+  uint16_t id = 0;
+  uint16_t topic_length;
+  uint32_t i = header;
+
+  switch (type)
+  {
+    case MQTT_PUBLISH:
+      //
+      //  QoS 2 takes a PUBREC and PUBREL exchange that is not supported, it is
+      //  dropped as the reserved QoS 3. The topic and packet identifier
+      //  should fit in the packet.
+      //
+      if (qos >= 2 || (uint32_t)length < i + 2)
+      {
+        return;
+      }
+      topic_length = ((uint16_t)packet[i] << 8) | packet[i + 1];
+      i += 2 + (uint32_t)topic_length;
+      if ((uint32_t)length < i + (qos ? 2 : 0))
+      {
+        return;
+      }
+      if (qos)
+      {
+        id = ((uint16_t)packet[i] << 8) | packet[i + 1];
+        i += 2;
+      }
+
+      if (client->callback)
+      {
+        client->callback((char *)&packet[header + 2], topic_length, &packet[i], (uint16_t)(length - i), client->context);
+      }
+
+      if (qos)
+      {
+        ack[0] = MQTT_PUBACK;
+        ack[1] = 2;
+        ack[2] = id >> 8;
+        ack[3] = id & 0xFF;
+        mqtt_send(ack, sizeof(ack));
+      }
+      return;
+
+    case MQTT_PINGRESP:
+      client->ping_at = 0;
+      return;
+
+    case MQTT_PUBACK:
+    case MQTT_SUBACK:
+      if (length >= header + 2)
+      {
+        id = ((uint16_t)packet[header] << 8) | packet[header + 1];
+      }
+      break;
+  }
+
+  if (type != (client->ack_type & 0xF0) || id != client->ack_id)
+  {
+    return;
+  }
+
+  //
+  //  CONNACK returns zero when accepted, SUBACK returns 0x80 on failure.
+  //
+  if (type == MQTT_CONNACK)
+  {
+    client->acked = (length >= header + 2 && packet[header + 1] == 0) ? 1 : 2;
+  }
+  else if (type == MQTT_SUBACK)
+  {
+    client->acked = (length >= header + 3 && packet[header + 2] != 0x80) ? 1 : 2;
+  }
+  else
+  {
+    client->acked = 1;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the connection lost with the MQTT broker.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+mqtt_lost(void)
+{
+  gs_mqtt_client.connected = false;
+  gs_mqtt_client.ping_at = 0;
+  gs_mqtt_client.rx_length = 0;
+  gs_mqtt_client.rx_skip = 0;
+  SIM868_socket_close();
+}
+
+//*****************************************************************************
+//
+//! @brief Queues an AT command or raw data.
+//!
+//! @param[in] at       AT command or raw data, it must remain valid until
+//!                     completed.
+//! @param[in] length   Number of bytes of raw data, zero for a command.
+//! @param[in] time_out Time for waiting the reply in ms.
+//! @param[in] callback Completion function, it can be null.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of queuing the command, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error_status occurred.
+//
+//*****************************************************************************
+static uint8_t
+at_queue(char *at, uint16_t length, uint16_t time_out, SIM868_at_callback_t callback, void *context)
+{
+  if (gs_at_engine.count == AT_QUEUE_LENGTH)
+  {
+    return ERROR_QUEUE_FULL;
+  }
+
+  uint8_t idx = (gs_at_engine.head + gs_at_engine.count) % AT_QUEUE_LENGTH;
+
+  gs_at_engine.queue[idx].at = at;
+  gs_at_engine.queue[idx].length = length;
+  gs_at_engine.queue[idx].time_out = time_out;
+  gs_at_engine.queue[idx].callback = callback;
+  gs_at_engine.queue[idx].context = context;
+  gs_at_engine.count++;
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Joins an AT command to a command line.
+//!
+//! This function appends the command to the line, the commands after the
+//! first one are joined by a semicolon without their AT prefix. The SIM868
+//! runs them in order and replies with a single final result code.
+//!
+//! @param[in,out] line Command line, empty to start a new one.
+//! @param[in]     size Size of the command line, up to AT_LINE_LENGTH.
+//! @param[in]     at   AT command to be joined.
+//!
+//! @return error_status Result of joining the command, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, the command does not fit and the line is kept.
+//
+//*****************************************************************************
+static uint8_t
+at_chain(char *line, uint16_t size, const char *at)
+{
+  uint16_t length = strlen(line);
+
+  //
+  //  Drop the AT prefix when it is joined.
+  //
+  if (length)
+  {
+    at += 2;
+  }
+
+  if (length + strlen(at) + 2 > size)
+  {
+    return ERROR_CONFIG;
+  }
+
+  if (length)
+  {
+    line[length++] = AT_CHAIN_SEPARATOR;
+  }
+  strcpy(&line[length], at);
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Sends the active AT command.
+//!
+//! This function discards the lines left from the previous command, looks up
+//! the lines expected in its reply and sends the command at the head of the
+//! queue. The characters received meanwhile are processed first, so the
+//! unsolicited result codes among them are still dispatched.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_dispatch(void)
+{
+  uint8_t i;
+  struct AT_Command *cmd = &gs_at_engine.queue[gs_at_engine.head];
+  char *at = cmd->length ? AT_RAW_DATA : cmd->at;
+
+  //
+  //  Discard the lines left from the previous command, a line being received
+  //  is kept whole and it is matched once complete.
+  //
+  at_receive();
+  gs_at_engine.line_count = 0;
+  gs_at_engine.result = AT_NO_RESULT;
+  at_release();
+
+  //
+  //  Look up the lines expected for this command.
+  //
+  gs_at_engine.response = 0;
+  for (i = 0; i < sizeof(g_at_responses) / sizeof(g_at_responses[0]); i++)
+  {
+    if (strncmp(at, g_at_responses[i].at, strlen(g_at_responses[i].at)) == 0)
+    {
+      gs_at_engine.response = &g_at_responses[i];
+      break;
+    }
+  }
+
+  //
+  //  Print AT command.
+  //
+  #ifdef  AT_DEBUG
+      _debug_printf("\t---> ");
+      _debug_printf(at);
+      _debug_printf("\r\n");
+  #endif
+
+  //
+  //  Send AT command, or the raw data as it is.
+  //
+  if (cmd->length)
+  {
+    _sim_send_array((uint8_t *)cmd->at, cmd->length);
+  }
+  else
+  {
+    _sim_send_data(cmd->at);
+    _sim_send_data("\r\n");
+  }
+
+  gs_at_engine.time_out = at_timeout(at, cmd->time_out);
+  gs_at_engine.sent_at = _sys_tick_ms();
+  gs_at_engine.busy = true;
+
+  trace_record(SIM868_TRACE_SENT, at, NO_ERROR, 0);
+
+  #if SIM868_STATS
+      gs_at_stats.snapshot.bytes_sent += cmd->length ? cmd->length : (strlen(cmd->at) + 2);
+  #endif
+}
+
+//*****************************************************************************
+//
+//! @brief Completes the active AT command.
+//!
+//! This function removes the active command from the queue and calls its
+//! completion function.
+//!
+//! @param[in] error_status Result of the command.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_complete(uint8_t error_status)
+{
+  struct AT_Command cmd = gs_at_engine.queue[gs_at_engine.head];
+
+  //
+  //  Print reply received.
+  //
+  #ifdef  AT_DEBUG
+      uint8_t i;
+      char line[DEBUG_LINE_LENGTH];
+      for (i = 0; i < gs_at_engine.line_count; i++)
+      {
+        slice_copy(gs_at_engine.line[i], line, DEBUG_LINE_LENGTH);
+        _debug_printf("\t<--- ");
+        _debug_printf(line);
+        _debug_printf("\r\n");
+      }
+      _debug_printf("\r\n");
+  #endif
+
+  gs_at_engine.head = (gs_at_engine.head + 1) % AT_QUEUE_LENGTH;
+  gs_at_engine.count--;
+  gs_at_engine.busy = false;
+  gs_sleep_mode.idle_since = _sys_tick_ms();
+
+  at_rto_update(error_status, gs_sleep_mode.idle_since - gs_at_engine.sent_at);
+
+  trace_record(SIM868_TRACE_DONE, cmd.length ? AT_RAW_DATA : cmd.at, error_status,
+               (uint16_t)(gs_sleep_mode.idle_since - gs_at_engine.sent_at));
+  stats_record(cmd.length ? AT_RAW_DATA : cmd.at, error_status,
+               (uint16_t)(gs_sleep_mode.idle_since - gs_at_engine.sent_at));
+
+  if (cmd.callback)
+  {
+    cmd.callback(error_status, cmd.context);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Releases the sim ring.
+//!
+//! This function frees the storage of the sim ring up to the line being
+//! assembled, except for the data of the last Http response. The data is
+//! dropped when less than a quarter of the ring would be left free.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_release(void)
+{
+  uint16_t used = (gs_sim_ring.scan + gs_sim_ring.size - gs_http_response.offset) % gs_sim_ring.size;
+
+  if (gs_http_response.length && used > ((gs_sim_ring.size * 3) / 4))
+  {
+    gs_http_response.length = 0;
+  }
+
+  if (gs_http_response.length)
+  {
+    gs_sim_ring.tail = gs_http_response.offset;
+  }
+  else
+  {
+    gs_sim_ring.tail = gs_at_engine.line_start;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the result of a final result code.
+//!
+//! @param[in] line Line received from the SIM868.
+//!
+//! @return error_status Result of the command, or AT_NO_RESULT if the line is
+//!                      not a final result code.
+//
+//*****************************************************************************
+static uint8_t
+at_result(struct Slice line)
+{
+  uint8_t i;
+
+  for (i = 0; i < sizeof(g_at_results) / sizeof(g_at_results[0]); i++)
+  {
+    uint8_t length = strlen(g_at_results[i].code);
+
+    if (slice_starts_with(line, g_at_results[i].code) &&
+        (line.length == length || g_at_results[i].code[length - 1] == ':'))
+    {
+      return g_at_results[i].error_status;
+    }
+  }
+
+  return AT_NO_RESULT;
+}
+
+//*****************************************************************************
+//
+//! @brief Ends the line being assembled.
+//!
+//! This function adds the line to the reply of the active command and
+//! completes the command once its final result code, and the line expected
+//! after it if any, have been received. Without an active command the line is
+//! discarded.
+//!
+//! @param[in] end Position in the sim ring where the line ends.
+//! @param[in] raw The line is raw data and it is not matched.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_end_line(uint16_t end, bool raw)
+{
+  const struct AT_Response *response = gs_at_engine.response;
+  struct Slice line;
+
+  line.offset = gs_at_engine.line_start;
+  line.length = (end + gs_sim_ring.size - line.offset) % gs_sim_ring.size;
+
+  //
+  //  Ignore the carriage return.
+  //
+  while (!raw && line.length && slice_char(line, line.length - 1) == '\r')
+  {
+    line.length--;
+  }
+
+  gs_at_engine.line_start = gs_sim_ring.scan;
+
+  //
+  //  Ignore empty lines.
+  //
+  if (!raw && line.length == 0)
+  {
+    return;
+  }
+
+  //
+  //  Unsolicited result codes are not part of the reply.
+  //
+  if (!raw && at_urc(line))
+  {
+    return;
+  }
+
+  //
+  //  Discard the lines received without a pending command, the last reply
+  //  is kept unless the ring is getting full.
+  //
+  if (!gs_at_engine.busy)
+  {
+    uint16_t used = (gs_sim_ring.head + gs_sim_ring.size - gs_sim_ring.tail) % gs_sim_ring.size;
+
+    if (gs_at_engine.line_count == 0 || used > (gs_sim_ring.size / 2))
+    {
+      gs_at_engine.line_count = 0;
+      at_release();
+    }
+    return;
+  }
+
+  //
+  //  Keep the line as part of the reply if there is room.
+  //
+  if (gs_at_engine.line_count < AT_REPLY_LINES)
+  {
+    gs_at_engine.line[gs_at_engine.line_count++] = line;
+  }
+
+  if (raw)
+  {
+    return;
+  }
+
+  //
+  //  Raw data announced by this line must not be matched.
+  //
+  if (response && response->data && slice_starts_with(line, response->data))
+  {
+    gs_at_engine.data_length = slice_to_uint(slice_skip(line, strlen(response->data)));
+    return;
+  }
+
+  //
+  //  The line that follows the final result code completes the command.
+  //
+  if (gs_at_engine.result != AT_NO_RESULT)
+  {
+    if (slice_starts_with(line, response->urc))
+    {
+      at_complete(gs_at_engine.result);
+    }
+    return;
+  }
+
+  uint8_t result = at_result(line);
+  if (result == AT_NO_RESULT)
+  {
+    return;
+  }
+
+  //
+  //  Wait for the line that follows the final result code, if any.
+  //
+  if (result == NO_ERROR && response && response->urc && !reply_find(response->urc))
+  {
+    gs_at_engine.result = result;
+    return;
+  }
+
+  at_complete(result);
+}
+
+//*****************************************************************************
+//
+//! @brief Dispatches the unsolicited result codes.
+//!
+//! This function sees every line received, with or without a pending command,
+//! and calls the handler of the code it starts with. The line is still part
+//! of the reply when the active command has the same prefix.
+//!
+//! @param[in] line Line received.
+//!
+//! @return true/false The line was an unsolicited result code and it must be
+//!                    taken out of the reply.
+//
+//*****************************************************************************
+static uint8_t
+at_urc(struct Slice line)
+{
+  const struct AT_Urc *urc;
+  char text[DEBUG_LINE_LENGTH];
+  uint8_t i;
+
+  for (i = 0; i < sizeof(g_at_urcs) / sizeof(g_at_urcs[0]); i++)
+  {
+    urc = &g_at_urcs[i];
+    if (!slice_starts_with(line, urc->prefix))
+    {
+      continue;
+    }
+
+    if (urc->handler)
+    {
+      urc->handler(line);
+    }
+
+    trace_record(SIM868_TRACE_URC, urc->prefix, NO_ERROR, 0);
+
+    if (gs_at_engine.busy && urc->at &&
+        !strncmp(gs_at_engine.queue[gs_at_engine.head].at, urc->at, strlen(urc->at)))
+    {
+      return false;
+    }
+
+    if (gs_at_engine.urc_callback)
+    {
+      slice_copy(line, text, sizeof(text));
+      gs_at_engine.urc_callback(text, gs_at_engine.urc_context);
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the GSM registration.
+//!
+//! "+CREG: <stat>[,<lac>,<ci>]", or the reply to AT+CREG? that begins with
+//! <n>, so it has an even number of fields.
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_creg(struct Slice line)
+{
+  struct Reply_Field field[4];
+  uint8_t count, stat;
+
+  count = slice_tokenize(slice_skip(line, strlen("+CREG: ")), ',', field, 4);
+  stat = (count % 2 == 0);
+  if (count > stat && field[stat].type == FIELD_NUMBER)
+  {
+    gs_gsm_registration.status = field[stat].value;
+    if (count >= stat + 3)
+    {
+      gs_gsm_registration.lac = slice_to_hex(field[stat + 1].text);
+      gs_gsm_registration.cell_id = slice_to_hex(field[stat + 2].text);
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the GPRS registration.
+//!
+//! "+CGREG: <stat>", the reply to AT+CGREG? has two fields. Once the SIM868
+//! is not registered the GPRS connection state has to be queried again.
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_cgreg(struct Slice line)
+{
+  struct Reply_Field field[2];
+
+  if (slice_tokenize(slice_skip(line, strlen("+CGREG: ")), ',', field, 2) == 1 &&
+      field[0].value != REGISTERED_HOME_NET && field[0].value != REGISTRED_NO_HOME_NET)
+  {
+    gs_gprs_connection.known = false;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the bearer closed by the network ("+SAPBR 1: DEACT").
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_bearer_closed(struct Slice line)
+{
+  (void)line;
+
+  gs_gprs_connection.bearer = CLOSED;
+  gs_http_session.active = false;
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the GPRS context lost ("+PDP: DEACT", SIM not ready).
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_pdp_closed(struct Slice line)
+{
+  (void)line;
+
+  gs_gprs_connection.known = false;
+  gs_gprs_connection.bearer = CLOSED;
+  gs_http_session.active = false;
+  gs_socket.context = false;
+  gs_socket.connected = false;
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the data received by the socket.
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_socket_data(struct Slice line)
+{
+  (void)line;
+
+  gs_socket.available = true;
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the socket closed by the server.
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_socket_closed(struct Slice line)
+{
+  (void)line;
+
+  gs_socket.connected = false;
+}
+
+//*****************************************************************************
+//
+//! @brief Tracks the SIM868 powering itself down.
+//!
+//! @param[in] line Line received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+urc_power_down(struct Slice line)
+{
+  urc_pdp_closed(line);
+
+  gs_bearer_config.dirty = true;
+  gs_gsm_registration.status = NOT_REGISTERED;
+}
+
+//*****************************************************************************
+//
+//! @brief Assembles the lines received from the SIM868.
+//!
+//! This function processes one character of the sim ring, the characters are
+//! not copied, a line is only a slice of the ring.
+//!
+//! @param[in] position Position of the character in the sim ring.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_process_char(uint16_t position)
+{
+  char incoming_char = gs_sim_ring.data[position];
+
+  //
+  //  Raw data is kept as it is received.
+  //
+  if (gs_at_engine.data_length)
+  {
+    if (--gs_at_engine.data_length == 0)
+    {
+      at_end_line(gs_sim_ring.scan, true);
+    }
+    return;
+  }
+
+  //
+  //  The new line is the end of the line.
+  //
+  if (incoming_char == '\n')
+  {
+    at_end_line(position, false);
+    return;
+  }
+
+  //
+  //  The data prompt is not followed by a new line.
+  //
+  if (incoming_char == ' ' &&
+      ((position + gs_sim_ring.size - gs_at_engine.line_start) % gs_sim_ring.size) == 1 &&
+      gs_sim_ring.data[gs_at_engine.line_start] == '>')
+  {
+    at_end_line(gs_sim_ring.scan, false);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Processes the characters received from the SIM868.
+//!
+//! This function moves any character held by the UART driver into the sim
+//! ring, this is only required when SIM868_rx_handler() is not used in the
+//! ISR, and assembles the lines received, in place.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_receive(void)
+{
+  while (_sim_data_available())
+  {
+    SIM868_rx_handler(_sim_read_buffer());
+  }
+
+  while (gs_sim_ring.scan != gs_sim_ring.head)
+  {
+    uint16_t position = gs_sim_ring.scan;
+    gs_sim_ring.scan = (position + 1) % gs_sim_ring.size;
+
+    at_process_char(position);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the time out of an AT command.
+//!
+//! This function selects the estimator of the command, and returns the
+//! retransmission time out learned (SRTT + 4 * RTTVAR), doubled by each time
+//! out since the last reply. The time of the commands that depend on the
+//! mobile network is scaled by the signal strength of the last AT+CSQ.
+//!
+//! @param[in] at       AT command.
+//! @param[in] time_out Time out requested in ms, it is the maximum.
+//!
+//! @return time_out Time to wait for the reply in ms.
+//
+//*****************************************************************************
+static uint32_t
+at_timeout(char *at, uint16_t time_out)
+{
+  struct AT_Rto *rto;
+  uint32_t learned;
+  uint8_t i;
+
+  gs_at_engine.rto = AT_RTO_NONE;
+  for (i = 0; i < AT_TIMEOUT_COMMANDS; i++)
+  {
+    if (strncmp(at, g_at_timeouts[i].at, strlen(g_at_timeouts[i].at)) == 0)
+    {
+      gs_at_engine.rto = i;
+      break;
+    }
+  }
+
+  if (gs_at_engine.rto == AT_RTO_NONE || !gs_at_timeouts.enabled)
+  {
+    return time_out;
+  }
+
+  rto = &gs_at_timeouts.rto[gs_at_engine.rto];
+  if (rto->samples < AT_RTO_SAMPLES)
+  {
+    return time_out;
+  }
+
+  learned = rto->srtt + (4 * rto->rttvar);
+
+  //
+  //  Signal strength: below RSSI_LOW the reply may take twice as long,
+  //  below RSSI_MEDIUM one and a half times.
+  //
+  if (g_at_timeouts[gs_at_engine.rto].radio)
+  {
+    if (gs_at_timeouts.rssi < RSSI_LOW || gs_at_timeouts.rssi == RSSI_UNKNOWN)
+    {
+      learned *= 2;
+    }
+    else if (gs_at_timeouts.rssi < RSSI_MEDIUM)
+    {
+      learned += learned / 2;
+    }
+  }
+
+  learned <<= rto->backoff;
+
+  if (learned < AT_RTO_MIN)
+  {
+    learned = AT_RTO_MIN;
+  }
+
+  return (learned < time_out) ? learned : time_out;
+}
+
+//*****************************************************************************
+//
+//! @brief Updates the estimator of the active AT command.
+//!
+//! @param[in] error_status Result of the command, any reply is a sample of
+//!                         the round trip time.
+//! @param[in] elapsed      Round trip time of the command in ms.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_rto_update(uint8_t error_status, uint32_t elapsed)
+{
+  struct AT_Rto *rto;
+  uint32_t delta;
+
+  if (gs_at_engine.rto == AT_RTO_NONE)
+  {
+    return;
+  }
+
+  rto = &gs_at_timeouts.rto[gs_at_engine.rto];
+
+  if (error_status == ERROR_TIMEOUT)
+  {
+    if (rto->backoff < AT_RTO_MAX_BACKOFF)
+    {
+      rto->backoff++;
+    }
+    return;
+  }
+
+  rto->backoff = 0;
+
+  if (rto->samples == 0)
+  {
+    rto->srtt = elapsed;
+    rto->rttvar = elapsed / 2;
+  }
+  else
+  {
+    delta = (elapsed > rto->srtt) ? (elapsed - rto->srtt) : (rto->srtt - elapsed);
+    rto->rttvar = ((3 * rto->rttvar) + delta) / 4;
+    rto->srtt = ((7 * rto->srtt) + elapsed) / 8;
+  }
+
+  if (rto->samples < AT_RTO_SAMPLES)
+  {
+    rto->samples++;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Waits until all the queued AT commands are completed.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+at_wait_idle(void)
+{
+  while (SIM868_at_is_busy())
+  {
+    SIM868_poll();
+
+    //
+    //  Let the other tasks run while the reply is waited for.
+    //
+    if (SIM868_at_is_busy())
+    {
+      _sim_idle();
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Starts a task.
+//!
+//! This function makes the step the running task, it is first resumed by the
+//! next SIM868_poll(). Only one task runs at a time.
+//!
+//! @param[in] step     First step of the task.
+//! @param[in] callback Function called when the task is completed, it can be
+//!                     null.
+//! @param[in] context  User pointer passed to the callback.
+//!
+//! @return error_status Result of starting the task, if error_status is equal
+//!                      to false, then the task is running, if not, another
+//!                      task is running.
+//
+//*****************************************************************************
+static uint8_t
+task_start(uint8_t (*step)(uint8_t depth), SIM868_task_callback_t callback, void *context)
+{
+  struct Sim_Task *task = &gs_sim_task;
+
+  if (task->running)
+  {
+    return ERROR_TASK_BUSY;
+  }
+
+  task->step = step;
+  task->callback = callback;
+  task->context = context;
+  task->line[0] = 0;
+  task->at_state = TASK_AT_NONE;
+  task->error_status = NO_ERROR;
+  task->running = true;
+
+  return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Waits for the running task.
+//!
+//! This function runs SIM868_poll() until the task is completed.
+//!
+//! @return error_status Result of the task.
+//
+//*****************************************************************************
+static uint8_t
+task_wait(void)
+{
+  while (gs_sim_task.running)
+  {
+    SIM868_poll();
+
+    if (gs_sim_task.running)
+    {
+      _sim_idle();
+    }
+  }
+
+  return gs_sim_task.error_status;
+}
+
+//*****************************************************************************
+//
+//! @brief Resumes the running task.
+//!
+//! This function runs the steps of the task up to the next wait, and calls its
+//! completion function once they are done.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+task_resume(void)
+{
+  struct Sim_Task *task = &gs_sim_task;
+
+  if (task->running && task->step(0) == TASK_DONE)
+  {
+    task->running = false;
+
+    if (task->callback)
+    {
+      task->callback(task->error_status, task->context);
+    }
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Sends an AT command of the running task.
+//!
+//! This function queues the command the first time it is called, then it
+//! tells if the task still has to wait for the reply. A full queue is tried
+//! again on the next call.
+//!
+//! @param[in] at       AT command, it must remain valid until completed.
+//! @param[in] time_out Time for waiting the reply in ms.
+//!
+//! @return true/false The task waits for the reply.
+//
+//*****************************************************************************
+static uint8_t
+task_send(char *at, uint16_t time_out)
+{
+  if (gs_sim_task.at_state == TASK_AT_NONE)
+  {
+    if (at_queue(at, 0, time_out, task_at_done, NULL))
+    {
+      return true;
+    }
+    gs_sim_task.at_state = TASK_AT_SENT;
+  }
+
+  return (gs_sim_task.at_state != TASK_AT_DONE);
+}
+
+//*****************************************************************************
+//
+//! @brief Completes an AT command of the running task.
+//!
+//! This function is the callback of the commands sent by the tasks, the task
+//! is resumed at once, while the lines of the reply are still held.
+//!
+//! @param[in] error_status Result of the AT command, it is checked with the
+//!                         lines of the reply.
+//! @param[in] context      Not used.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+task_at_done(uint8_t error_status, void *context)
+{
+  (void)error_status;
+  (void)context;
+
+  gs_sim_task.at_state = TASK_AT_DONE;
+
+  task_resume();
+}
+
+#if SIM868_RTOS
+//*****************************************************************************
+//
+//! @brief Modem task of the RTOS port.
+//!
+//! This function waits for a character, a request or the tick, then it starts
+//! the next request once the last one is done and runs the AT engine.
+//!
+//! @param[in] parameters Not used.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+rtos_task(void *parameters)
+{
+  struct SIM868_Request *request;
+
+  (void)parameters;
+
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SIM868_RTOS_TICK_MS));
+
+    while (gs_rtos_port.active == NULL &&
+           xQueueReceive(gs_rtos_port.queue, &request, 0) == pdPASS)
+    {
+      rtos_start(request);
+    }
+
+    SIM868_poll();
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Starts a request of the RTOS port.
+//!
+//! This function starts the asynchronous function of the request, a request
+//! that can not be started is done at once with the error.
+//!
+//! @param[in] request Request to be started.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+rtos_start(struct SIM868_Request *request)
+{
+  uint8_t error_status;
+
+  gs_rtos_port.active = request;
+
+  switch (request->type)
+  {
+    case SIM868_REQUEST_AT:
+      error_status = SIM868_at_send_async(request->at, request->time_out, rtos_at_done, request);
+    break;
+
+    case SIM868_REQUEST_SIM_CARD_INIT:
+      error_status = SIM868_sim_card_init_async(rtos_done, request);
+    break;
+
+    case SIM868_REQUEST_GPRS_GSM_INIT:
+      error_status = SIM868_gprs_gsm_init_async(rtos_done, request);
+    break;
+
+    case SIM868_REQUEST_GPRS_ENABLE:
+      error_status = SIM868_gprs_enable_async(request->state, rtos_done, request);
+    break;
+
+    case SIM868_REQUEST_HTTP:
+      if (request->json_structure)
+      {
+        SIM868_http_set_json_structure(request->json_structure);
+      }
+      error_status = SIM868_http_send_request_async(request->method, request->max_attempts, rtos_done, request);
+    break;
+
+    default:
+      error_status = ERROR_RTOS;
+  }
+
+  if (error_status)
+  {
+    rtos_done(error_status, request);
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Completes a request of the RTOS port.
+//!
+//! This function keeps the result in the request, copies the Http response
+//! into its reply buffer and notifies the task that posted it.
+//!
+//! @param[in] error_status Result of the request.
+//! @param[in] context      Request completed.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+rtos_done(uint8_t error_status, void *context)
+{
+  struct SIM868_Request *request = context;
+  TaskHandle_t notify = request->notify;
+
+  request->error_status = error_status;
+
+  if (request->type == SIM868_REQUEST_HTTP)
+  {
+    request->status_code = g_http_status_code;
+    request->data_length = g_http_data_length;
+
+    if (request->reply)
+    {
+      SIM868_http_get_response(request->reply, request->length);
+    }
+  }
+
+  gs_rtos_port.active = NULL;
+
+  //
+  //  The request may be released as soon as it is done.
+  //
+  request->done = true;
+  xTaskNotifyGive(notify);
+}
+
+//*****************************************************************************
+//
+//! @brief Completes an AT command request of the RTOS port.
+//!
+//! This function copies the lines of the reply into the reply buffer of the
+//! request, separated by new lines, then it completes the request.
+//!
+//! @param[in] error_status Result of the AT command.
+//! @param[in] context      Request completed.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+rtos_at_done(uint8_t error_status, void *context)
+{
+  struct SIM868_Request *request = context;
+  uint16_t used = 0;
+  uint8_t i;
+
+  if (request->reply && request->length)
+  {
+    request->reply[0] = 0;
+
+    for (i = 0; i < gs_at_engine.line_count && used + 1 < request->length; i++)
+    {
+      used += slice_copy(gs_at_engine.line[i], &request->reply[used], request->length - used);
+      if (used + 1 < request->length)
+      {
+        request->reply[used++] = '\n';
+        request->reply[used] = 0;
+      }
+    }
+  }
+
+  rtos_done(error_status, request);
+}
+#endif
+
+//*****************************************************************************
+//
+//! @brief Returns one character of a slice.
+//!
+//! @param[in] s Slice of the sim ring.
+//! @param[in] i Index of the character.
+//!
+//! @return character.
+//
+//*****************************************************************************
+static char
+slice_char(struct Slice s, uint16_t i)
+{
+  return gs_sim_ring.data[(s.offset + i) % gs_sim_ring.size];
+}
+
+//*****************************************************************************
+//
+//! @brief Checks if a slice starts with a text.
+//!
+//! @param[in] s    Slice of the sim ring.
+//! @param[in] text Null terminated text.
+//!
+//! @return true/false Result of the comparison.
+//
+//*****************************************************************************
+static bool
+slice_starts_with(struct Slice s, char *text)
+{
+  uint16_t i;
+
+  for (i = 0; text[i]; i++)
+  {
+    if (i >= s.length || slice_char(s, i) != text[i])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Checks if a slice is equal to a text.
+//!
+//! @param[in] s    Slice of the sim ring.
+//! @param[in] text Null terminated text.
+//!
+//! @return true/false Result of the comparison.
+//
+//*****************************************************************************
+static bool
+slice_equals(struct Slice s, char *text)
+{
+  return (s.length == strlen(text) && slice_starts_with(s, text));
+}
+
+//*****************************************************************************
+//
+//! @brief Skips the first characters of a slice.
+//!
+//! @param[in] s Slice of the sim ring.
+//! @param[in] n Number of characters to skip.
+//!
+//! @return s Remaining part of the slice.
+//
+//*****************************************************************************
+static struct Slice
+slice_skip(struct Slice s, uint16_t n)
+{
+  if (n > s.length)
+  {
+    n = s.length;
+  }
+
+  s.offset = (s.offset + n) % gs_sim_ring.size;
+  s.length -= n;
+
+  return s;
+}
+
+//*****************************************************************************
+//
+//! @brief Converts the digits at the beginning of a slice.
+//!
+//! @param[in] s Slice of the sim ring.
+//!
+//! @return value Unsigned integer value, zero if there are no digits.
+//
+//*****************************************************************************
+static uint32_t
+slice_to_uint(struct Slice s)
+{
+  uint16_t i = 0;
+  uint32_t value = 0;
+
+  while (i < s.length && slice_char(s, i) == ' ')
+  {
+    i++;
+  }
+
+  for (; i < s.length && slice_char(s, i) >= '0' && slice_char(s, i) <= '9'; i++)
+  {
+    value = (value * 10) + (slice_char(s, i) - '0');
+  }
+
+  return value;
+}
+
+//*****************************************************************************
+//
+//! @brief Converts the hexadecimal digits at the beginning of a slice.
+//!
+//! @param[in] s Slice of the sim ring.
+//!
+//! @return value Unsigned integer value, zero if there are no digits.
+//
+//*****************************************************************************
+static uint32_t
+slice_to_hex(struct Slice s)
+{
+  uint16_t i;
+  uint32_t value = 0;
+  char c;
+
+  for (i = 0; i < s.length; i++)
+  {
+    c = slice_char(s, i);
+    if (c >= '0' && c <= '9')
+    {
+      value = (value << 4) | (c - '0');
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+      value = (value << 4) | (c - 'A' + 10);
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+      value = (value << 4) | (c - 'a' + 10);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  return value;
+}
+
+//*****************************************************************************
+//
+//! @brief Copies a slice into a buffer.
+//!
+//! @param[in]  s      Slice of the sim ring.
+//! @param[out] buffer Buffer where the slice is copied and null terminated.
+//! @param[in]  length Size of the buffer.
+//!
+//! @return length Number of characters copied.
+//
+//*****************************************************************************
+static uint16_t
+slice_copy(struct Slice s, char *buffer, uint16_t length)
+{
+  uint16_t i;
+
+  if (length == 0)
+  {
+    return 0;
+  }
+
+  for (i = 0; i < s.length && i < (length - 1); i++)
+  {
+    buffer[i] = slice_char(s, i);
+  }
+  buffer[i] = 0;
+
+  return i;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns one line of the last reply.
+//!
+//! @param[in] line Index of the line.
+//!
+//! @return line Slice of the line, or null if it does not exist.
+//
+//*****************************************************************************
+static struct Slice *
+reply_line(uint8_t line)
+{
+  if (line >= gs_at_engine.line_count)
+  {
+    return 0;
+  }
+
+  return &gs_at_engine.line[line];
+}
+
+//*****************************************************************************
+//
+//! @brief Finds a line of the last reply.
+//!
+//! @param[in] reply Beginning of the line to be found.
+//!
+//! @return line Slice of the first line that starts with reply, or null if
+//!              none was found.
+//
+//*****************************************************************************
+static struct Slice *
+reply_find(char *reply)
+{
+  uint8_t i;
+
+  for (i = 0; i < gs_at_engine.line_count; i++)
+  {
+    if (slice_starts_with(gs_at_engine.line[i], reply))
+    {
+      return &gs_at_engine.line[i];
+    }
+  }
+
+  return 0;
+}
+
+//*****************************************************************************
+//
+//! @brief Check SIM868 reply.
+//!
+//! This function compares the expected reply with each line of the reply
+//! recieved from the SIM868. The operation is an string comparison.
+//!
+//! @param[in] at       AT command used in mobile applications.
+//! @param[in] reply    Expected reply from the SIM868.
+//! @param[in] time_out Time for exectuing the reading operation.
+//!
+//! @return true/false   Result of an string comparison.
+//
+//*****************************************************************************
+static uint8_t
+send_check_reply(char *at, char *reply, uint16_t time_out)
+{
+    get_reply(at, time_out);
+
+    return reply_check(reply);
+}
+
+//*****************************************************************************
+//
+//! @brief Checks the last reply.
+//!
+//! This function looks for a line of the last reply received from the SIM868.
+//!
+//! @param[in] reply Expected reply from the SIM868.
+//!
+//! @return true/false The reply expected was not received.
+//
+//*****************************************************************************
+static uint8_t
+reply_check(char *reply)
+{
+    uint8_t i;
+
+    for (i = 0; i < gs_at_engine.line_count; i++)
+    {
+      if (slice_equals(gs_at_engine.line[i], reply))
+      {
+        return false;
+      }
+    }
+
+    return true;
+}
+
+//*****************************************************************************
+//
+//! @brief Sends raw data and checks the reply.
+//!
+//! This function is the same as send_check_reply() for data sent after the
+//! data prompt, the data is not followed by a new line.
+//!
+//! @param[in] data     Data to be sent.
+//! @param[in] length   Number of bytes of the data.
+//! @param[in] reply    Reply expected.
+//! @param[in] time_out Time for exectuing the reading operation.
+//!
+//! @return true/false The reply expected was not received.
+//
+//*****************************************************************************
+static uint8_t
+send_check_data(uint8_t *data, uint16_t length, char *reply, uint16_t time_out)
+{
+    if (gs_sim_task.running || at_queue((char *)data, length, time_out, NULL, NULL))
+    {
+      return true;
+    }
+
+    at_wait_idle();
+
+    return reply_check(reply);
+}
+
+//*****************************************************************************
+//
+//! @brief Get reply from SIM868.
+//!
+//! This function sends an specifc AT command to the SIM868 and gets its reply.
+//!
+//! @param[in] at       AT command used in mobile applications.
+//! @param[in] time_out Time for exectuing the reading operation.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+get_reply(char *at, uint16_t time_out)
+{
+    //
+    //  Queue the AT command and run the engine until the reply arrives. The
+    //  replies of a running task would be mixed with it.
+    //
+    if (gs_sim_task.running || SIM868_at_send_async(at, time_out, NULL, NULL))
+    {
+      gs_at_engine.line_count = 0;
+      return;
+    }
+
+    at_wait_idle();
+}
+
+//*****************************************************************************
+//
+//! @brief Parse the SIM868 reply.
+//!
+//! This function parse the SIM868 reply to store the value of identifier within
+//! the string response return.
+//!
+//! @param[in] reply    Expected reply from the SIM868.
+//! @param[in] v        Address were the value is stored.
+//! @param[in] divider  Character delimiter used by the SIM868.
+//! @param[in] index    Index of the character.
+//!
+//! @return error_status Result of the parsing operation, if error_status is
+//!                      equal to false, then the operation was successful, if
+//!                      not, an error occurred.
+//
+//*****************************************************************************
+static uint8_t
+parse_reply(char *reply, uint16_t *v, char divider, uint8_t index)
+{
+    struct Reply_Field field[REPLY_MAX_FIELDS];
+
+    if (index >= REPLY_MAX_FIELDS ||
+        reply_tokenize(reply, divider, field, index + 1) <= index)
+    {
+      return ERROR_REPLY;
+    }
+
+    *v = field[index].value;
+
+    return NO_ERROR;
+}
+
+//*****************************************************************************
+//
+//! @brief Splits a line of the SIM868 reply into typed fields.
+//!
+//! This function scans once the line that starts with reply, and returns each
+//! field found after it. The line is not modified, the fields are slices of
+//! the sim ring. A divider within a quoted string does not end the field.
+//!
+//! @param[in]  reply      Beginning of the line, like "+SAPBR: ".
+//! @param[in]  divider    Character delimiter used by the SIM868.
+//! @param[out] field      Fields found.
+//! @param[in]  max_fields Maximum number of fields to be returned.
+//!
+//! @return count Number of fields found, zero if the line was not found.
+//
+//*****************************************************************************
+static uint8_t
+reply_tokenize(char *reply, char divider, struct Reply_Field *field, uint8_t max_fields)
+{
+    struct Slice *line = reply_find(reply);
+    if (line == 0)
+    {
+      return 0;
+    }
+
+    return slice_tokenize(slice_skip(*line, strlen(reply)), divider, field, max_fields);
+}
+
+//*****************************************************************************
+//
+//! @brief Splits a slice into typed fields.
+//!
+//! @param[in]  p          Slice of the sim ring, after the prefix of the line.
+//! @param[in]  divider    Character delimiter used by the SIM868.
+//! @param[out] field      Fields found.
+//! @param[in]  max_fields Maximum number of fields to be returned.
+//!
+//! @return count Number of fields found.
+//
+//*****************************************************************************
+static uint8_t
+slice_tokenize(struct Slice p, char divider, struct Reply_Field *field, uint8_t max_fields)
+{
+    uint8_t count = 0;
+    uint8_t numeric, octet_digits, dots;
+    uint16_t i = 0;
+    uint16_t start, octet;
+    struct Reply_Field *f;
+    char c;
+
+    while (count < max_fields)
+    {
+      f = &field[count++];
+      f->type = FIELD_EMPTY;
+      f->value = 0;
+
+      while (i < p.length && slice_char(p, i) == ' ')
+      {
+        i++;
+      }
+
+      if (i < p.length && slice_char(p, i) == '"')
+      {
+        //
+        //  Quoted string, it is an IP if it is made of four octets.
+        //
+        start = ++i;
+        octet = 0;
+        octet_digits = 0;
+        dots = 0;
+        numeric = true;
+        for (; i < p.length && (c = slice_char(p, i)) != '"'; i++)
+        {
+          if (c >= '0' && c <= '9' && octet_digits < 3)
+          {
+            octet = (octet * 10) + (c - '0');
+            octet_digits++;
+          }
+          else if (c == '.' && octet_digits && dots < 3)
+          {
+            f->value = (f->value << 8) | octet;
+            octet = 0;
+            octet_digits = 0;
+            dots++;
+          }
+          else
+          {
+            numeric = false;
+          }
+          if (octet > 255)
+          {
+            numeric = false;
+          }
+        }
+        f->text = slice_skip(p, start);
+        f->text.length = i - start;
+
+        if (numeric && dots == 3 && octet_digits)
+        {
+          f->type = FIELD_IP;
+          f->value = (f->value << 8) | octet;
+        }
+        else
+        {
+          f->type = FIELD_STRING;
+          f->value = 0;
+        }
+
+        //
+        //  Skip the closing quote and up to the divider.
+        //
+        while (i < p.length && slice_char(p, i) != divider)
+        {
+          i++;
+        }
+      }
+      else
+      {
+        start = i;
+        numeric = true;
+        for (; i < p.length && (c = slice_char(p, i)) != divider; i++)
+        {
+          if (c >= '0' && c <= '9')
+          {
+            f->value = (f->value * 10) + (c - '0');
+          }
+          else if (c != ' ')
+          {
+            numeric = false;
+          }
+        }
+        f->text = slice_skip(p, start);
+        f->text.length = i - start;
+
+        if (f->text.length)
+        {
+          f->type = numeric ? FIELD_NUMBER : FIELD_TEXT;
+        }
+      }
+
+      if (i >= p.length)
+      {
+        break;
+      }
+
+      //
+      //  Skip the divider.
+      //
+      i++;
+    }
+
+    return count;
+}
+
+//*****************************************************************************
+//
+//! @brief Parses a character of the GNSS output.
+//!
+//! This function runs the NMEA parser one character at a time, so it can be
+//! restarted at any point of a sentence. A '$' always starts a new sentence,
+//! and a sentence is only committed to the fix when its checksum is valid.
+//!
+//! @param[in] incoming_char Character received.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+nmea_process_char(char incoming_char)
+{
+  struct NMEA_Parser *p = &gs_nmea_parser;
+  uint8_t digit;
+
+  if (incoming_char == '$')
+  {
+    p->state = NMEA_FIELDS;
+    p->sentence = NMEA_UNKNOWN;
+    p->field = 0;
+    p->checksum = 0;
+    p->digits = 0;
+    p->letter = 0;
+    p->fix = gs_gnss_fix;
+    return;
+  }
+
+  switch (p->state)
+  {
+    case NMEA_FIELDS:
+      if (incoming_char == '*')
+      {
+        nmea_end_field();
+        p->state = NMEA_CHECKSUM;
+        p->received = 0;
+        p->received_digits = 0;
+        return;
+      }
+      if (incoming_char == '\r' || incoming_char == '\n')
+      {
+        //
+        //  Sentence without checksum.
+        //
+        p->state = NMEA_IDLE;
+        return;
+      }
+
+      p->checksum ^= (uint8_t)incoming_char;
+
+      if (incoming_char == ',')
+      {
+        nmea_end_field();
+        if (p->sentence == NMEA_UNKNOWN || ++p->field > NMEA_MAX_FIELDS)
+        {
+          p->state = NMEA_IDLE;
+          return;
+        }
+        p->value = 0;
+        p->decimals = 0;
+        p->digits = 0;
+        p->point = false;
+        p->negative = false;
+        p->letter = 0;
+      }
+      else if (p->field == 0)
+      {
+        if (p->digits < NMEA_ADDRESS_LENGTH)
+        {
+          p->address[p->digits] = incoming_char;
+        }
+        p->digits++;
+      }
+      else if (incoming_char >= '0' && incoming_char <= '9')
+      {
+        //
+        //  Decimals beyond NMEA_MAX_DECIMALS are truncated.
+        //
+        if ((!p->point || p->decimals < NMEA_MAX_DECIMALS) &&
+            p->value < (INT32_MAX / 10))
+        {
+          p->value = (p->value * 10) + (uint8_t)(incoming_char - '0');
+          p->decimals += p->point;
+        }
+        p->digits++;
+      }
+      else if (incoming_char == '.')
+      {
+        p->point = true;
+      }
+      else if (incoming_char == '-' && !p->digits)
+      {
+        p->negative = true;
+      }
+      else if (!p->letter)
+      {
+        p->letter = incoming_char;
+      }
+      break;
+
+    case NMEA_CHECKSUM:
+      if (incoming_char >= '0' && incoming_char <= '9')
+      {
+        digit = incoming_char - '0';
+      }
+      else if (incoming_char >= 'A' && incoming_char <= 'F')
+      {
+        digit = incoming_char - 'A' + 10;
+      }
+      else
+      {
+        p->state = NMEA_IDLE;
+        return;
+      }
+
+      p->received = (p->received << 4) | digit;
+      if (++p->received_digits == 2)
+      {
+        if (p->received == p->checksum && p->sentence != NMEA_UNKNOWN)
+        {
+          p->fix.satellites_in_view = p->in_view[0] + p->in_view[1];
+          gs_gnss_fix = p->fix;
+          if (p->sentence == NMEA_RMC || p->sentence == NMEA_ZDA)
+          {
+            time_sync(&gs_gnss_fix);
+          }
+        }
+        p->state = NMEA_IDLE;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Stores the field just received in the fix of the parser.
+//!
+//! Empty fields are skipped, so the fix keeps the last value reported.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+nmea_end_field(void)
+{
+  struct NMEA_Parser *p = &gs_nmea_parser;
+  struct GNSS_Fix *fix = &p->fix;
+
+  if (p->field == 0)
+  {
+    nmea_identify();
+    return;
+  }
+
+  if (!p->digits && !p->letter)
+  {
+    return;
+  }
+
+  switch (p->sentence)
+  {
+    //
+    //  $--RMC,time,status,lat,N/S,lon,E/W,speed,course,date,...
+    //
+    case NMEA_RMC:
+      if (p->field == 1)
+      {
+        nmea_time(&fix->time, false);
+      }
+      else if (p->field == 2)
+      {
+        fix->valid = (p->letter == 'A');
+      }
+      else if (p->field <= 6)
+      {
+        nmea_position(p->field - 3);
+      }
+      else if (p->field == 7)
+      {
+        fix->speed_cms = nmea_speed();
+      }
+      else if (p->field == 8)
+      {
+        fix->course = nmea_fixed(2);
+      }
+      else if (p->field == 9)
+      {
+        nmea_time(&fix->time, true);
+      }
+      break;
+
+    //
+    //  $--GGA,time,lat,N/S,lon,E/W,quality,satellites,hdop,altitude,...
+    //
+    case NMEA_GGA:
+      if (p->field == 1)
+      {
+        nmea_time(&fix->time, false);
+      }
+      else if (p->field <= 5)
+      {
+        nmea_position(p->field - 2);
+      }
+      else if (p->field == 6)
+      {
+        fix->quality = nmea_fixed(0);
+      }
+      else if (p->field == 7)
+      {
+        fix->satellites = nmea_fixed(0);
+      }
+      else if (p->field == 8)
+      {
+        fix->hdop = nmea_fixed(2);
+      }
+      else if (p->field == 9)
+      {
+        fix->altitude = nmea_fixed(2);
+      }
+      break;
+
+    //
+    //  $--GSA,selection,mode,12 x satellite,pdop,hdop,vdop
+    //
+    case NMEA_GSA:
+      if (p->field == 2)
+      {
+        fix->mode = nmea_fixed(0);
+      }
+      else if (p->field == 16)
+      {
+        fix->hdop = nmea_fixed(2);
+      }
+      break;
+
+    //
+    //  $--GSV,messages,message,satellites in view,...
+    //
+    case NMEA_GSV:
+      if (p->field == 3)
+      {
+        p->in_view[p->talker] = nmea_fixed(0);
+      }
+      break;
+
+    //
+    //  $--VTG,course,T,course,M,speed,N,speed,K
+    //
+    case NMEA_VTG:
+      if (p->field == 1)
+      {
+        fix->course = nmea_fixed(2);
+      }
+      else if (p->field == 5)
+      {
+        fix->speed_cms = nmea_speed();
+      }
+      break;
+
+    //
+    //  $--ZDA,time,day,month,year,zone hours,zone minutes
+    //
+    case NMEA_ZDA:
+      if (p->field == 1)
+      {
+        nmea_time(&fix->time, false);
+      }
+      else if (p->field == 2)
+      {
+        fix->time.day = nmea_fixed(0);
+      }
+      else if (p->field == 3)
+      {
+        fix->time.month = nmea_fixed(0);
+      }
+      else if (p->field == 4)
+      {
+        fix->time.year = nmea_fixed(0) % 100;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+//*****************************************************************************
+//
+//! @brief Identifies the sentence from its address.
+//!
+//! The talker identifier is ignored, except to tell apart the satellites in
+//! view of GLONASS from the other constellations.
+//!
+//! @return None.
+//
+//*****************************************************************************
+static void
+nmea_identify(void)
+{
+  struct NMEA_Parser *p = &gs_nmea_parser;
+  char *type = &p->address[2];
+
+  p->sentence = NMEA_UNKNOWN;
+  if (p->digits != NMEA_ADDRESS_LENGTH)
+  {
+    return;
+  }
+
+  p->talker = (p->address[1] == 'L');
+
+  if (!strncmp(type, "RMC", 3))
+  {
+    p->sentence = NMEA_RMC;
+  }
+  else if (!strncmp(type, "GGA", 3))
+  {
+    p->sentence = NMEA_GGA;
+  }
+  else if (!strncmp(type, "GSA", 3))
+  {
+    p->sentence = NMEA_GSA;
+  }
+  else if (!strncmp(type, "GSV", 3))
+  {
+    p->sentence = NMEA_GSV;
+  }
+  else if (!strncmp(type, "VTG", 3))
+  {
+    p->sentence = NMEA_VTG;
+  }
+  else if (!strncmp(type, "ZDA", 3))
+  {
+    p->sentence = NMEA_ZDA;
+  }
 }
 
 //*****************************************************************************
 //
-//! @brief Start an Http session.
-//!
-//! This function start an Http session for the requested method and downloads.
-//! the data returned from the server.
+//! @brief Stores a field of the position.
 //!
-//! @param[in] method   Http request method (POST/GET).
+//! @param[in] field Index of the field within the position, 0 latitude,
+//!                  1 N/S, 2 longitude and 3 E/W.
 //!
-//! @return error_status Result of the Http operation, if error_status is equal
-//!                      to false, then the operation was successful, if not,
-//!                      an error occurred.
+//! @return None.
 //
 //*****************************************************************************
-static uint8_t
-http_start(uint8_t method)
+static void
+nmea_position(uint8_t field)
 {
-    //
-    //  Http Request session start.
-    //
-    error_status = http_action(30000, method);
-    if (error_status)
-    {
-      return error_status;
-    }
+  struct NMEA_Parser *p = &gs_nmea_parser;
+  int32_t number;
+  int32_t degrees;
 
+  if (field == 1 && p->letter == 'S')
+  {
+    p->fix.lat = -p->fix.lat;
+  }
+  else if (field == 3 && p->letter == 'W')
+  {
+    p->fix.lon = -p->fix.lon;
+  }
+  else if (field == 0 || field == 2)
+  {
     //
-    //  Http response data.
+    //  Convert from degrees and minutes (dddmm.mmmmm) to microdegrees,
+    //  one hundred-thousandth of minute is 1/6 of microdegree.
     //
-    error_status = http_read_all();
-    if (error_status)
+    number = nmea_fixed(NMEA_COORDINATE_DECIMALS);
+    degrees = number / 10000000;
+    number -= degrees * 10000000;
+    number = (degrees * 1000000) + ((number + 3) / 6);
+
+    if (field == 0)
     {
-      return error_status;
+      p->fix.lat = number;
     }
-
-    //
-    //  Terminate Http service.
-    //
-    if(send_check_reply("AT+HTTPTERM", "OK", DEFAULT_TIMEOUT))
+    else
     {
-      return ERROR_REPLY;
+      p->fix.lon = number;
     }
-
-    _debug_printf("HTTP request, done!\r\n\r\n");
-    _debug_delay(DEBUG_SHORT_DELAY);
-
-    return NO_ERROR;
+  }
 }
 
 //*****************************************************************************
 //
-//! @brief Read a new line.
+//! @brief Stores a time (hhmmss.sss) or date (ddmmyy) field.
 //!
-//! This function reads a new line coming from the SIM868 serial port.
+//! The milliseconds of the time are stored in the fix of the parser.
 //!
-//! @param[in] time_out Time for exectuing the reading operation.
-//! @param[in] lines    Number of lines to be read.
+//! @param[out] time Date and time to be updated.
+//! @param[in]  date The field is the date.
 //!
 //! @return None.
 //
 //*****************************************************************************
 static void
-read_line(uint16_t time_out, uint8_t lines)
+nmea_time(struct GNSS_Data_Time *time, uint8_t date)
 {
-  uint8_t reply_idx = 0;
+  uint32_t number;
 
-  //
-  //  Read the SIM868 serial port until time_out
-  //  is zero or the sim buffer is full.
-  //
-  while (time_out--)
+  if (date)
   {
-    if (reply_idx > REPLY_BUFFER_LENGTH)
-    {
-      break;
-    }
-
-    while(_sim_data_available())
-    {
-      char incoming_char =  _sim_read_buffer();
-
-      //
-      //  Ignore the carriage return.
-      //
-      if (incoming_char == '\r')
-      {
-        continue;
-      }
-
-      if (incoming_char == '\n')
-      {
-        //
-        //  Ignore the first new line.
-        //
-        if (reply_idx == 0)
-        {
-          continue;
-        }
-        //
-        // The second new line is the end of the line.
-        //
-        if (!lines)
-        {
-            time_out = 0;
-            break;
-        }
-      }
-
-      //
-      //  Store the incoming characters in the buffer.
-      //
-      g_sim_buffer[reply_idx] = incoming_char;
-      reply_idx++;
-    }
-
-    if (time_out == 0)
-    {
-      break;
-    }
-
-    _debug_delay(1);
+    number = nmea_fixed(0);
+    time->day = number / 10000;
+    time->month = (number / 100) % 100;
+    time->year = number % 100;
+  }
+  else
+  {
+    number = nmea_fixed(3);
+    time->hour = number / 10000000;
+    time->minutes = (number / 100000) % 100;
+    time->seconds = (number / 1000) % 100;
+    gs_nmea_parser.fix.time_ms = number % 1000;
   }
-
-  //
-  //  Close the string with a null character.
-  //
-  g_sim_buffer[reply_idx] = 0;
 }
 
 //*****************************************************************************
 //
-//! @brief Check SIM868 reply.
+//! @brief Returns the speed in knots of the field just received in cm/s.
 //!
-//! This function compares the expected reply with the reply recieved from
-//! the SIM868. The operation is an string comparison.
+//! One knot is 1852/3600 m/s, that is 463/9 cm/s.
 //!
-//! @param[in] at       AT command used in mobile applications.
-//! @param[in] reply    Expected reply from the SIM868.
-//! @param[in] time_out Time for exectuing the reading operation.
+//! @return speed in cm/s.
+//
+//*****************************************************************************
+static uint16_t
+nmea_speed(void)
+{
+  uint32_t knots = nmea_fixed(NMEA_SPEED_DECIMALS);
+
+  return ((knots * 463) + 4500) / 9000;
+}
+
+//*****************************************************************************
+//
+//! @brief Returns the number of the field just received in fixed point.
 //!
-//! @return true/false   Result of an string comparison.
+//! @param[in] decimals Number of decimals of the result, the extra decimals of
+//!                     the field are truncated.
+//!
+//! @return number multiplied by 10^decimals.
 //
 //*****************************************************************************
-static uint8_t
-send_check_reply(char *at, char *reply, uint16_t time_out)
+static int32_t
+nmea_fixed(uint8_t decimals)
 {
-    get_reply(at, time_out);
-    return (!(strcmp(g_sim_buffer, reply) == 0));
+  int32_t number = gs_nmea_parser.value;
+  uint8_t i;
+
+  for (i = gs_nmea_parser.decimals; i < decimals; i++)
+  {
+    number *= 10;
+  }
+  for (i = decimals; i < gs_nmea_parser.decimals; i++)
+  {
+    number /= 10;
+  }
+
+  return gs_nmea_parser.negative ? -number : number;
 }
 
 //*****************************************************************************
 //
-//! @brief Get reply from SIM868.
+//! @brief Syncs the RTC to the time of a sentence.
 //!
-//! This function sends an specifc AT command to the SIM868 and gets its reply.
+//! This function is called for each RMC or ZDA sentence with a valid
+//! checksum. The sentences of the same second only sync the RTC once, and the
+//! host RTC is set when the time drifts from the last sync.
 //!
-//! @param[in] at       AT command used in mobile applications.
-//! @param[in] time_out Time for exectuing the reading operation.
+//! @param[in] fix Fix updated with the sentence.
 //!
 //! @return None.
 //
 //*****************************************************************************
 static void
-get_reply(char *at, uint16_t time_out)
+time_sync(struct GNSS_Fix *fix)
 {
-    _sim_clear_buffer();
+  uint32_t now = _sys_tick_ms();
+  uint32_t seconds;
+  uint32_t elapsed;
 
-    //
-    //  Print AT command.
-    //
-    #ifdef  AT_DEBUG
-        _debug_printf("\t---> ");
-        _debug_printf(at);
-        _debug_printf("\r\n");
-    #endif
+  //
+  //  The time is reported before the date is known.
+  //
+  if (!time_has_date(&fix->time))
+  {
+    return;
+  }
 
-    //
-    //  Send AT command.
-    //
-    _sim_send_data(at);
-    _sim_send_data("\r\n");
+  seconds = time_seconds(&fix->time);
+  if (gs_time_sync.valid && seconds == gs_time_sync.seconds)
+  {
+    return;
+  }
 
-    //
-    //  Get reply -> SINGLE_LINE.
-    //
-    read_line(time_out, SINGLE_LINE);
+  elapsed = (uint32_t)(now - gs_time_sync.synced_at) + gs_time_sync.ms;
+  if (!gs_time_sync.valid || gs_time_sync.seconds + (elapsed / 1000) != seconds)
+  {
+    _rtc_set(seconds);
+  }
 
-    //
-    //  Print reply received.
-    //
-    #ifdef  AT_DEBUG
-        _debug_printf("\t<--- ");
-        _debug_printf(g_sim_buffer);
-        _debug_printf("\r\n\r\n");
-    #endif
+  //
+  //  The sentences are sent after the pulse of the second they report.
+  //
+  if (gs_time_sync.pps && (uint32_t)(now - gs_time_sync.pps_at) < 1000)
+  {
+    gs_time_sync.synced_at = gs_time_sync.pps_at;
+    gs_time_sync.ms = 0;
+  }
+  else
+  {
+    gs_time_sync.synced_at = now;
+    gs_time_sync.ms = fix->time_ms;
+  }
+
+  gs_time_sync.seconds = seconds;
+  gs_time_sync.valid = true;
 }
 
 //*****************************************************************************
 //
-//! @brief Send a parsing request.
-//!
-//! This function gets the reply of the SIM868 and sends a parsing request to
-//! retrieve an identifier within the string response returned.
+//! @brief Returns if a date and time has a valid date.
 //!
-//! @param[in] at       AT command used in mobile applications.
-//! @param[in] reply    Expected reply from the SIM868.
-//! @param[in] v        Address were the value is stored.
-//! @param[in] divider  Character delimiter used by the SIM868.
-//! @param[in] index    Index of the character.
-//! @param[in] time_out Time for exectuing the reading operation.
+//! @param[in] time Date and time, the date is zero until it is reported.
 //!
-//! @return error_status Result of the requested operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @return true/false The day and the month are valid.
 //
 //*****************************************************************************
 static uint8_t
-send_parse_reply(char *at, char *reply, uint16_t *v, char divider, uint8_t index, uint16_t time_out)
+time_has_date(struct GNSS_Data_Time *time)
 {
-    get_reply(at, time_out);
-
-    if (parse_reply(reply, v, divider, index)) return ERROR_REPLY;
-
-    return NO_ERROR;
+  return (time->day != 0 && time->month != 0 && time->month <= 12);
 }
 
 //*****************************************************************************
 //
-//! @brief Parse the SIM868 reply.
-//!
-//! This function parse the SIM868 reply to store the value of identifier within
-//! the string response return.
+//! @brief Converts UTC seconds to the local time.
 //!
-//! @param[in] reply    Expected reply from the SIM868.
-//! @param[in] v        Address were the value is stored.
-//! @param[in] divider  Character delimiter used by the SIM868.
-//! @param[in] index    Index of the character.
+//! @param[in] seconds UTC seconds since 2000-01-01 00:00:00.
 //!
-//! @return error_status Result of the parsing operation, if error_status is
-//!                      equal to false, then the operation was successful, if
-//!                      not, an error occurred.
+//! @return seconds Local seconds since 2000-01-01 00:00:00, zero for the
+//!                 times before it.
 //
 //*****************************************************************************
-static uint8_t
-parse_reply(char *reply, uint16_t *v, char divider, uint8_t index)
+static uint32_t
+time_local(uint32_t seconds)
 {
-    uint8_t i;
-
-    //
-    //  get the pointer
-    //
-    char *p = strstr(g_sim_buffer, reply);
-    if (p == 0)
-    {
-      return ERROR_REPLY;
-    }
-
-    //
-    //  point to the result
-    //
-    p += strlen(reply);
-    for (i=0; i<index; i++)
-    {
-        //
-        //  increment dividers
-        //
-        p = strchr(p, divider);
-        if (!p)
-        {
-          return ERROR_REPLY;
-        }
-        p++;
-    }
-
-    //
-    //  get always the first value
-    //
-    if(strlen(p) > 1)
-    {
-      p = strtok(p, ",");
-    }
+  int32_t offset = (int32_t)gs_time_sync.zone * 60;
 
-    *v = atoi(p);
+  if (offset < 0 && seconds < (uint32_t)-offset)
+  {
+    return 0;
+  }
 
-    return NO_ERROR;
+  return seconds + offset;
 }
 
 //*****************************************************************************
 //
-//! @brief Read the output of the GNSS serial port.
+//! @brief Converts a date and time to seconds.
 //!
-//! This function stores in a buffer the $GNRMC output, one of the eight NMEA
-//! data outputs that the the serial port returns when is read. This funtion
-//! also determines whether  or not the data is valid (fixed).
+//! @param[in] time Date and time, the year is from 2000 to 2099.
 //!
-//! @return None.
+//! @return seconds Seconds since 2000-01-01 00:00:00.
 //
 //*****************************************************************************
-static void
-gnss_read_data(void)
+static uint32_t
+time_seconds(struct GNSS_Data_Time *time)
 {
-  uint8_t cnt = 0;
-  uint8_t gnss_idx = 0;
-  char incoming_char;
-  char *delimiter = ",";
-
-  //
-  //  $GNRMC flags.
-  //
-  uint8_t gnrmcR = false;
-  uint8_t gnrmcM = false;
-  uint8_t gnrmcC = false;
-
-  //
-  //  Clear all old data from gnss buffer.
-  //
-  _gnss_clear_buffer();
+  uint32_t days;
+  uint8_t i;
 
   //
-  //  Wait until one of the eight NMEA data
-  //  outputs ($GNRMC) has been recieved.
+  //  Every fourth year is a leap year from 2000 to 2099, 2000 included.
   //
-  while(1)
+  days = (365UL * time->year) + ((time->year + 3) / 4);
+  for (i = 1; i < time->month && i <= 12; i++)
   {
-    if(_gnss_data_available())
-    {
-      //
-      //  Read imcoming data.
-      //
-      incoming_char =  _gnss_read_buffer();
-
-      if(!gnrmcC)
-      {
-        //
-        //  Check if the 'R' char of $GNRMC was recieved.
-        //
-        if(incoming_char == 0x52)
-        {
-          gnrmcR = true;
-        }
-
-        //
-        //  Check if the 'M' char of $GNRMC was recieved.
-        //
-        if(incoming_char == 0x4D && gnrmcR)
-        {
-          gnrmcM = true;
-        }
-
-        //
-        //  Check if the 'C' char of $GNRMC was recieved.
-        //
-        if(incoming_char == 0x43 && gnrmcM)
-        {
-          gnrmcC = true;
-        }
-      }
-
-      //
-      //  If the $GNRMC output has been founded, then get
-      //   the data fix status, and the output into gnss buffer.
-      //
-      if(gnrmcC)
-      {
-        //
-        //  End of $GNRMC output.
-        //
-        if(incoming_char == 0x0D)
-        {
-          break;
-        }
-
-        //
-        //  Check if data is valid (fixed),
-        //  'A' -> OK.
-        //  'V' -> Invalid.
-        //
-        if(incoming_char == 0x56)
-        {
-          g_gnss_is_data_fixed  = false;
-          break;
-        }
-        else if(incoming_char == 0x41)
-        {
-          if(cnt++ == 30)
-          {
-            g_gnss_is_data_fixed = true;
-          }
-        }
-
-        //
-        //  Store each character read in the buffer.
-        //
-        g_gnss_buffer[gnss_idx++] = incoming_char;
-      }
-    }
+    days += g_last_day_month[i];
   }
+  if (time->month > 2 && (time->year % 4) == 0)
+  {
+    days++;
+  }
+  if (time->day)
+  {
+    days += time->day - 1;
+  }
+
+  return (days * 86400UL) + ((uint32_t)time->hour * 3600) + ((uint32_t)time->minutes * 60) + time->seconds;
 }
 
 //*****************************************************************************
 //
-//! @brief Delay in seconds.
+//! @brief Converts seconds to a date and time.
 //!
-//! This function delays the program exectuing for an specific number of
-//! seconds.
+//! @param[out] time    Date and time, the year is from 2000 to 2099.
+//! @param[in]  seconds Seconds since 2000-01-01 00:00:00.
 //!
 //! @return None.
 //
 //*****************************************************************************
 static void
-delay_seconds(uint8_t seconds)
+time_date(struct GNSS_Data_Time *time, uint32_t seconds)
 {
-    uint8_t cnt;
-    for(cnt = 0; cnt < seconds; cnt++)
+  uint32_t days = seconds / 86400;
+  uint16_t length;
+  uint8_t year;
+  uint8_t month;
+
+  time->seconds = seconds % 60;
+  time->minutes = (seconds / 60) % 60;
+  time->hour = (seconds / 3600) % 24;
+
+  //
+  //  Every block of four years has 1461 days, the first year is a leap year.
+  //
+  year = (days / 1461) * 4;
+  days %= 1461;
+  while (days >= (length = (year % 4) ? 365 : 366))
+  {
+    days -= length;
+    year++;
+  }
+
+  for (month = 1; month < 12; month++)
+  {
+    length = g_last_day_month[month] + (month == 2 && (year % 4) == 0);
+    if (days < length)
     {
-        _debug_delay(DEBUG_SHORT_DELAY);
+      break;
     }
+    days -= length;
+  }
+
+  time->year = year;
+  time->month = month;
+  time->day = days + 1;
 }
@@ -24,43 +24,202 @@
 //
 //*****************************************************************************
 
+//
+//  Port header, set SIM868_PORT_HEADER to a header that defines the hardware
+//  API of another target to build the library without editing this file,
+//  e.g. -DSIM868_PORT_HEADER='"sim868_port_host.h"' for a host build with a
+//  simulator of the SIM868. Each group below that the port header defines
+//  (by its first macro) is skipped, the other groups keep these definitions.
+//
+#ifdef SIM868_PORT_HEADER
+#include SIM868_PORT_HEADER
+#endif
+
 //
 //  SIM868 UART Interface
 //
+#ifndef _sim_data_available
 #define _sim_data_available()                       (SIM868_GetRxBufferSize() > 0)
 #define _sim_read_buffer()                          SIM8868_GetChar()
 #define _sim_clear_buffer()                         SIM868_ClearRxBuffer()
 #define _sim_send_data(...)                         SIM868_PutString(__VA_ARGS__)
+#define _sim_send_array(...)                        SIM868_PutArray(__VA_ARGS__)
+#endif
+#define SIM868_BAUD_RATE                            115200
 
 //
 //  SIM868 Power Control GPIO
 //
+#ifndef _sim_state
 #define _sim_state()                                SIM_STATE_Read()
 #define _sim_pwm(...)                               SIM_POWER_Write(__VA_ARGS__)
+#define _sim_dtr(...)                               SIM_DTR_Write(__VA_ARGS__)
+#endif
 
 //
 //  GNSS UART Interface
 //
+#ifndef _gnss_data_available
 #define _gnss_data_available()                      (GNSS_GetRxBufferSize() > 0)
 #define _gnss_read_buffer()                         GNSS_GetChar()
 #define _gnss_clear_buffer()                        GNSS_ClearRxBuffer()
+#endif
 
 //
 //  GNSS Power Control GPIO
 //
+#ifndef _gnss_enable
 #define _gnss_enable(...)                           GNSS_ENABLE_Write(__VA_ARGS__)
+#endif
 
 //
 //  DEBUGGING UART Interface
+//  SIM868_LOG_LEVEL selects what is printed, SIM868_LOG_NONE for production
+//  builds, SIM868_LOG_INFO for the progress messages, and SIM868_LOG_AT to
+//  also trace each AT command and its reply (AT_DEBUG).
 //
+#define SIM868_LOG_NONE                             0
+#define SIM868_LOG_INFO                             1
+#define SIM868_LOG_AT                               2
+
+#ifndef SIM868_LOG_LEVEL
+#define SIM868_LOG_LEVEL                            SIM868_LOG_AT
+#endif
+
+#if SIM868_LOG_LEVEL >= SIM868_LOG_AT
 #define AT_DEBUG
-#define _debug_printf(...)                          DEBUGGER_PutString(__VA_ARGS__)
+#endif
+
+#ifndef _debug_put_string
+#define _debug_put_string(...)                      DEBUGGER_PutString(__VA_ARGS__)
+#endif
+
+#if SIM868_LOG_LEVEL >= SIM868_LOG_INFO
+#define _debug_printf(...)                          _debug_put_string(__VA_ARGS__)
+#else
+#define _debug_printf(...)
+#endif
 
 //
 //  Delay function from the hosting MCU,
 //  the function should provide a delay in ms.
+//  The pauses only there to read the debugging output are removed with the
+//  progress messages.
 //
+#ifndef _debug_delay
 #define _debug_delay(...)                           CyDelay(__VA_ARGS__)
+#endif
+
+#if SIM868_LOG_LEVEL >= SIM868_LOG_INFO
+#define _debug_pause(...)                           _debug_delay(__VA_ARGS__)
+#else
+#define _debug_pause(...)
+#endif
+
+//
+//  Trace buffer of the AT commands, kept in the retention RAM for post-mortem
+//  analysis, set SIM868_TRACE_LENGTH to the number of entries, zero to remove
+//  it.
+//
+#ifndef SIM868_TRACE_LENGTH
+#define SIM868_TRACE_LENGTH                         0
+#endif
+
+//
+//  Counters of the AT commands and of the Http requests, set SIM868_STATS to
+//  zero to remove them.
+//
+#ifndef SIM868_STATS
+#define SIM868_STATS                                1
+#endif
+
+//
+//  Size of the receive ring of the GNSS serial port filled by
+//  SIM868_gnss_rx_handler(), it should hold the output of one second, about
+//  560 characters for the RMC, GGA, GSA and GSV sentences, between two
+//  calls of SIM868_gnss_poll() or SIM868_poll().
+//
+#ifndef SIM868_GNSS_RX_LENGTH
+#define SIM868_GNSS_RX_LENGTH                       1024
+#endif
+
+//
+//  Tick counter from the hosting MCU,
+//  the function should return a free-running counter in ms.
+//
+#ifndef _sys_tick_ms
+#define _sys_tick_ms()                              SYSTICK_GetMs()
+#endif
+
+//
+//  Real time clock from the hosting MCU, it is set with the UTC seconds since
+//  2000-01-01 when the time of the GNSS drifts from the time service. It can
+//  be left empty, the time service keeps the time with the tick.
+//
+#ifndef _rtc_set
+#define _rtc_set(seconds)
+#endif
+
+//
+//  Offset from UTC in minutes of the local time, of the date and time of the
+//  fixes and of SIM868_time_get_local(), until SIM868_time_set_zone() is
+//  called.
+//
+#ifndef SIM868_TIME_ZONE
+#define SIM868_TIME_ZONE                            (-360)
+#endif
+
+//
+//  Flash memory from the hosting MCU for the store of the reports, the
+//  functions should read, program and erase a sector of the sectors given
+//  below, and return zero on success. An erased byte reads 0xFF and it is
+//  programmed only once. SIM868_STORE_SECTORS should be at least two, one is
+//  erased when the log is full. Set it to zero to remove the store.
+//
+#ifndef _flash_read
+#define _flash_read(...)                            FLASH_Read(__VA_ARGS__)
+#define _flash_write(...)                           FLASH_Write(__VA_ARGS__)
+#define _flash_erase(...)                           FLASH_EraseSector(__VA_ARGS__)
+#endif
+#define SIM868_STORE_ADDRESS                        0x00038000UL
+#define SIM868_STORE_SECTOR_SIZE                    1024
+
+#ifndef SIM868_STORE_SECTORS
+#define SIM868_STORE_SECTORS                        0
+#endif
+
+//
+//  Retention RAM from the hosting MCU, the variables placed in it should not
+//  be initialized at startup, so they survive a reset of the MCU.
+//
+#ifndef SIM868_RETAINED
+#define SIM868_RETAINED                             __attribute__((section(".noinit")))
+#endif
+
+//
+//  RTOS port, set SIM868_RTOS to one to run the AT engine in a FreeRTOS modem
+//  task created by SIM868_rtos_init(). The other tasks post requests to it
+//  instead of calling the API, and the UART interrupt calls
+//  SIM868_rtos_rx_isr(). The blocking functions of the modem task sleep with
+//  _sim_idle() instead of spinning. Without the RTOS port, a port header can
+//  define _sim_idle() to run a simulator of the SIM868 while they wait.
+//
+#ifndef SIM868_RTOS
+#define SIM868_RTOS                                 0
+#endif
+
+#if SIM868_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#define SIM868_RTOS_QUEUE_LENGTH                    8
+#define SIM868_RTOS_STACK_SIZE                      512
+#define SIM868_RTOS_PRIORITY                        (tskIDLE_PRIORITY + 2)
+#define SIM868_RTOS_TICK_MS                         10
+#define _sim_idle()                                 ulTaskNotifyTake(pdTRUE, 1)
+#elif !defined(_sim_idle)
+#define _sim_idle()
+#endif
 
 //*****************************************************************************
 //
@@ -78,12 +237,237 @@ enum Bearer_Service_Provider
     MOVISTAR
 };
 
+//*****************************************************************************
+//
+//  The following are the transport protocols of the socket.
+//
+//*****************************************************************************
+
+#define SIM868_SOCKET_TCP                           0
+#define SIM868_SOCKET_UDP                           1
+
+//*****************************************************************************
+//
+//  The following is a request to the modem task of the RTOS port, it must
+//  remain valid until the task that posted it is notified.
+//  Type: SIM868_REQUEST_AT, SIM868_REQUEST_SIM_CARD_INIT,
+//  SIM868_REQUEST_GPRS_GSM_INIT, SIM868_REQUEST_GPRS_ENABLE or
+//  SIM868_REQUEST_HTTP.
+//  At/Time out: AT command and time for waiting its reply in ms.
+//  State: ON/OFF for SIM868_REQUEST_GPRS_ENABLE.
+//  Method/Max attempts/Json structure: Http request, the json structure is
+//  only used by the POST method.
+//  Reply/Length: Buffer where the lines of the AT reply, or the Http
+//  response, are copied, it can be null.
+//  Error status: Result of the request.
+//  Status code/Data length: Result of the Http request, a response larger
+//  than the reply buffer is cut.
+//  Notify: Task notified once the request is done, set when it is posted.
+//  Done: Set once the request is done, cleared when it is posted.
+//
+//*****************************************************************************
+
+#define SIM868_REQUEST_AT                           0
+#define SIM868_REQUEST_SIM_CARD_INIT                1
+#define SIM868_REQUEST_GPRS_GSM_INIT                2
+#define SIM868_REQUEST_GPRS_ENABLE                  3
+#define SIM868_REQUEST_HTTP                         4
+
+#if SIM868_RTOS
+struct SIM868_Request
+{
+  uint8_t type;
+  char *at;
+  uint16_t time_out;
+  uint8_t state, method, max_attempts;
+  char *json_structure;
+  char *reply;
+  uint16_t length;
+  uint8_t error_status;
+  uint16_t status_code;
+  uint32_t data_length;
+  TaskHandle_t notify;
+  uint8_t done;
+};
+#endif
+
+//*****************************************************************************
+//
+//  The following is an entry of the trace buffer.
+//  Tick: Time of the event in ms.
+//  At: Beginning of the AT command or unsolicited result code, null
+//  terminated.
+//  Event: SIM868_TRACE_SENT, SIM868_TRACE_DONE or SIM868_TRACE_URC.
+//  Error status: Result of the command, for SIM868_TRACE_DONE.
+//  Elapsed: Round trip time of the command in ms, for SIM868_TRACE_DONE.
+//
+//*****************************************************************************
+
+#define SIM868_TRACE_SENT                           1
+#define SIM868_TRACE_DONE                           2
+#define SIM868_TRACE_URC                            3
+
+struct SIM868_Trace_Entry
+{
+  uint32_t tick;
+  char at[8];
+  uint8_t event, error_status;
+  uint16_t elapsed;
+};
+
+//*****************************************************************************
+//
+//  The following are the counters of a class of AT commands.
+//  Count: Commands completed, including the failed ones.
+//  Timeouts/Errors: Commands without reply, or with an error result code.
+//  Min/Max/Mean: Round trip time in ms of the commands that got a reply.
+//
+//*****************************************************************************
+
+#define SIM868_STATS_OTHER                          0
+#define SIM868_STATS_NETWORK                        1
+#define SIM868_STATS_BEARER                         2
+#define SIM868_STATS_HTTP_SETUP                     3
+#define SIM868_STATS_HTTP_DATA                      4
+#define SIM868_STATS_HTTP_ACTION                    5
+#define SIM868_STATS_HTTP_READ                      6
+#define SIM868_STATS_CLASSES                        7
+
+struct SIM868_Command_Stats
+{
+  uint16_t count, timeouts, errors;
+  uint16_t min, max, mean;
+};
+
+//*****************************************************************************
+//
+//  The following is the snapshot returned by SIM868_get_stats().
+//  Command: Counters of each class of AT commands, SIM868_STATS_OTHER to
+//  SIM868_STATS_HTTP_READ.
+//  Http requests/retries/failures: Requests started, extra attempts made by
+//  SIM868_http_send_request(), and requests that failed.
+//  Bytes sent/received: Characters written to and read from the SIM868,
+//  Rx overruns are the ones dropped because the receive ring was full.
+//  GNSS overruns: Characters of the GNSS output dropped the same way.
+//
+//*****************************************************************************
+
+struct SIM868_Stats
+{
+  struct SIM868_Command_Stats command[SIM868_STATS_CLASSES];
+  uint16_t http_requests, http_retries, http_failures;
+  uint32_t bytes_sent, bytes_received, rx_overruns, gnss_overruns;
+};
+
+//*****************************************************************************
+//
+//  The following is the completion callback of an asynchronous AT command.
+//  The error_status is false when the final result code was a success (OK,
+//  DOWNLOAD or the data prompt), the lines of the reply can be copied with
+//  SIM868_at_read_reply() from within the callback.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_at_callback_t)(uint8_t error_status, void *context);
+
+//*****************************************************************************
+//
+//  The following is the callback of an unsolicited result code, the line is
+//  null terminated and it is only valid during the call.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_urc_callback_t)(char *urc, void *context);
+
+//*****************************************************************************
+//
+//  The following is the completion callback of a task started by one of the
+//  _async() functions of the initialization and the Http request. It is
+//  called from SIM868_poll(), another task can be started from it.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_task_callback_t)(uint8_t error_status, void *context);
+
+//*****************************************************************************
+//
+//  The following is the sink of a streamed Http response. The data is not null
+//  terminated and it is only valid during the call.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_http_sink_t)(char *data, uint16_t length, void *context);
+
+//*****************************************************************************
+//
+//  The following is the completion callback of an asynchronous Http request.
+//  The error_status is false when the server replied OK or CREATED, the length
+//  is the size of the response data left in the SIM868.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_http_callback_t)(uint8_t error_status, uint16_t status_code, uint32_t length, void *context);
+
+//*****************************************************************************
+//
+//  The following is the callback of a message published by the MQTT broker.
+//  The topic and the payload are not null terminated and they are only valid
+//  during the call.
+//
+//*****************************************************************************
+
+typedef void (*SIM868_mqtt_callback_t)(char *topic, uint16_t topic_length, uint8_t *payload, uint16_t length, void *context);
+
 //*****************************************************************************
 //
 //  Prototypes for the API
 //
 //*****************************************************************************
 
+//
+//  AT Command Engine
+//
+extern void SIM868_poll(void);
+extern void SIM868_rx_handler(char incoming_char);
+extern void SIM868_rx_block(const char *data, uint16_t length);
+extern uint8_t SIM868_at_is_busy(void);
+extern uint8_t SIM868_at_get_reply_lines(void);
+extern uint8_t SIM868_at_read_reply(uint8_t line, char *reply, uint8_t length);
+extern uint8_t SIM868_at_send_async(char *at, uint16_t time_out, SIM868_at_callback_t callback, void *context);
+extern void SIM868_at_set_urc_callback(SIM868_urc_callback_t callback, void *context);
+extern void SIM868_at_set_adaptive_timeout(uint8_t state);
+
+//
+//  Tasks, only one runs at a time and the other blocking functions fail while
+//  it is running.
+//
+extern uint8_t SIM868_task_is_running(void);
+
+//
+//  RTOS Port, the requests are the only functions to call from the other
+//  tasks once the modem task runs.
+//
+#if SIM868_RTOS
+extern uint8_t SIM868_rtos_init(void);
+extern uint8_t SIM868_rtos_post(struct SIM868_Request *request);
+extern uint8_t SIM868_rtos_request(struct SIM868_Request *request);
+extern void SIM868_rtos_rx_isr(char incoming_char);
+extern void SIM868_rtos_rx_block_isr(const char *data, uint16_t length);
+#endif
+
+//
+//  Trace Buffer
+//
+extern uint8_t SIM868_trace_get_count(void);
+extern uint8_t SIM868_trace_read(uint8_t index, struct SIM868_Trace_Entry *entry);
+extern void SIM868_trace_clear(void);
+
+//
+//  Statistics
+//
+extern void SIM868_get_stats(struct SIM868_Stats *stats);
+extern void SIM868_clear_stats(void);
+
 //
 //  SIM868
 //
@@ -91,38 +475,121 @@ extern uint8_t SIM868_init(void);
 extern uint8_t SIM868_get_state(void);
 extern uint8_t SIM868_set_power_level(uint8_t state);
 
+//
+//  Low Power
+//
+extern uint8_t SIM868_sleep_enable(uint16_t idle_time);
+extern uint8_t SIM868_sleep_disable(void);
+extern uint8_t SIM868_sleep(void);
+extern void SIM868_wake(void);
+extern uint8_t SIM868_is_sleeping(void);
+
 //
 //  SIM Card
 //
 extern uint8_t SIM868_sim_card_init(void);
+extern uint8_t SIM868_sim_card_init_async(SIM868_task_callback_t callback, void *context);
 
 //
 //  GPRS/GSM (Mobile Network)
 //
 extern void SIM868_gprs_set_apn(uint8_t serivce);
+extern uint8_t SIM868_gprs_set_bearer(const char *apn, const char *user, const char *pwd);
 extern uint8_t SIM868_gprs_enable(uint8_t state);
+extern uint8_t SIM868_gprs_enable_async(uint8_t state, SIM868_task_callback_t callback, void *context);
 extern uint8_t SIM868_gprs_gsm_init(void);
+extern uint8_t SIM868_gprs_gsm_init_async(SIM868_task_callback_t callback, void *context);
+extern void SIM868_gsm_set_registration_timeout(uint32_t time_out);
+extern uint8_t SIM868_gsm_get_registration_status(void);
+extern uint16_t SIM868_gsm_get_lac(void);
+extern uint32_t SIM868_gsm_get_cell_id(void);
 
 //
 //  GNSS (Global Navigation Satellite System )
 //
+extern void SIM868_gnss_poll(void);
+extern void SIM868_gnss_rx_handler(char incoming_char);
+extern void SIM868_gnss_rx_block(const char *data, uint16_t length);
+extern void SIM868_gnss_parse(char *data, uint16_t length);
 extern uint8_t SIM868_gnss_get_fix_status(void);
 extern void SIM868_gnss_set_power_level(uint8_t state);
 extern uint8_t SIM868_gnss_get_data(float *lat, float *lon, uint8_t *speed_kph);
+extern uint8_t SIM868_gnss_get_position(int32_t *lat, int32_t *lon, uint16_t *speed_cms);
 extern uint8_t SIM868_gnss_get_seconds(void);
 extern uint8_t SIM868_gnss_get_minutes(void);
 extern uint8_t SIM868_gnss_get_hour(void);
 extern uint8_t SIM868_gnss_get_day(void);
 extern uint8_t SIM868_gnss_get_month(void);
 extern uint16_t SIM868_gnss_get_year(void);
+extern float SIM868_gnss_get_hdop(void);
+extern uint16_t SIM868_gnss_get_hdop_x100(void);
+extern uint8_t SIM868_gnss_get_satellites(void);
+extern uint8_t SIM868_gnss_get_satellites_in_view(void);
+extern uint8_t SIM868_gnss_get_fix_mode(void);
+extern float SIM868_gnss_get_altitude(void);
+extern float SIM868_gnss_get_course(void);
+
+//
+//  Time Service
+//
+extern void SIM868_time_set_zone(int16_t minutes);
+extern void SIM868_time_pps_isr(void);
+extern uint8_t SIM868_time_get_utc(uint32_t *seconds, uint16_t *ms);
+extern uint8_t SIM868_time_get_local(uint32_t *seconds, uint16_t *ms);
+extern uint8_t SIM868_time_read(void);
+
+//
+//  Report Batch
+//
+extern void SIM868_batch_set_threshold(uint8_t count, uint16_t max_age);
+extern uint8_t SIM868_batch_add_fix(float lat, float lon, uint8_t speed_kph);
+extern uint8_t SIM868_batch_add_position(int32_t lat, int32_t lon, uint8_t speed_kph);
+extern uint8_t SIM868_batch_is_due(void);
+extern uint8_t SIM868_batch_get_count(void);
+extern uint16_t SIM868_batch_encode(uint8_t *buffer, uint16_t length);
+extern uint8_t SIM868_batch_send(uint8_t max_attempts);
+
+//
+//  Report Store
+//
+extern uint16_t SIM868_store_get_count(void);
+extern uint16_t SIM868_store_get_dropped(void);
+extern uint8_t SIM868_store_forward(uint8_t max_batches, uint8_t max_attempts);
 
 // Http Protocol
-extern void SIM868_http_set_root(char* root);
-extern void SIM868_http_set_user_data(char* user_data);
-extern void SIM868_http_set_user_agent(char* user_agent);
-extern void SIM868_http_set_web_serivce(char* web_service);
-extern void SIM868_http_set_content_type(char* content_type);
+extern uint8_t SIM868_http_set_root(const char* root);
+extern uint8_t SIM868_http_set_user_data(const char* user_data);
+extern uint8_t SIM868_http_set_user_agent(const char* user_agent);
+extern uint8_t SIM868_http_set_web_serivce(const char* web_service);
+extern uint8_t SIM868_http_set_content_type(const char* content_type);
 extern void SIM868_http_set_json_structure(char* json_structure);
+extern void SIM868_http_set_keep_alive(uint8_t state);
 extern uint8_t SIM868_http_send_request(uint8_t method, uint8_t max_attempts);
+extern uint8_t SIM868_http_send_request_async(uint8_t method, uint8_t max_attempts, SIM868_task_callback_t callback, void *context);
+extern uint8_t SIM868_http_request_async(uint8_t method, SIM868_http_callback_t callback, void *context);
+extern uint8_t SIM868_http_is_pending(void);
+extern uint8_t SIM868_http_get_error_status(void);
+extern uint16_t SIM868_http_get_status_code(void);
+extern uint16_t SIM868_http_get_response(char *response, uint16_t length);
+extern uint32_t SIM868_http_get_response_length(void);
+extern uint8_t SIM868_http_read_stream(SIM868_http_sink_t sink, uint16_t chunk_size, void *context);
+
+// Socket
+extern uint8_t SIM868_socket_open(uint8_t protocol, char *host, uint16_t port);
+extern uint8_t SIM868_socket_close(void);
+extern uint8_t SIM868_socket_is_open(void);
+extern uint8_t SIM868_socket_send(uint8_t *data, uint16_t length);
+extern uint8_t SIM868_socket_available(void);
+extern uint16_t SIM868_socket_receive(uint8_t *data, uint16_t length);
+
+// MQTT Protocol
+extern void SIM868_mqtt_set_buffer(uint8_t *buffer, uint16_t length);
+extern void SIM868_mqtt_set_callback(SIM868_mqtt_callback_t callback, void *context);
+extern uint8_t SIM868_mqtt_connect(char *host, uint16_t port, char *client_id, char *user, char *pwd, uint16_t keep_alive);
+extern uint8_t SIM868_mqtt_disconnect(void);
+extern uint8_t SIM868_mqtt_is_connected(void);
+extern uint8_t SIM868_mqtt_publish(char *topic, uint8_t *payload, uint16_t length, uint8_t qos);
+extern uint8_t SIM868_mqtt_subscribe(char *topic, uint8_t qos);
+extern void SIM868_mqtt_poll(void);
 
 #endif